@@ -1,32 +1,135 @@
 ﻿// bw_disp.c
 
+#include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 #include "esp_err.h"
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
 
 #include "bw_disp.h"
+#include "disp_handle_table.h"
+#include "disp_stats.h"
+#include "disp_trace.h"
 
 /** @file */
 
 /** Maximum number of display instances */
-#define MAX_DISP_INST_NUM 128 
-/** Maximum number of pages */
-#define MAX_PAGE_NUM 8
+#define MAX_DISP_INST_NUM 128
+/** Maximum number of pages of a panel */
+#define MAX_PAGE_NUM BWD_MAX_PAGE_NUM
+/** Maximum number of column runs sent in a single batched transfer */
+#define BWD_BATCH_MAX_RUNS 16
+/** Bus cost (in bytes) of addressing a separate column run in a batched transfer: 3 page/column commands with
+ *  their control bytes, control byte of the data stream, repeated START and address.
+ *  Unchanged bytes between two changed runs are sent if there are not more of them than that. */
+#define BWD_DIFF_RUN_COST 9
+/** Columns of a compressed image decoded at a time */
+#define BWD_RLE_CHUNK 128
+/** Longest run (or literal) of a single compressed image token */
+#define BWD_RLE_MAX_RUN 64
+/** Columns of a row-major bitmap transposed at a time (multiple of 8) */
+#define BWD_BITMAP_CHUNK 64
+
+#define BWD_RLE_LITERAL     0x00    ///< Compressed image token: n + 1 literal bytes follow
+#define BWD_RLE_ZEROS       0x40    ///< Compressed image token: n + 1 bytes 0x00
+#define BWD_RLE_ONES        0x80    ///< Compressed image token: n + 1 bytes 0xFF
+#define BWD_RLE_REPEAT      0xC0    ///< Compressed image token: n + 1 copies of the next byte
+
+/** Stack size of the refresh task */
+#define BWD_REFRESH_TASK_STACK_SIZE 3072
+
+#define BWD_EVT_REQUEST     BIT0    ///< Refresh requested
+#define BWD_EVT_IDLE        BIT1    ///< No refresh pending or in progress
+#define BWD_EVT_STOP        BIT2    ///< Refresh task stop requested
+#define BWD_EVT_STOPPED     BIT3    ///< Refresh task stopped
+#define BWD_EVT_NO_WAITERS  BIT4    ///< No task waits for the refresh (bw_disp_refresh_wait)
 
 
 #define TAG "BW_DISP"
 
-/** @brief rectangle */
-typedef struct 
+typedef uint32_t __attribute__((__may_alias__)) bwd_word_t;    ///< Word used to process display buffer bytes 4 at a time
+
+#define BWD_ALWAYS_INLINE static inline __attribute__((always_inline))
+
+/** @brief Batch of column runs sent to the display in a single transfer */
+typedef struct
+{
+    int run_num;                                                    ///< Number of runs in the batch
+    uint8_t page[BWD_BATCH_MAX_RUNS];                               ///< Page of each run
+    bw_disp_span_t run[BWD_BATCH_MAX_RUNS];                             ///< Column span of each run
+    uint8_t commands[BWD_BATCH_MAX_RUNS][BWD_PAGE_COL_CMD_MAX_LEN]; ///< Page/column address commands of each run
+    disp_proto_seg_t segments[2 * BWD_BATCH_MAX_RUNS + 1];          ///< Transfer segments (commands and data of each run, tail commands)
+    uint8_t tail_commands[1];                                       ///< Commands sent after the runs (display start line)
+    int tail_len;                                                   ///< Number of tail commands (0 - none)
+} bwd_batch_t;
+
+/** @brief State of the asynchronous refresh */
+typedef struct
+{
+    TaskHandle_t task;                        ///< Refresh task
+    EventGroupHandle_t events;                ///< Refresh task events (BWD_EVT_*)
+    SemaphoreHandle_t lock;                   ///< Protects the front buffer and its dirty spans
+    esp_err_t last_err;                       ///< Result of the last failed transfer (ESP_OK if none)
+    int waiters;                              ///< Number of tasks waiting for the refresh (they keep the state alive)
+    bw_disp_span_t front_dirty[MAX_PAGE_NUM]; ///< Dirty spans of the front buffer
+    bw_disp_span_t tx_dirty[MAX_PAGE_NUM];    ///< Dirty spans of the transfer buffer
+    uint16_t front_start_line;                ///< Display start line of the front buffer
+    uint16_t tx_start_line;                   ///< Display start line of the transfer buffer
+    uint8_t* front;                           ///< Front buffer - last frame submitted for refresh
+    uint8_t* tx;                              ///< Transfer buffer - frame being sent by the refresh task
+
+    uint8_t buffers[];                        ///< Front and transfer buffers
+} bwd_async_t;
+
+#if BW_DISP_STATS
+/** @brief Traffic of the frame being sent (added to the counters when the frame is done) */
+typedef struct
+{
+    uint32_t transfers;                 ///< Batched transfers sent
+    uint32_t pages;                     ///< Pages with runs
+    uint32_t runs;                      ///< Column runs
+    uint32_t columns;                   ///< Columns of all runs
+    uint32_t command_bytes;             ///< Addressing command bytes of all runs
+    int last_page;                      ///< Page of the last run
+} bwd_frame_stats_t;
+
+/** Counts call of a drawing primitive */
+#define BWD_STATS_PRIM(inst, prim)      ((inst)->stats.primitives[(prim)]++)
+#else
+#define BWD_STATS_PRIM(inst, prim)
+#endif
+
+
+/** @brief Viewport of a canvas on its display */
+typedef struct
 {
-    uint16_t x;
-    uint16_t y;
-    uint16_t width;
-    uint16_t height;
-} bwd_rect_t;
+    bw_disp_handle_t disp;              ///< Display showing the canvas
+    bw_disp_if_t canvas_if;             ///< Interface of the canvas (display interface with canvas dimensions)
+    bw_image_t *image;                  ///< Canvas buffer as an image
+    uint16_t width;                     ///< Viewport width (display width)
+    uint16_t height;                    ///< Viewport height (display height)
+    uint16_t x;                         ///< Viewport position - x
+    uint16_t y;                         ///< Viewport position - y
+    uint16_t shown_x;                   ///< Viewport position copied to the display buffer - x
+    uint16_t shown_y;                   ///< Viewport position copied to the display buffer - y
+    bool shown;                         ///< Display buffer holds the viewport
+    bw_disp_span_t* dirty;              ///< Dirty spans of the canvas pages (following the pages)
+    uint8_t* pages[];                   ///< Pages of the canvas buffer
+} bwd_view_t;
 
+/** @brief Frame of a display rotated by 90/270 degrees: the display buffer transposed into the panel layout */
+typedef struct
+{
+    bw_disp_if_t rotated_if;                ///< Interface with width and height swapped (used by drawing functions)
+    bw_disp_span_t dirty[MAX_PAGE_NUM];     ///< Dirty spans of the frame (panel pages)
+    uint8_t* buffer;                        ///< Frame (following the rotated dirty spans)
+    bw_disp_span_t* rotated_dirty;          ///< Dirty spans of the display buffer pages (following the pages)
+    uint8_t* rotated_pages[];               ///< Pages of the display buffer (rotated_if.page_num)
+} bwd_transpose_t;
 
 /** @brief Black and white display type.
  * 
@@ -37,57 +140,202 @@ typedef struct
     bw_disp_handle_t handle;            ///< Display handle
     disp_proto_handle_t comm_handle;    ///< Communication protocol handle
     
-    bw_disp_if_t* disp_if;              ///< Display interface
-    uint8_t page_num;                   ///< Number of pages
-    uint8_t* pages[MAX_PAGE_NUM];       ///< Array of pointers to the beginnings of pages in a display buffer
-    bwd_rect_t dirty_rect;              ///< "Dirty" part of the display, that needs to be refreshed
+    bw_disp_if_t* disp_if;              ///< Display interface (dimensions of the display buffer)
+    bw_disp_if_t* panel_if;             ///< Interface of the panel (differs from disp_if if rotated by 90/270 degrees)
+    uint16_t page_num;                  ///< Number of pages
+    uint8_t panel_page_num;             ///< Number of pages of the panel
+    uint8_t** pages;                    ///< Array of pointers to the beginnings of pages in a display buffer
+    bw_disp_span_t* dirty;              ///< "Dirty" column span of each page, that needs to be refreshed
+    uint8_t* panel_pages[MAX_PAGE_NUM]; ///< Pages of a buffer in the panel layout (canvases and rotated displays have their own)
+    bw_disp_span_t panel_dirty[MAX_PAGE_NUM];   ///< Dirty spans of a buffer in the panel layout
+    bw_disp_surface_t surface;          ///< Drawing surface (display buffer and dirty spans)
+    bw_disp_refresh_mode_t refresh_mode;    ///< Refresh mode
+    uint16_t start_line;                ///< Start line set on the display (changed only by whoever sends frames)
+    uint8_t* shadow;                    ///< Copy of the display buffer as last sent to the display (BWDR_DIFF mode only)
+    bw_disp_span_t shadow_stale[MAX_PAGE_NUM];  ///< Spans not sent since the shadow was created - sent whatever their content
+    bwd_batch_t batch;                  ///< Refresh transfer batch
+    bwd_async_t* async;                 ///< Asynchronous refresh state (NULL if refresh task is not running)
+    SemaphoreHandle_t lock;             ///< Display lock (recursive) - taken by drawing functions and bw_disp_lock
+    bwd_view_t* view;                   ///< Viewport (canvases only; NULL for displays)
+    bwd_transpose_t* transposed;        ///< Transposed frame (rotation by 90/270 degrees only)
+#if BW_DISP_STATS
+    portMUX_TYPE stats_lock;            ///< Protects refresh counters (updated by the refresh task without the display lock)
+    bw_disp_stats_t stats;              ///< Performance counters (primitive counters are protected by the display lock)
+    bwd_frame_stats_t frame;            ///< Traffic of the frame being sent
+#endif
 
     uint16_t buffer_size;               ///< Display buffer size
+    uint8_t* buffer;                    ///< Display buffer (in the storage)
     
-    uint8_t buffer[];                   ///< Display buffer
+    uint8_t storage[];                  ///< Display buffer (preceded by the image header for canvases)
 } bw_disp_t;
 
 extern bw_disp_if_t bw_disp_sh1106_128x64_if;   ///< Display interface definition for 128x64 display using SH1106 driver
 
-static int s_bw_disp_inst_num = 0;              ///< Number of display instances
-static int s_bw_disp_inst_free_num = 0;         ///< Number of free (dealocated) display instances
+DISP_HANDLE_TABLE_DEFINE(s_bw_disp_instances, MAX_DISP_INST_NUM);  ///< Display instances
+/** Display locks by slot of the instance table. A lock is created with the first instance in its slot and kept
+ *  for the next ones, so a task waiting for the lock of a display being closed wakes up on a valid mutex. */
+static SemaphoreHandle_t s_bw_disp_locks[MAX_DISP_INST_NUM];
+
+static bw_disp_t* bw_disp_get_instance(bw_disp_handle_t handle)
+{
+    bw_disp_t *inst = (bw_disp_t *) disp_handle_get(&s_bw_disp_instances, handle);
+    if (inst == NULL)
+    {
+        ESP_LOGE(TAG, "Invalid handle: #%d", handle);
+    }
+    return inst;
+}
+
+// Gets the instance and locks it (NULL if the handle is invalid)
+static bw_disp_t* bw_disp_lock_instance(bw_disp_handle_t handle)
+{
+    bw_disp_t *inst = bw_disp_get_instance(handle);
+    if (inst == NULL)
+    {
+        return NULL;
+    }
+    // the lock of the slot (the instance could be freed meanwhile; NULL while the instance is being published)
+    SemaphoreHandle_t lock = __atomic_load_n(&(s_bw_disp_locks[disp_handle_index(&s_bw_disp_instances, handle)]), __ATOMIC_ACQUIRE);
+    if (lock == NULL)
+    {
+        ESP_LOGE(TAG, "Invalid handle: #%d", handle);
+        return NULL;
+    }
+    xSemaphoreTakeRecursive(lock, portMAX_DELAY);
+    // the display could have been closed while waiting for the lock
+    if (disp_handle_get(&s_bw_disp_instances, handle) != inst)
+    {
+        ESP_LOGE(TAG, "Invalid handle: #%d", handle);
+        xSemaphoreGiveRecursive(lock);
+        return NULL;
+    }
+    return inst;
+}
+
+// Publishes the complete instance with the lock of its slot (created for the first instance in the slot)
+static bw_disp_handle_t bw_disp_publish(bw_disp_t *inst)
+{
+    bw_disp_handle_t handle = disp_handle_alloc(&s_bw_disp_instances, inst);
+    if (handle == INVALID_HANDLE)
+    {
+        ESP_LOGE(TAG, "Too many instances!");
+        return INVALID_HANDLE;
+    }
+    // the slot is not used by anyone else until the handle is freed
+    SemaphoreHandle_t *slot_lock = &(s_bw_disp_locks[disp_handle_index(&s_bw_disp_instances, handle)]);
+    inst->lock = *slot_lock;
+    if (inst->lock == NULL)
+    {
+        inst->lock = xSemaphoreCreateRecursiveMutex();
+        if (inst->lock == NULL)
+        {
+            ESP_LOGE(TAG, "Failed to create display lock");
+            disp_handle_free(&s_bw_disp_instances, handle);
+            return INVALID_HANDLE;
+        }
+        __atomic_store_n(slot_lock, inst->lock, __ATOMIC_RELEASE);
+    }
+    return handle;
+}
+
+// Unlocks instance locked by BWD_LOCKED_INSTANCE when it goes out of scope
+static inline void bw_disp_unlock_cleanup(bw_disp_t **instPtr)
+{
+    if (*instPtr != NULL)
+    {
+        xSemaphoreGiveRecursive((*instPtr)->lock);
+    }
+}
+
+/** Declares inst - instance of the handle, locked until the end of the scope (NULL if the handle is invalid) */
+#define BWD_LOCKED_INSTANCE(inst, handle) \
+    bw_disp_t *inst __attribute__((cleanup(bw_disp_unlock_cleanup))) = bw_disp_lock_instance(handle)
+
+
+static void bw_disp_clear_spans(bw_disp_span_t spans[], int page_num)
+{
+    for (int page = 0; page < page_num; page++)
+    {
+        spans[page].x0 = 0xFFFF;
+        spans[page].x1 = 0;
+    }
+}
 
-static bw_disp_t **s_bw_disp_instances = NULL;  ///< Array of display instances
+static bool bw_disp_is_span_empty(const bw_disp_span_t *span)
+{
+    return span->x0 > span->x1;
+}
 
+static void bw_disp_merge_span(bw_disp_span_t *span, uint16_t x0, uint16_t x1)
+{
+    span->x0 = MIN(x0, span->x0);
+    span->x1 = MAX(x1, span->x1);
+}
 
 static void bw_disp_clear_dirty_rect(bw_disp_t *inst)
 {
     assert(inst != NULL);
-    inst->dirty_rect.x = inst->dirty_rect.y = 0;
-    inst->dirty_rect.width = inst->dirty_rect.height = 0;    
+    bw_disp_clear_spans(inst->dirty, inst->page_num);
 }
 
+// Checks whether the frame has to be sent: some pages are dirty or the display has been scrolled since the last frame
 static bool bw_disp_is_dirty(bw_disp_t *inst)
 {
     assert(inst != NULL);
-    return (inst->dirty_rect.width > 0) && (inst->dirty_rect.height > 0);
+    uint16_t start_line = (inst->async != NULL) ? inst->async->front_start_line : inst->start_line;
+    if (inst->surface.scroll != start_line)
+    {
+        return true;
+    }
+    for (int page = 0; page < inst->page_num; page++)
+    {
+        if (!bw_disp_is_span_empty(&(inst->dirty[page])))
+        {
+            return true;
+        }
+    }
+    if (inst->transposed != NULL)
+    {
+        // blocks transposed but not sent yet
+        for (int page = 0; page < inst->panel_page_num; page++)
+        {
+            if (!bw_disp_is_span_empty(&(inst->transposed->dirty[page])))
+            {
+                return true;
+            }
+        }
+    }
+    return false;
 }
 
 static void bw_disp_set_dirty_rect(bw_disp_t *inst, uint16_t x, uint16_t y, uint16_t width, uint16_t height)
 {
     assert(inst != NULL);
     assert(width > 0 && height > 0);
-    if (!bw_disp_is_dirty(inst))
-    {        
-        inst->dirty_rect.x = x;
-        inst->dirty_rect.y = y;
-        inst->dirty_rect.width = width;
-        inst->dirty_rect.height = height;        
-        return;
+    uint16_t x1 = x + width - 1;
+    int first_page = y >> 3;
+    int last_page = (y + height - 1) >> 3;
+    for (int page = first_page; page <= last_page; page++)
+    {
+        bw_disp_merge_span(&(inst->dirty[page]), x, x1);
     }
-    uint16_t x0 = MIN(x, inst->dirty_rect.x);
-    uint16_t y0 = MIN(y, inst->dirty_rect.y);
-    uint16_t x1 = MAX(x + width - 1, inst->dirty_rect.x + inst->dirty_rect.width - 1);
-    uint16_t y1 = MAX(y + height - 1, inst->dirty_rect.y + inst->dirty_rect.height - 1);
-    inst->dirty_rect.x = x0;
-    inst->dirty_rect.y = y0;
-    inst->dirty_rect.width = x1 - x0 + 1;
-    inst->dirty_rect.height = y1 - y0 + 1;
+}
+
+// Sets up pages and the drawing surface (disp_if, page_num, buffer and the page arrays have to be set)
+static void bw_disp_init_surface(bw_disp_t *inst)
+{
+    uint16_t width = inst->disp_if->width;
+    bw_disp_clear_dirty_rect(inst);
+    for (int i = 0; i < inst->page_num; i++)
+    {
+        inst->pages[i] = &(inst->buffer[i * width]);
+    }
+    inst->surface.width = width;
+    inst->surface.height = inst->disp_if->height;
+    inst->surface.page_num = inst->page_num;
+    inst->surface.buffer = inst->buffer;
+    inst->surface.dirty = inst->dirty;
 }
 
 bw_disp_handle_t bw_disp_init(disp_proto_handle_t comm_handle, bw_disp_type_t disp_type)
@@ -113,314 +361,1668 @@ bw_disp_handle_t bw_disp_init(disp_proto_handle_t comm_handle, bw_disp_type_t di
     assert(page_num <= MAX_PAGE_NUM);
     assert((int) page_num * width <= 0xFFFF);
     uint16_t buffer_size = page_num * width;
-    int inst_no = -1;
-    if (s_bw_disp_inst_free_num == 0)
-    {
-        if (s_bw_disp_inst_num >= MAX_DISP_INST_NUM)
-        {
-            ESP_LOGE(TAG, "Too many instances!");
-            return INVALID_HANDLE;
-        }
-        inst_no = s_bw_disp_inst_num;
-        bw_disp_t **instPtr = (bw_disp_t **) realloc(s_bw_disp_instances, (s_bw_disp_inst_num + 1) * sizeof(bw_disp_t *));
-        if (instPtr == NULL)
-        {
-            ESP_LOGE(TAG, "Failed to allocate memory for instances");
-            return INVALID_HANDLE;
-        }
-        s_bw_disp_instances = instPtr;
-        s_bw_disp_instances[s_bw_disp_inst_num] = NULL;
-        s_bw_disp_inst_num++;
-    }
-    else
-    {
-        for (int i = 0; i < s_bw_disp_inst_num; i++)
-        {
-            if (s_bw_disp_instances[i] == NULL)
-            {
-                inst_no = i;
-                break;
-            }
-        }
-    }
-    assert((inst_no >= 0) && (inst_no < s_bw_disp_inst_num));
-    s_bw_disp_instances[inst_no] = (bw_disp_t *) calloc(1, sizeof(bw_disp_t) + buffer_size);
-    if (s_bw_disp_instances[inst_no] == NULL)
+    bw_disp_t *inst = (bw_disp_t *) calloc(1, sizeof(bw_disp_t) + buffer_size);
+    if (inst == NULL)
     {
         ESP_LOGE(TAG, "Failed to allocate instance memory");
         return INVALID_HANDLE;
     }
-    bw_disp_t *inst = s_bw_disp_instances[inst_no];
     inst->type = disp_type;
-    inst->handle = inst_no + 1;
+#if BW_DISP_STATS
+    portMUX_INITIALIZE(&(inst->stats_lock));
+#endif
     inst->comm_handle = comm_handle;
     inst->disp_if = disp_if;
+    inst->panel_if = disp_if;
     inst->page_num = page_num;    
+    inst->panel_page_num = page_num;
+    inst->pages = inst->panel_pages;
+    inst->dirty = inst->panel_dirty;
     inst->buffer_size = buffer_size;
-    for (int i = 0; i < page_num; i++)
-    {
-        inst->pages[i] = &(inst->buffer[i * width]);
-    }
+    inst->buffer = inst->storage;
+    bw_disp_init_surface(inst);
     esp_err_t ret = disp_proto_write_commands(inst->comm_handle, inst->disp_if->init_commands.buf, inst->disp_if->init_commands.sz);
     if (ret != ESP_OK)
     {
         ESP_LOGE(TAG, "Display initialization failed");
-        free(s_bw_disp_instances[inst_no]);
-        s_bw_disp_instances[inst_no] = NULL;
-        s_bw_disp_inst_free_num++;
+        free(inst);
         return INVALID_HANDLE;
     }    
     bw_disp_set_dirty_rect(inst, 0, 0, inst->disp_if->width, inst->disp_if->height);
+    // the instance is complete before its handle is published
+    inst->handle = bw_disp_publish(inst);
+    if (inst->handle == INVALID_HANDLE)
+    {
+        free(inst);
+        return INVALID_HANDLE;
+    }
     ESP_LOGI(TAG, "Display initialized. Handle: #%d; Type: %d; W: %d; H: %d", inst->handle, disp_type, inst->disp_if->width, inst->disp_if->height);
     return inst->handle;
 }
 
-static bw_disp_t* bw_disp_get_instance(bw_disp_handle_t handle)
+bw_disp_handle_t bw_disp_canvas_create(bw_disp_handle_t disp, uint16_t width, uint16_t height)
 {
-    if ((handle == 0) || (handle > s_bw_disp_inst_num) || (s_bw_disp_instances[handle - 1] == NULL))
+    bw_disp_t *disp_inst = bw_disp_get_instance(disp);
+    if (disp_inst == NULL)
     {
-        ESP_LOGE(TAG, "Invalid handle: #%d", handle);
-        return NULL;
+        return INVALID_HANDLE;
+    }
+    if (disp_inst->view != NULL)
+    {
+        ESP_LOGE(TAG, "Canvas cannot be shown on another canvas. Handle: #%d", disp);
+        return INVALID_HANDLE;
+    }
+    int page_num = (height + 7) / 8;
+    if (width < disp_inst->disp_if->width || height < disp_inst->disp_if->height || page_num * width > 0xFFFF)
+    {
+        ESP_LOGE(TAG, "Invalid canvas size: %dx%d", width, height);
+        return INVALID_HANDLE;
     }
-    return s_bw_disp_instances[handle - 1];
+    uint16_t buffer_size = page_num * width;
+    bw_disp_t *inst = (bw_disp_t *) calloc(1, sizeof(bw_disp_t) + sizeof(bw_image_t) + buffer_size);
+    // page arrays are sized for the canvas and follow the view
+    bwd_view_t *view = (bwd_view_t *) calloc(1, sizeof(bwd_view_t) + page_num * (sizeof(uint8_t *) + sizeof(bw_disp_span_t)));
+    if (inst == NULL || view == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to allocate canvas memory");
+        free(view);
+        free(inst);
+        return INVALID_HANDLE;
+    }
+    inst->type = disp_inst->type;
+#if BW_DISP_STATS
+    portMUX_INITIALIZE(&(inst->stats_lock));
+#endif
+    inst->comm_handle = INVALID_HANDLE;
+    view->disp = disp;
+    view->canvas_if = *(disp_inst->disp_if);
+    view->canvas_if.width = width;
+    view->canvas_if.height = height;
+    view->canvas_if.page_num = page_num;
+    view->dirty = (bw_disp_span_t *) &(view->pages[page_num]);
+    view->width = disp_inst->disp_if->width;
+    view->height = disp_inst->disp_if->height;
+    // the canvas buffer follows the image header, so the canvas is an image as well
+    view->image = (bw_image_t *) inst->storage;
+    view->image->width = width;
+    view->image->height = height;
+    view->image->format = BWIF_RAW;
+    inst->view = view;
+    inst->disp_if = &(view->canvas_if);
+    inst->panel_if = inst->disp_if;
+    inst->page_num = page_num;
+    inst->panel_page_num = page_num;
+    inst->pages = view->pages;
+    inst->dirty = view->dirty;
+    inst->buffer_size = buffer_size;
+    inst->buffer = view->image->image;
+    bw_disp_init_surface(inst);
+    inst->handle = bw_disp_publish(inst);
+    if (inst->handle == INVALID_HANDLE)
+    {
+        free(view);
+        free(inst);
+        return INVALID_HANDLE;
+    }
+    ESP_LOGI(TAG, "Canvas created. Handle: #%d; Display: #%d; W: %d; H: %d", inst->handle, disp, width, height);
+    return inst->handle;
 }
 
-
-esp_err_t bw_disp_close(bw_disp_handle_t handle)
+esp_err_t bw_disp_set_viewport(bw_disp_handle_t canvas, uint16_t x, uint16_t y)
 {
-    bw_disp_t *inst = bw_disp_get_instance(handle);
+    BWD_LOCKED_INSTANCE(inst, canvas);
     if (inst == NULL)
     {
         return ESP_ERR_INVALID_ARG;
     }
-    esp_err_t ret = disp_proto_write_commands(inst->comm_handle, inst->disp_if->close_commands.buf, inst->disp_if->close_commands.sz);
-    if (ret != ESP_OK)
+    bwd_view_t *view = inst->view;
+    if (view == NULL)
     {
-        ESP_LOGE(TAG, "Failed to close/shutdown the display. Handle: #%d.", handle);
+        ESP_LOGE(TAG, "Not a canvas. Handle: #%d", canvas);
+        return ESP_ERR_INVALID_ARG;
     }
-    esp_err_t ret2 = disp_proto_close(inst->comm_handle);
-    if (ret2 != ESP_OK)
+    if ((x + view->width) > inst->disp_if->width || (y + view->height) > inst->disp_if->height)
     {
-        ESP_LOGE(TAG, "Failed to close display connection. Handle: #%d. Comm handle: #%d", handle, inst->comm_handle);
+        ESP_LOGE(TAG, "Viewport does not fit in the canvas: %d, %d. Handle: #%d", x, y, canvas);
+        return ESP_ERR_INVALID_ARG;
     }
-    free(inst);
-    s_bw_disp_instances[handle - 1] = NULL;
-    s_bw_disp_inst_free_num++;
-    return ret != ESP_OK ? ret : ret2;
+    view->x = x;
+    view->y = y;
+    return ESP_OK;
 }
 
-esp_err_t bw_disp_clear(bw_disp_handle_t handle)
+const bw_image_t* bw_disp_get_canvas_image(bw_disp_handle_t canvas)
 {
-    return bw_disp_fill(handle, BWDC_BLACK);
+    bw_disp_t *inst = bw_disp_get_instance(canvas);
+    if (inst == NULL || inst->view == NULL)
+    {
+        return NULL;
+    }
+    return inst->view->image;
 }
 
-esp_err_t bw_disp_fill(bw_disp_handle_t handle, bw_disp_clr_t c)
+esp_err_t bw_disp_lock(bw_disp_handle_t handle)
+{
+    return (bw_disp_lock_instance(handle) != NULL) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t bw_disp_unlock(bw_disp_handle_t handle)
 {
     bw_disp_t *inst = bw_disp_get_instance(handle);
     if (inst == NULL)
     {
         return ESP_ERR_INVALID_ARG;
     }
-    memset(inst->buffer, c == BWDC_BLACK ? 0x00 : 0xFF, inst->buffer_size);
-    bw_disp_set_dirty_rect(inst, 0, 0, inst->disp_if->width, inst->disp_if->height);
-    return ESP_OK;
+    return (xSemaphoreGiveRecursive(inst->lock) == pdTRUE) ? ESP_OK : ESP_ERR_INVALID_STATE;
 }
 
-esp_err_t bw_disp_refresh(bw_disp_handle_t handle)
+esp_err_t bw_disp_get_stats(bw_disp_handle_t handle, bw_disp_stats_t *stats)
 {
-    bw_disp_t *inst = bw_disp_get_instance(handle);
-    if (inst == NULL)
+#if BW_DISP_STATS
+    BWD_LOCKED_INSTANCE(inst, handle);
+    if ((inst == NULL) || (stats == NULL))
     {
         return ESP_ERR_INVALID_ARG;
     }
-    if (!bw_disp_is_dirty(inst))
-    {
-        return ESP_OK;
-    }
-    esp_err_t ret;    
-    uint8_t first_page = (inst->dirty_rect.y >> 3);
-    uint8_t last_page = (inst->dirty_rect.y + inst->dirty_rect.height - 1) >> 3;    
-    for (int page = first_page; page <= last_page; page++)
+    taskENTER_CRITICAL(&(inst->stats_lock));
+    *stats = inst->stats;
+    taskEXIT_CRITICAL(&(inst->stats_lock));
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+esp_err_t bw_disp_reset_stats(bw_disp_handle_t handle)
+{
+#if BW_DISP_STATS
+    BWD_LOCKED_INSTANCE(inst, handle);
+    if (inst == NULL)
     {
-        ret = inst->disp_if->set_page_col(inst->comm_handle, page, inst->disp_if->first_col + inst->dirty_rect.x);
-        if (ret != ESP_OK)
-        {
-            ESP_LOGE(TAG, "Failed to set page/column address. Handle: #%d. Page: %d", handle, page);
-            return ret;
-        }
-        ret = disp_proto_write_data(inst->comm_handle, &(inst->buffer[page * inst->disp_if->width + inst->dirty_rect.x]), inst->dirty_rect.width);
-        if (ret != ESP_OK)
-        {
-            ESP_LOGE(TAG, "Failed to write page data. Handle: #%d. Page: %d", handle, page);
-            return ret;
-        }        
+        return ESP_ERR_INVALID_ARG;
     }
-    bw_disp_clear_dirty_rect(inst);
+    taskENTER_CRITICAL(&(inst->stats_lock));
+    memset(&(inst->stats), 0, sizeof(inst->stats));
+    taskEXIT_CRITICAL(&(inst->stats_lock));
     return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
 }
 
-esp_err_t bw_disp_set_pixel(bw_disp_handle_t handle, uint16_t x, uint16_t y, bw_disp_clr_t c)
+#if BW_DISP_STATS
+void bw_disp_stats_prim(bw_disp_handle_t handle, bw_disp_prim_t prim)
 {
     bw_disp_t *inst = bw_disp_get_instance(handle);
-    if (inst == NULL)
+    if (inst != NULL)
     {
-        return ESP_ERR_INVALID_ARG;
+        BWD_STATS_PRIM(inst, prim);
     }
-    if (x >= inst->disp_if->width || y >= inst->disp_if->height)
+}
+#endif
+
+esp_err_t bw_disp_close(bw_disp_handle_t handle)
+{
+    bw_disp_t *inst = bw_disp_lock_instance(handle);
+    if (inst == NULL)
     {
         return ESP_ERR_INVALID_ARG;
     }
-    int page = y >> 3;
-    int y_bit = 1 << (y & 0x07);
-    if (c == BWDC_BLACK)
+    esp_err_t ret = ESP_OK;
+    esp_err_t ret2 = ESP_OK;
+    // a canvas has no connection of its own
+    if (inst->view == NULL)
     {
-        inst->pages[page][x] &= !y_bit;
+        // the refresh task does not take the display lock - it has to be gone before the connection is closed
+        bw_disp_stop_async(handle);
+        ret = disp_proto_write_commands(inst->comm_handle, inst->disp_if->close_commands.buf, inst->disp_if->close_commands.sz);
+        if (ret != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to close/shutdown the display. Handle: #%d.", handle);
+        }
+        ret2 = disp_proto_close(inst->comm_handle);
+        if (ret2 != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to close display connection. Handle: #%d. Comm handle: #%d", handle, inst->comm_handle);
+        }
     }
-    else
+    // tasks waiting for the lock find the handle invalid (the lock stays with the slot)
+    SemaphoreHandle_t lock = inst->lock;
+    disp_handle_free(&s_bw_disp_instances, handle);
+    free(inst->shadow);
+    free(inst->view);
+    free(inst->transposed);
+    free(inst);
+    // release the lock completely, also when the caller held it with bw_disp_lock
+    while (xSemaphoreGiveRecursive(lock) == pdTRUE)
     {
-        inst->pages[page][x] |= y_bit;
     }
-    bw_disp_set_dirty_rect(inst, x, y, 1, 1);
-    return ESP_OK;
+    return ret != ESP_OK ? ret : ret2;
 }
 
-esp_err_t bw_disp_get_pixel(bw_disp_handle_t handle, uint16_t x, uint16_t y, bw_disp_clr_t *c)
+esp_err_t bw_disp_clear(bw_disp_handle_t handle)
 {
-    bw_disp_t *inst = bw_disp_get_instance(handle);
+    return bw_disp_fill(handle, BWDC_BLACK);
+}
+
+esp_err_t bw_disp_fill(bw_disp_handle_t handle, bw_disp_clr_t c)
+{
+    BWD_LOCKED_INSTANCE(inst, handle);
     if (inst == NULL)
     {
         return ESP_ERR_INVALID_ARG;
     }
-    if (x >= inst->disp_if->width || y >= inst->disp_if->height)
-    {
-        return ESP_ERR_INVALID_ARG;
-    }
-    int page = y >> 3;
-    int y_bit = 1 << (y & 0x07);
-    *c = (inst->pages[page][x] & y_bit) ? BWDC_WHITE : BWDC_BLACK;
+    BWD_STATS_PRIM(inst, BWDP_FILL);
+    DISP_TRACE_SCOPE(handle, BWT_FILL, 0);
+    memset(inst->buffer, c == BWDC_BLACK ? 0x00 : 0xFF, inst->buffer_size);
+    bw_disp_set_dirty_rect(inst, 0, 0, inst->disp_if->width, inst->disp_if->height);
     return ESP_OK;
 }
 
-esp_err_t bw_disp_vline(bw_disp_handle_t handle, uint16_t x, uint16_t y, uint16_t h, bw_disp_clr_t c)
+// Transposes 8x8 bit matrix: bit j of byte i goes to bit i of byte j. SWAR on the two 32-bit halves 
+// (little endian): bits are swapped between 2x2 blocks, then 4x4 blocks within words, then 4x4 blocks across them.
+BWD_ALWAYS_INLINE void bw_disp_transpose8(const uint8_t *src, uint8_t *dst)
 {
-    bw_disp_t *inst = bw_disp_get_instance(handle);
-    if (inst == NULL)
-    {
-        return ESP_ERR_INVALID_ARG;
-    }
-    if (x >= inst->disp_if->width || y >= inst->disp_if->height || (y + h) > inst->disp_if->height)
-    {
-        return ESP_ERR_INVALID_ARG;
-    }
-    int first_page = y >> 3;
-    uint16_t y_e = y + h - 1;
-    int last_page = y_e >> 3;
-    int page = first_page;
-    uint8_t pix_mask = 0;
-    int y_bit_s = 1 << (y & 0x07);
-    int y_bit_e = 1 << (y_e & 0x07);
-    int y_bit_e_f = (first_page < last_page) ? (1 << 7) : y_bit_e;
-    for (int i = y_bit_s; i <=  y_bit_e_f; i <<= 1) 
+    uint32_t lo;
+    uint32_t hi;
+    uint32_t t;
+    memcpy(&lo, src, 4);
+    memcpy(&hi, src + 4, 4);
+    t = (lo ^ (lo >> 7)) & 0x00AA00AAU;
+    lo ^= t ^ (t << 7);
+    t = (hi ^ (hi >> 7)) & 0x00AA00AAU;
+    hi ^= t ^ (t << 7);
+    t = (lo ^ (lo >> 14)) & 0x0000CCCCU;
+    lo ^= t ^ (t << 14);
+    t = (hi ^ (hi >> 14)) & 0x0000CCCCU;
+    hi ^= t ^ (t << 14);
+    t = ((lo >> 4) ^ hi) & 0x0F0F0F0FU;
+    hi ^= t;
+    lo ^= t << 4;
+    memcpy(dst, &lo, 4);
+    memcpy(dst + 4, &hi, 4);
+}
+
+// Gets the frame sent to the display and its dirty spans. Rotated by 90/270 degrees, dirty 8x8 blocks 
+// of the display buffer are transposed into the frame first: block b of page p becomes columns 8p - 8p+7 of panel page b.
+static uint8_t* bw_disp_frame(bw_disp_t *inst, bw_disp_span_t **dirty)
+{
+    bwd_transpose_t *transposed = inst->transposed;
+    if (transposed == NULL)
     {
-        pix_mask |= i;
+        *dirty = inst->dirty;
+        return inst->buffer;
     }
-    while (page <= last_page)
+    uint16_t width = inst->disp_if->width;
+    uint16_t panel_width = inst->panel_if->width;
+    for (int page = 0; page < inst->page_num; page++)
     {
-        if (c == BWDC_WHITE)
-        {
-            // set pixels
-            inst->pages[page][x] |= pix_mask;
-        }
-        else // c == bwdc_black
-        {
-            // clear pixels
-            inst->pages[page][x] &= ~pix_mask;
-        }
-        page++;
-        if (page < last_page)
+        const bw_disp_span_t *span = &(inst->dirty[page]);
+        if (bw_disp_is_span_empty(span))
         {
-            pix_mask = 0xFF;
+            continue;
         }
-        else
+        for (int block = span->x0 >> 3; block <= (span->x1 >> 3); block++)
         {
-            pix_mask = 0;
-            for (int i = 1; i <= y_bit_e; i <<= 1) 
-            {
-                pix_mask |= i;
-            }
+            bw_disp_transpose8(&(inst->buffer[page * width + block * 8]), &(transposed->buffer[block * panel_width + page * 8]));
+            bw_disp_merge_span(&(transposed->dirty[block]), page * 8, page * 8 + 7);
         }
     }
-    bw_disp_set_dirty_rect(inst, x, y, 1, h);
-    return ESP_OK;
+    bw_disp_clear_dirty_rect(inst);
+    *dirty = transposed->dirty;
+    return transposed->buffer;
 }
 
-esp_err_t bw_disp_hline(bw_disp_handle_t handle, uint16_t x, uint16_t y, uint16_t w, bw_disp_clr_t c)
+static esp_err_t bw_disp_batch_flush(bw_disp_t *inst)
 {
-    bw_disp_t *inst = bw_disp_get_instance(handle);
-    if (inst == NULL)
+    bwd_batch_t *batch = &(inst->batch);
+    int seg_num = 2 * batch->run_num;
+    if (batch->tail_len > 0)
     {
-        return ESP_ERR_INVALID_ARG;
+        disp_proto_seg_t *seg = &(batch->segments[seg_num++]);
+        seg->type = DPS_COMMANDS;
+        seg->buf = batch->tail_commands;
+        seg->len = batch->tail_len;
     }
-    if (x >= inst->disp_if->width || y >= inst->disp_if->height || (x + w) > inst->disp_if->width)
+    if (seg_num == 0)
     {
-        return ESP_ERR_INVALID_ARG;
+        return ESP_OK;
     }
-    int page = y >> 3;
-    int y_bit = 1 << (y & 0x07);
-    if (c == BWDC_BLACK)
+    esp_err_t ret = disp_proto_write_segments(inst->comm_handle, batch->segments, seg_num);
+    if (ret != ESP_OK)
     {
-        for (int i = 0; i < w; i++, x++)
-        {
-            inst->pages[page][x] &= ~y_bit;
-        }
+        ESP_LOGE(TAG, "Failed to write display data. Handle: #%d. Runs: %d", inst->handle, batch->run_num);
+        batch->run_num = 0;
+        batch->tail_len = 0;
+        return ret;
     }
-    else
+#if BW_DISP_STATS
+    inst->frame.transfers++;
+    inst->frame.command_bytes += batch->tail_len;
+#endif
+    batch->tail_len = 0;
+    if (inst->shadow != NULL)
     {
-        for (int i = 0; i < w; i++, x++)
+        for (int i = 0; i < batch->run_num; i++)
         {
-            inst->pages[page][x] |= y_bit;
+            disp_proto_seg_t *data_seg = &(batch->segments[2 * i + 1]);
+            memcpy(&(inst->shadow[batch->page[i] * inst->panel_if->width + batch->run[i].x0]), data_seg->buf, data_seg->len);
         }
     }
-    bw_disp_set_dirty_rect(inst, x, y, w, 1);
+    batch->run_num = 0;
     return ESP_OK;
 }
 
-esp_err_t bw_disp_rect(bw_disp_handle_t handle, uint16_t x, uint16_t y, uint16_t w, uint16_t h, bw_disp_clr_t c)
+static esp_err_t bw_disp_batch_add(bw_disp_t *inst, uint8_t *page_buf, int page, uint16_t x0, uint16_t x1)
 {
+    bwd_batch_t *batch = &(inst->batch);
+    if (batch->run_num >= BWD_BATCH_MAX_RUNS)
+    {
+        esp_err_t ret = bw_disp_batch_flush(inst);
+        if (ret != ESP_OK)
+        {
+            return ret;
+        }
+    }
+    int i = batch->run_num++;
+    batch->page[i] = page;
+    batch->run[i].x0 = x0;
+    batch->run[i].x1 = x1;
+    disp_proto_seg_t *seg = &(batch->segments[2 * i]);
+    seg[0].type = DPS_COMMANDS;
+    seg[0].buf = batch->commands[i];
+    seg[0].len = inst->disp_if->page_col_commands(page, inst->disp_if->first_col + x0, batch->commands[i]);
+    seg[1].type = DPS_DATA;
+    seg[1].buf = &(page_buf[x0]);
+    seg[1].len = x1 - x0 + 1;
+#if BW_DISP_STATS
+    if ((inst->frame.runs == 0) || (inst->frame.last_page != page))
+    {
+        inst->frame.pages++;
+        inst->frame.last_page = page;
+    }
+    inst->frame.runs++;
+    inst->frame.columns += seg[1].len;
+    inst->frame.command_bytes += seg[0].len;
+#endif
+    return ESP_OK;
+}
+
+static esp_err_t bw_disp_refresh_page_diff(bw_disp_t *inst, uint8_t *page_buf, int page, const bw_disp_span_t *span)
+{
+    assert(inst->shadow != NULL);
+    uint8_t *shadow = &(inst->shadow[page * inst->panel_if->width]);
+    const bw_disp_span_t *stale = &(inst->shadow_stale[page]);
+    int run_s = -1; // first column of the current run
+    int run_e = -1; // last column of the current run
+    for (int x = span->x0; x <= span->x1; x++)
+    {
+        if (page_buf[x] == shadow[x] && (x < stale->x0 || x > stale->x1))
+        {
+            continue;
+        }
+        if (run_s < 0)
+        {
+            run_s = x;
+        }
+        else if ((x - run_e - 1) > BWD_DIFF_RUN_COST)
+        {
+            // gap is too big - cheaper to address the next run separately
+            esp_err_t ret = bw_disp_batch_add(inst, page_buf, page, run_s, run_e);
+            if (ret != ESP_OK)
+            {
+                return ret;
+            }
+            run_s = x;
+        }
+        run_e = x;
+    }
+    if (run_s < 0)
+    {
+        return ESP_OK;
+    }
+    return bw_disp_batch_add(inst, page_buf, page, run_s, run_e);
+}
+
+// Sends dirty spans of the given buffer to the display, followed by its start line (if changed) in the last transfer.
+// Spans are cleared on success.
+static esp_err_t bw_disp_refresh_frame(bw_disp_t *inst, uint8_t *buf, bw_disp_span_t dirty[], uint16_t start_line)
+{
+    esp_err_t ret;    
+    for (int page = 0; page < inst->panel_page_num; page++)
+    {
+        if (bw_disp_is_span_empty(&(dirty[page])))
+        {
+            continue;
+        }
+        uint8_t *page_buf = &(buf[page * inst->panel_if->width]);
+        DISP_TRACE_START(page_start);
+        if (inst->refresh_mode == BWDR_DIFF)
+        {
+            ret = bw_disp_refresh_page_diff(inst, page_buf, page, &(dirty[page]));
+        }
+        else
+        {
+            ret = bw_disp_batch_add(inst, page_buf, page, dirty[page].x0, dirty[page].x1);
+        }
+        DISP_TRACE_RECORD(BWT_REFRESH_PAGE, inst->handle, dirty[page].x1 - dirty[page].x0 + 1, page_start, ret);
+        if (ret != ESP_OK)
+        {
+            return ret;
+        }        
+    }
+    if (start_line != inst->start_line)
+    {
+        // rows exposed by scrolling are in place before they are shown
+        inst->batch.tail_commands[0] = BWD_CMD_SET_DISPLAY_START_LINE + start_line;
+        inst->batch.tail_len = 1;
+    }
+    ret = bw_disp_batch_flush(inst);
+    if (ret != ESP_OK)
+    {
+        return ret;
+    }
+    bw_disp_clear_spans(dirty, inst->panel_page_num);
+    bw_disp_clear_spans(inst->shadow_stale, inst->panel_page_num);
+    inst->start_line = start_line;
+    return ESP_OK;
+}
+
+// Sends the frame (as bw_disp_refresh_frame), adds its time and traffic to the counters and traces it
+static esp_err_t bw_disp_refresh_priv(bw_disp_t *inst, uint8_t *buf, bw_disp_span_t dirty[], uint16_t start_line)
+{
+    DISP_TRACE_START(trace_start);
+#if BW_DISP_TRACE
+    // spans are cleared by the refresh
+    uint32_t dirty_pages = 0;
+    for (int page = 0; page < inst->panel_page_num; page++)
+    {
+        dirty_pages += !bw_disp_is_span_empty(&(dirty[page]));
+    }
+#endif
+#if BW_DISP_STATS
+    memset(&(inst->frame), 0, sizeof(inst->frame));
+    DISP_STATS_START(start);
+    esp_err_t ret = bw_disp_refresh_frame(inst, buf, dirty, start_line);
+    taskENTER_CRITICAL(&(inst->stats_lock));
+    bw_disp_stats_t *stats = &(inst->stats);
+    disp_latency_stats_add(&(stats->refresh_latency), start);
+    stats->refreshes++;
+    if (ret != ESP_OK)
+    {
+        stats->refresh_errors++;
+    }
+    stats->transfers += inst->frame.transfers;
+    stats->pages += inst->frame.pages;
+    stats->runs += inst->frame.runs;
+    stats->columns += inst->frame.columns;
+    stats->command_bytes += inst->frame.command_bytes;
+    taskEXIT_CRITICAL(&(inst->stats_lock));
+#else
+    esp_err_t ret = bw_disp_refresh_frame(inst, buf, dirty, start_line);
+#endif
+    DISP_TRACE_RECORD(BWT_REFRESH, inst->handle, dirty_pages, trace_start, ret);
+    return ret;
+}
+
+static void bw_disp_refresh_task(void *arg)
+{
+    bw_disp_t *inst = (bw_disp_t *) arg;
+    bwd_async_t *async = inst->async;
+    while (true)
+    {
+        EventBits_t bits = xEventGroupWaitBits(async->events, BWD_EVT_REQUEST | BWD_EVT_STOP, pdTRUE, pdFALSE, portMAX_DELAY);
+        if (bits & BWD_EVT_STOP)
+        {
+            break;
+        }
+        // take all frames submitted so far - requests made during the transfer are coalesced into the next one
+        xSemaphoreTake(async->lock, portMAX_DELAY);
+        for (int page = 0; page < inst->panel_page_num; page++)
+        {
+            bw_disp_span_t *span = &(async->front_dirty[page]);
+            if (!bw_disp_is_span_empty(span))
+            {
+                int offset = page * inst->panel_if->width + span->x0;
+                memcpy(&(async->tx[offset]), &(async->front[offset]), span->x1 - span->x0 + 1);
+                bw_disp_merge_span(&(async->tx_dirty[page]), span->x0, span->x1);
+            }
+        }
+        bw_disp_clear_spans(async->front_dirty, inst->panel_page_num);
+        async->tx_start_line = async->front_start_line;
+        xSemaphoreGive(async->lock);
+
+        esp_err_t ret = bw_disp_refresh_priv(inst, async->tx, async->tx_dirty, async->tx_start_line);
+
+        xSemaphoreTake(async->lock, portMAX_DELAY);
+        if (ret != ESP_OK)
+        {
+            async->last_err = ret;
+        }
+        if ((xEventGroupGetBits(async->events) & BWD_EVT_REQUEST) == 0)
+        {
+            xEventGroupSetBits(async->events, BWD_EVT_IDLE);
+        }
+        xSemaphoreGive(async->lock);
+    }
+    xEventGroupSetBits(async->events, BWD_EVT_STOPPED);
+    vTaskDelete(NULL);
+}
+
+esp_err_t bw_disp_start_async(bw_disp_handle_t handle, UBaseType_t priority, BaseType_t core_id)
+{
+    BWD_LOCKED_INSTANCE(inst, handle);
+    if (inst == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (inst->view != NULL)
+    {
+        ESP_LOGE(TAG, "Canvas is refreshed by its display. Handle: #%d", handle);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    if (inst->async != NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    bwd_async_t *async = (bwd_async_t *) calloc(1, sizeof(bwd_async_t) + 2 * inst->buffer_size);
+    if (async == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to allocate asynchronous refresh buffers. Handle: #%d", handle);
+        return ESP_ERR_NO_MEM;
+    }
+    async->front = &(async->buffers[0]);
+    async->tx = &(async->buffers[inst->buffer_size]);
+    // front and transfer buffers start with the display content except for dirty spans,
+    // which stay in the back buffer until the first refresh request
+    bw_disp_span_t *dirty;
+    uint8_t *frame = bw_disp_frame(inst, &dirty);
+    memcpy(async->front, frame, inst->buffer_size);
+    memcpy(async->tx, frame, inst->buffer_size);
+    bw_disp_clear_spans(async->front_dirty, inst->panel_page_num);
+    bw_disp_clear_spans(async->tx_dirty, inst->panel_page_num);
+    async->front_start_line = inst->start_line;
+    async->tx_start_line = inst->start_line;
+    async->last_err = ESP_OK;
+    async->events = xEventGroupCreate();
+    async->lock = xSemaphoreCreateMutex();
+    if (async->events == NULL || async->lock == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to create refresh task synchronization objects. Handle: #%d", handle);
+        goto fail;
+    }
+    xEventGroupSetBits(async->events, BWD_EVT_IDLE | BWD_EVT_NO_WAITERS);
+    inst->async = async;
+    if (xTaskCreatePinnedToCore(&bw_disp_refresh_task, "bw_disp_refresh", BWD_REFRESH_TASK_STACK_SIZE, inst, priority, &(async->task), core_id) != pdPASS)
+    {
+        ESP_LOGE(TAG, "Failed to create refresh task. Handle: #%d", handle);
+        inst->async = NULL;
+        goto fail;
+    }
+    return ESP_OK;
+fail:
+    if (async->events != NULL)
+    {
+        vEventGroupDelete(async->events);
+    }
+    if (async->lock != NULL)
+    {
+        vSemaphoreDelete(async->lock);
+    }
+    free(async);
+    return ESP_ERR_NO_MEM;
+}
+
+esp_err_t bw_disp_stop_async(bw_disp_handle_t handle)
+{
+    BWD_LOCKED_INSTANCE(inst, handle);
+    if (inst == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    bwd_async_t *async = inst->async;
+    if (async == NULL)
+    {
+        return ESP_OK;
+    }
+    xEventGroupWaitBits(async->events, BWD_EVT_IDLE, pdFALSE, pdTRUE, portMAX_DELAY);
+    xEventGroupSetBits(async->events, BWD_EVT_STOP);
+    xEventGroupWaitBits(async->events, BWD_EVT_STOPPED, pdFALSE, pdTRUE, portMAX_DELAY);
+    // tasks waiting for the refresh do not hold the display lock - the state is freed after they are gone
+    xEventGroupWaitBits(async->events, BWD_EVT_NO_WAITERS, pdFALSE, pdTRUE, portMAX_DELAY);
+    // whatever was not sent successfully is still dirty (back buffer content is always the most recent one)
+    bw_disp_span_t *dirty;
+    bw_disp_frame(inst, &dirty);
+    for (int page = 0; page < inst->panel_page_num; page++)
+    {
+        bw_disp_span_t *span = &(async->tx_dirty[page]);
+        if (!bw_disp_is_span_empty(span))
+        {
+            bw_disp_merge_span(&(dirty[page]), span->x0, span->x1);
+        }
+    }
+    inst->async = NULL;
+    vEventGroupDelete(async->events);
+    vSemaphoreDelete(async->lock);
+    free(async);
+    return ESP_OK;
+}
+
+// Copies the canvas to the buffer of its display (defined with the image functions)
+static esp_err_t bw_disp_canvas_compose(bw_disp_t *inst);
+
+esp_err_t bw_disp_refresh_async(bw_disp_handle_t handle)
+{
+    BWD_LOCKED_INSTANCE(inst, handle);
+    if (inst == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (inst->view != NULL)
+    {
+        esp_err_t ret = bw_disp_canvas_compose(inst);
+        return (ret == ESP_OK) ? bw_disp_refresh_async(inst->view->disp) : ret;
+    }
+    bwd_async_t *async = inst->async;
+    if (async == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (!bw_disp_is_dirty(inst))
+    {
+        return ESP_OK;
+    }
+    bw_disp_span_t *dirty;
+    uint8_t *frame = bw_disp_frame(inst, &dirty);
+    xSemaphoreTake(async->lock, portMAX_DELAY);
+    for (int page = 0; page < inst->panel_page_num; page++)
+    {
+        bw_disp_span_t *span = &(dirty[page]);
+        if (!bw_disp_is_span_empty(span))
+        {
+            int offset = page * inst->panel_if->width + span->x0;
+            memcpy(&(async->front[offset]), &(frame[offset]), span->x1 - span->x0 + 1);
+            bw_disp_merge_span(&(async->front_dirty[page]), span->x0, span->x1);
+        }
+    }
+    bw_disp_clear_spans(dirty, inst->panel_page_num);
+    async->front_start_line = inst->surface.scroll;
+    xEventGroupClearBits(async->events, BWD_EVT_IDLE);
+    xEventGroupSetBits(async->events, BWD_EVT_REQUEST);
+    xSemaphoreGive(async->lock);
+    return ESP_OK;
+}
+
+esp_err_t bw_disp_refresh_wait(bw_disp_handle_t handle, TickType_t timeout)
+{
+    bwd_async_t *async;
+    {
+        BWD_LOCKED_INSTANCE(inst, handle);
+        if (inst == NULL)
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+        if (inst->view != NULL)
+        {
+            return bw_disp_refresh_wait(inst->view->disp, timeout);
+        }
+        async = inst->async;
+        if (async == NULL)
+        {
+            return ESP_OK;
+        }
+        // registered as a waiter, so that the refresh task is not stopped meanwhile
+        xSemaphoreTake(async->lock, portMAX_DELAY);
+        if (async->waiters++ == 0)
+        {
+            xEventGroupClearBits(async->events, BWD_EVT_NO_WAITERS);
+        }
+        xSemaphoreGive(async->lock);
+    }
+    // the display is not locked while waiting - other tasks can draw meanwhile
+    EventBits_t bits = xEventGroupWaitBits(async->events, BWD_EVT_IDLE, pdFALSE, pdTRUE, timeout);
+    xSemaphoreTake(async->lock, portMAX_DELAY);
+    esp_err_t ret = ESP_ERR_TIMEOUT;
+    if ((bits & BWD_EVT_IDLE) != 0)
+    {
+        ret = async->last_err;
+        async->last_err = ESP_OK;
+    }
+    bool last = --async->waiters == 0;
+    xSemaphoreGive(async->lock);
+    if (last)
+    {
+        // the state may be freed by bw_disp_stop_async as soon as the bit is set
+        xEventGroupSetBits(async->events, BWD_EVT_NO_WAITERS);
+    }
+    return ret;
+}
+
+esp_err_t bw_disp_refresh(bw_disp_handle_t handle)
+{
+    bw_disp_handle_t canvas_disp = INVALID_HANDLE;
+    {
+        BWD_LOCKED_INSTANCE(inst, handle);
+        if (inst == NULL)
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+        if (inst->view != NULL)
+        {
+            esp_err_t ret = bw_disp_canvas_compose(inst);
+            if (ret != ESP_OK)
+            {
+                return ret;
+            }
+            canvas_disp = inst->view->disp;
+        }
+        else if (inst->async == NULL)
+        {
+            if (!bw_disp_is_dirty(inst))
+            {
+                return ESP_OK;
+            }
+            bw_disp_span_t *dirty;
+            uint8_t *frame = bw_disp_frame(inst, &dirty);
+            return bw_disp_refresh_priv(inst, frame, dirty, inst->surface.scroll);
+        }
+        else
+        {
+            esp_err_t ret = bw_disp_refresh_async(handle);
+            if (ret != ESP_OK)
+            {
+                return ret;
+            }
+        }
+    }
+    if (canvas_disp != INVALID_HANDLE)
+    {
+        // the canvas is not locked while its display is refreshed
+        return bw_disp_refresh(canvas_disp);
+    }
+    // the display is not locked while the frame is sent - other tasks can draw meanwhile
+    return bw_disp_refresh_wait(handle, portMAX_DELAY);
+}
+
+esp_err_t bw_disp_set_refresh_mode(bw_disp_handle_t handle, bw_disp_refresh_mode_t mode)
+{
+    BWD_LOCKED_INSTANCE(inst, handle);
+    if (inst == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (inst->view != NULL)
+    {
+        ESP_LOGE(TAG, "Canvas is refreshed by its display. Handle: #%d", handle);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    if (inst->async != NULL)
+    {
+        ESP_LOGE(TAG, "Refresh mode cannot be changed while refresh task is running. Handle: #%d", handle);
+        return ESP_ERR_INVALID_STATE;
+    }
+    switch (mode)
+    {
+    case BWDR_DIRTY:
+        free(inst->shadow);
+        inst->shadow = NULL;
+        break;
+    case BWDR_DIFF:
+        if (inst->shadow == NULL)
+        {
+            inst->shadow = (uint8_t *) malloc(inst->buffer_size);
+            if (inst->shadow == NULL)
+            {
+                ESP_LOGE(TAG, "Failed to allocate shadow buffer. Handle: #%d", handle);
+                return ESP_ERR_NO_MEM;
+            }
+            // Content of the display is known only outside of the dirty spans, so every byte inside of them 
+            // is sent by the next frame (inverting the shadow is not enough - the byte could be drawn to that value).
+            bw_disp_span_t *dirty;
+            memcpy(inst->shadow, bw_disp_frame(inst, &dirty), inst->buffer_size);
+            memcpy(inst->shadow_stale, dirty, sizeof(inst->shadow_stale));
+        }
+        break;
+    default:
+        ESP_LOGE(TAG, "Invalid refresh mode: %d", mode);
+        return ESP_ERR_INVALID_ARG;
+    }
+    inst->refresh_mode = mode;
+    return ESP_OK;
+}
+
+esp_err_t bw_disp_set_rotation(bw_disp_handle_t handle, bw_disp_rotation_t rotation)
+{
+    BWD_LOCKED_INSTANCE(inst, handle);
+    if (inst == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (inst->view != NULL)
+    {
+        ESP_LOGE(TAG, "Canvas is rotated with its display. Handle: #%d", handle);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    if (rotation > BWD_ROTATE_270)
+    {
+        ESP_LOGE(TAG, "Invalid rotation: %d", rotation);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (inst->async != NULL)
+    {
+        ESP_LOGE(TAG, "Rotation cannot be changed while refresh task is running. Handle: #%d", handle);
+        return ESP_ERR_INVALID_STATE;
+    }
+    bw_disp_if_t *panel_if = inst->panel_if;
+    bool transpose = (rotation == BWD_ROTATE_90) || (rotation == BWD_ROTATE_270);
+    if (panel_if->flip_commands == NULL || (transpose && (panel_if->height != inst->panel_page_num * 8 || (panel_if->width & 0x07) != 0)))
+    {
+        ESP_LOGE(TAG, "Rotation is not supported by the display: %d. Handle: #%d", rotation, handle);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    bwd_transpose_t *transposed = NULL;
+    if (transpose && inst->transposed == NULL)
+    {
+        // page arrays of the rotated display buffer and the frame follow the structure
+        int page_num = panel_if->width / 8;
+        size_t arrays_size = page_num * (sizeof(uint8_t *) + sizeof(bw_disp_span_t));
+        transposed = (bwd_transpose_t *) calloc(1, sizeof(bwd_transpose_t) + arrays_size + inst->buffer_size);
+        if (transposed == NULL)
+        {
+            ESP_LOGE(TAG, "Failed to allocate transposed frame. Handle: #%d", handle);
+            return ESP_ERR_NO_MEM;
+        }
+        transposed->rotated_dirty = (bw_disp_span_t *) &(transposed->rotated_pages[page_num]);
+        transposed->buffer = (uint8_t *) &(transposed->rotated_dirty[page_num]);
+    }
+    // a transposed frame is turned into a rotation by mirroring one of the axes
+    uint8_t commands[BWD_FLIP_CMD_MAX_LEN];
+    bool flip_x = (rotation == BWD_ROTATE_90) || (rotation == BWD_ROTATE_180);
+    bool flip_y = (rotation == BWD_ROTATE_180) || (rotation == BWD_ROTATE_270);
+    int len = panel_if->flip_commands(flip_x, flip_y, commands);
+    esp_err_t ret = disp_proto_write_commands(inst->comm_handle, commands, len);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to set display orientation. Handle: #%d", handle);
+        free(transposed);
+        return ret;
+    }
+    if (transpose == (inst->transposed != NULL))
+    {
+        return ESP_OK;
+    }
+    if (transpose)
+    {
+        transposed->rotated_if = *panel_if;
+        transposed->rotated_if.width = panel_if->height;
+        transposed->rotated_if.height = panel_if->width;
+        transposed->rotated_if.page_num = panel_if->width / 8;
+        bw_disp_clear_spans(transposed->dirty, inst->panel_page_num);
+        inst->transposed = transposed;
+        inst->disp_if = &(transposed->rotated_if);
+        inst->page_num = transposed->rotated_if.page_num;
+        inst->pages = transposed->rotated_pages;
+        inst->dirty = transposed->rotated_dirty;
+    }
+    else
+    {
+        free(inst->transposed);
+        inst->transposed = NULL;
+        inst->disp_if = panel_if;
+        inst->page_num = inst->panel_page_num;
+        inst->pages = inst->panel_pages;
+        inst->dirty = inst->panel_dirty;
+    }
+    // the buffer has new dimensions - it starts blank and the whole frame is sent
+    bw_disp_init_surface(inst);
+    inst->surface.scroll = 0;
+    memset(inst->buffer, 0, inst->buffer_size);
+    bw_disp_set_dirty_rect(inst, 0, 0, inst->disp_if->width, inst->disp_if->height);
+    return ESP_OK;
+}
+
+esp_err_t bw_disp_set_pixel(bw_disp_handle_t handle, uint16_t x, uint16_t y, bw_disp_clr_t c)
+{
+    BWD_LOCKED_INSTANCE(inst, handle);
+    if (inst == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    BWD_STATS_PRIM(inst, BWDP_PIXEL);
+    DISP_TRACE_SCOPE(handle, BWT_PIXEL, 1);
+    if (x >= inst->disp_if->width || y >= inst->disp_if->height)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    bw_disp_surface_set_pixel(&(inst->surface), x, y, c);
+    return ESP_OK;
+}
+
+esp_err_t bw_disp_set_pixels(bw_disp_handle_t handle, const bw_disp_point_t points[], int n, bw_disp_clr_t c)
+{
+    BWD_LOCKED_INSTANCE(inst, handle);
+    if (inst == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    BWD_STATS_PRIM(inst, BWDP_PIXEL);
+    DISP_TRACE_SCOPE(handle, BWT_PIXEL, n);
+    uint16_t width = inst->disp_if->width;
+    uint16_t height = inst->disp_if->height;
+    esp_err_t ret = ESP_OK;
+    for (int i = 0; i < n; i++)
+    {
+        uint16_t x = points[i].x;
+        uint16_t y = points[i].y;
+        if (x >= width || y >= height)
+        {
+            ret = ESP_ERR_INVALID_ARG;
+            continue;
+        }
+        y = bw_disp_surface_row(&(inst->surface), y);
+        int page = y >> 3;
+        uint8_t y_bit = 1 << (y & 0x07);
+        if (c == BWDC_BLACK)
+        {
+            inst->pages[page][x] &= ~y_bit;
+        }
+        else
+        {
+            inst->pages[page][x] |= y_bit;
+        }
+        bw_disp_surface_mark_dirty(&(inst->surface), page, x, x);
+    }
+    return ret;
+}
+
+esp_err_t bw_disp_get_pixel(bw_disp_handle_t handle, uint16_t x, uint16_t y, bw_disp_clr_t *c)
+{
+    BWD_LOCKED_INSTANCE(inst, handle);
+    if (inst == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (x >= inst->disp_if->width || y >= inst->disp_if->height)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *c = bw_disp_surface_get_pixel(&(inst->surface), x, y);
+    return ESP_OK;
+}
+
+// Sets (white) or clears (black) bits of mask in n consecutive bytes, processing aligned words 4 bytes at a time
+static void bw_disp_fill_span(uint8_t *p, int n, uint8_t mask, bw_disp_clr_t c)
+{
+    if (mask == 0xFF)
+    {
+        memset(p, c == BWDC_BLACK ? 0x00 : 0xFF, n);
+        return;
+    }
+    uint8_t *p_e = p + n;
+    bwd_word_t word_mask = mask * 0x01010101U;
+    if (c == BWDC_BLACK)
+    {
+        for (; p < p_e && ((uintptr_t) p & 0x03); p++)
+        {
+            *p &= ~mask;
+        }
+        for (; p + 4 <= p_e; p += 4)
+        {
+            *(bwd_word_t *) p &= ~word_mask;
+        }
+        for (; p < p_e; p++)
+        {
+            *p &= ~mask;
+        }
+    }
+    else
+    {
+        for (; p < p_e && ((uintptr_t) p & 0x03); p++)
+        {
+            *p |= mask;
+        }
+        for (; p + 4 <= p_e; p += 4)
+        {
+            *(bwd_word_t *) p |= word_mask;
+        }
+        for (; p < p_e; p++)
+        {
+            *p |= mask;
+        }
+    }
+}
+
+// Fills rectangle of buffer rows page by page: partial top and bottom pages are masked, full pages in between 
+// are set with memset. Arguments must be already validated (the rectangle has to fit in the buffer, w > 0, h > 0).
+static void bw_disp_fill_buffer_rect(bw_disp_t *inst, uint16_t x, uint16_t y, uint16_t w, uint16_t h, bw_disp_clr_t c)
+{
+    uint16_t y_e = y + h - 1;
+    int first_page = y >> 3;
+    int last_page = y_e >> 3;
+    uint8_t first_mask = 0xFF << (y & 0x07);
+    uint8_t last_mask = 0xFF >> (7 - (y_e & 0x07));
+    if (first_page == last_page)
+    {
+        bw_disp_fill_span(&(inst->pages[first_page][x]), w, first_mask & last_mask, c);
+    }
+    else
+    {
+        bw_disp_fill_span(&(inst->pages[first_page][x]), w, first_mask, c);
+        for (int page = first_page + 1; page < last_page; page++)
+        {
+            bw_disp_fill_span(&(inst->pages[page][x]), w, 0xFF, c);
+        }
+        bw_disp_fill_span(&(inst->pages[last_page][x]), w, last_mask, c);
+    }
+    bw_disp_set_dirty_rect(inst, x, y, w, h);
+}
+
+// Fills rectangle of display rows, which wraps around the end of the buffer if the display is scrolled.
+// Arguments must be already validated (the rectangle has to fit in the display, w > 0, h > 0).
+static void bw_disp_fill_rect_priv(bw_disp_t *inst, uint16_t x, uint16_t y, uint16_t w, uint16_t h, bw_disp_clr_t c)
+{
+    uint16_t row = bw_disp_surface_row(&(inst->surface), y);
+    uint16_t h0 = MIN(h, inst->disp_if->height - row);
+    bw_disp_fill_buffer_rect(inst, x, row, w, h0, c);
+    if (h0 < h)
+    {
+        bw_disp_fill_buffer_rect(inst, x, 0, w, h - h0, c);
+    }
+}
+
+esp_err_t bw_disp_vline(bw_disp_handle_t handle, uint16_t x, uint16_t y, uint16_t h, bw_disp_clr_t c)
+{
+    BWD_LOCKED_INSTANCE(inst, handle);
+    if (inst == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    BWD_STATS_PRIM(inst, BWDP_LINE);
+    DISP_TRACE_SCOPE(handle, BWT_LINE, 0);
+    if (x >= inst->disp_if->width || y >= inst->disp_if->height || (y + h) > inst->disp_if->height)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (h == 0)
+    {
+        return ESP_OK;
+    }
+    bw_disp_fill_rect_priv(inst, x, y, 1, h, c);
+    return ESP_OK;
+}
+
+esp_err_t bw_disp_hline(bw_disp_handle_t handle, uint16_t x, uint16_t y, uint16_t w, bw_disp_clr_t c)
+{
+    BWD_LOCKED_INSTANCE(inst, handle);
+    if (inst == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    BWD_STATS_PRIM(inst, BWDP_LINE);
+    DISP_TRACE_SCOPE(handle, BWT_LINE, 0);
+    if (x >= inst->disp_if->width || y >= inst->disp_if->height || (x + w) > inst->disp_if->width)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (w == 0)
+    {
+        return ESP_OK;
+    }
+    bw_disp_fill_rect_priv(inst, x, y, w, 1, c);
+    return ESP_OK;
+}
+
+esp_err_t bw_disp_rect(bw_disp_handle_t handle, uint16_t x, uint16_t y, uint16_t w, uint16_t h, bw_disp_clr_t c)
+{
+    BWD_LOCKED_INSTANCE(inst, handle);
+    if (inst == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    BWD_STATS_PRIM(inst, BWDP_RECT);
+    DISP_TRACE_SCOPE(handle, BWT_RECT, 0);
     esp_err_t ret;
     ret = bw_disp_hline(handle, x, y, w, c);
     if (ret != ESP_OK)
     {
-        return ret;
+        return ret;
+    }
+    ret = bw_disp_vline(handle, x, y, h, c);
+    if (ret != ESP_OK)
+    {
+        return ret;
+    }
+    ret = bw_disp_hline(handle, x, y + h - 1, w, c);
+    if (ret != ESP_OK)
+    {
+        return ret;
+    }
+    ret = bw_disp_vline(handle, x + w - 1, y, h, c);
+    return ret;
+}
+
+esp_err_t bw_disp_fill_rect(bw_disp_handle_t handle, uint16_t x, uint16_t y, uint16_t w, uint16_t h, bw_disp_clr_t c)
+{
+    BWD_LOCKED_INSTANCE(inst, handle);
+    if (inst == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    BWD_STATS_PRIM(inst, BWDP_RECT);
+    DISP_TRACE_SCOPE(handle, BWT_RECT, 0);
+    if (x >= inst->disp_if->width || y >= inst->disp_if->height || (x + w) > inst->disp_if->width || (y + h) > inst->disp_if->height)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (w == 0 || h == 0)
+    {
+        return ESP_OK;
+    }
+    bw_disp_fill_rect_priv(inst, x, y, w, h, c);
+    return ESP_OK;
+}
+
+// Checks whether the display can scroll: the buffer has to be a whole ring of the display RAM rows reachable
+// by the start line (canvases are moved by their viewport instead, rows of a transposed buffer are panel columns)
+static bool bw_disp_can_scroll(const bw_disp_t *inst)
+{
+    uint16_t height = inst->disp_if->height;
+    return inst->view == NULL && inst->transposed == NULL && height == inst->page_num * 8 && height <= 64;
+}
+
+// Scrolls the display content by rows (up if positive), leaving the exposed rows as they were
+static void bw_disp_scroll_rows(bw_disp_t *inst, int rows)
+{
+    uint16_t height = inst->disp_if->height;
+    // row 0 shows the buffer row that was shown by row "rows" before
+    int scroll = (inst->surface.scroll + rows) % height;
+    inst->surface.scroll = (scroll < 0) ? scroll + height : scroll;
+}
+
+esp_err_t bw_disp_scroll(bw_disp_handle_t handle, int16_t rows, bw_disp_clr_t c)
+{
+    BWD_LOCKED_INSTANCE(inst, handle);
+    if (inst == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!bw_disp_can_scroll(inst))
+    {
+        ESP_LOGE(TAG, "Scrolling is not supported by the display. Handle: #%d", handle);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    if (rows == 0)
+    {
+        return ESP_OK;
+    }
+    uint16_t height = inst->disp_if->height;
+    uint16_t n = MIN(abs(rows), height);
+    bw_disp_scroll_rows(inst, rows);
+    bw_disp_fill_rect_priv(inst, 0, (rows > 0) ? height - n : 0, inst->disp_if->width, n, c);
+    return ESP_OK;
+}
+
+// Combines image byte s with display byte d. Only bits set in mask m (rows covered by the image) are affected.
+BWD_ALWAYS_INLINE uint8_t bw_disp_blit_combine(uint8_t d, uint8_t s, uint8_t m, bw_disp_img_draw_mode_t mode)
+{
+    switch (mode)
+    {
+    case BWDM_ADD_WHITE:
+        return d | (s & m);
+    case BWDM_ADD_BLACK:
+        return d & (s | ~m);
+    case BWDM_OVERRIDE:
+    default:
+        return (d & ~m) | (s & m);
+    }
+}
+
+// Kernel for image rows aligned with display pages (the same y offset within a page): every display page
+// takes one image page. Full pages drawn with BWDM_OVERRIDE are copied with memcpy.
+BWD_ALWAYS_INLINE void bw_disp_blit_aligned_kernel(uint8_t *dst, int dst_stride, const uint8_t *src, int src_stride, int w,
+    const uint8_t masks[], int page_cnt, bool inv, bw_disp_img_draw_mode_t mode)
+{
+    for (int p = 0; p < page_cnt; p++, dst += dst_stride, src += src_stride)
+    {
+        uint8_t m = masks[p];
+        if (mode == BWDM_OVERRIDE && !inv && m == 0xFF)
+        {
+            memcpy(dst, src, w);
+            continue;
+        }
+        for (int i = 0; i < w; i++)
+        {
+            uint8_t s = inv ? ~src[i] : src[i];
+            dst[i] = bw_disp_blit_combine(dst[i], s, m, mode);
+        }
+    }
+}
+
+// Kernel for shifted image rows: every display page combines the previous image page (shifted right by shr) with
+// the current one (shifted left). Image is walked column by column, so every image byte is loaded only once.
+// src points to the image page used as "current" by the first display page; src_page_cnt pages can be read from there;
+// has_prev tells if the image page before it belongs to the selection.
+BWD_ALWAYS_INLINE void bw_disp_blit_shifted_kernel(uint8_t *dst, int dst_stride, const uint8_t *src, int src_stride, int w,
+    const uint8_t masks[], int page_cnt, int src_page_cnt, bool has_prev, int shr, bool inv, bw_disp_img_draw_mode_t mode)
+{
+    int shl = 8 - shr;
+    for (int i = 0; i < w; i++)
+    {
+        const uint8_t *s_col = &(src[i]);
+        uint8_t *d_col = &(dst[i]);
+        uint8_t prev = has_prev ? s_col[-src_stride] : 0;
+        for (int p = 0; p < page_cnt; p++, d_col += dst_stride, s_col += src_stride)
+        {
+            uint8_t cur = (p < src_page_cnt) ? *s_col : 0;
+            uint8_t s = (uint8_t) ((prev >> shr) | (cur << shl));
+            prev = cur;
+            if (inv)
+            {
+                s = ~s;
+            }
+            *d_col = bw_disp_blit_combine(*d_col, s, masks[p], mode);
+        }
+    }
+}
+
+// Dispatches to a kernel specialized for the draw mode and inversion
+static void bw_disp_blit_aligned(uint8_t *dst, int dst_stride, const uint8_t *src, int src_stride, int w,
+    const uint8_t masks[], int page_cnt, bool inv, bw_disp_img_draw_mode_t mode)
+{
+    switch (mode)
+    {
+    case BWDM_ADD_WHITE:
+        if (inv)
+        {
+            bw_disp_blit_aligned_kernel(dst, dst_stride, src, src_stride, w, masks, page_cnt, true, BWDM_ADD_WHITE);
+        }
+        else
+        {
+            bw_disp_blit_aligned_kernel(dst, dst_stride, src, src_stride, w, masks, page_cnt, false, BWDM_ADD_WHITE);
+        }
+        break;
+    case BWDM_ADD_BLACK:
+        if (inv)
+        {
+            bw_disp_blit_aligned_kernel(dst, dst_stride, src, src_stride, w, masks, page_cnt, true, BWDM_ADD_BLACK);
+        }
+        else
+        {
+            bw_disp_blit_aligned_kernel(dst, dst_stride, src, src_stride, w, masks, page_cnt, false, BWDM_ADD_BLACK);
+        }
+        break;
+    case BWDM_OVERRIDE:
+    default:
+        if (inv)
+        {
+            bw_disp_blit_aligned_kernel(dst, dst_stride, src, src_stride, w, masks, page_cnt, true, BWDM_OVERRIDE);
+        }
+        else
+        {
+            bw_disp_blit_aligned_kernel(dst, dst_stride, src, src_stride, w, masks, page_cnt, false, BWDM_OVERRIDE);
+        }
+        break;
+    }
+}
+
+// Dispatches to a kernel specialized for the draw mode and inversion
+static void bw_disp_blit_shifted(uint8_t *dst, int dst_stride, const uint8_t *src, int src_stride, int w,
+    const uint8_t masks[], int page_cnt, int src_page_cnt, bool has_prev, int shr, bool inv, bw_disp_img_draw_mode_t mode)
+{
+    switch (mode)
+    {
+    case BWDM_ADD_WHITE:
+        if (inv)
+        {
+            bw_disp_blit_shifted_kernel(dst, dst_stride, src, src_stride, w, masks, page_cnt, src_page_cnt, has_prev, shr, true, BWDM_ADD_WHITE);
+        }
+        else
+        {
+            bw_disp_blit_shifted_kernel(dst, dst_stride, src, src_stride, w, masks, page_cnt, src_page_cnt, has_prev, shr, false, BWDM_ADD_WHITE);
+        }
+        break;
+    case BWDM_ADD_BLACK:
+        if (inv)
+        {
+            bw_disp_blit_shifted_kernel(dst, dst_stride, src, src_stride, w, masks, page_cnt, src_page_cnt, has_prev, shr, true, BWDM_ADD_BLACK);
+        }
+        else
+        {
+            bw_disp_blit_shifted_kernel(dst, dst_stride, src, src_stride, w, masks, page_cnt, src_page_cnt, has_prev, shr, false, BWDM_ADD_BLACK);
+        }
+        break;
+    case BWDM_OVERRIDE:
+    default:
+        if (inv)
+        {
+            bw_disp_blit_shifted_kernel(dst, dst_stride, src, src_stride, w, masks, page_cnt, src_page_cnt, has_prev, shr, true, BWDM_OVERRIDE);
+        }
+        else
+        {
+            bw_disp_blit_shifted_kernel(dst, dst_stride, src, src_stride, w, masks, page_cnt, src_page_cnt, has_prev, shr, false, BWDM_OVERRIDE);
+        }
+        break;
+    }
+}
+
+/** @brief Position in a compressed image page row. Decoding a row chunk by chunk continues from there,
+ *  so the tokens before the chunk are not skipped again. */
+typedef struct
+{
+    const uint8_t *p;   ///< Next token (the one covering the first column not decoded yet)
+    int col;            ///< Column of the token
+} bwd_rle_cursor_t;
+
+// Sets the cursor to the beginning of a compressed image page row. Image data starts with a table of 16-bit 
+// (little endian) offsets of the page rows, counted from the end of the table; runs never cross page rows.
+static void bw_disp_rle_seek(const bw_image_t *img, int page, bwd_rle_cursor_t *cur)
+{
+    int pages = (img->height + 7) >> 3;
+    cur->p = &(img->image[2 * pages + (img->image[2 * page] | (img->image[2 * page + 1] << 8))]);
+    cur->col = 0;
+}
+
+// Decodes columns ix..ix+w-1 of the page row from the cursor (not past ix) and moves the cursor to the token
+// covering column ix+w
+static void bw_disp_rle_decode(bwd_rle_cursor_t *cur, uint16_t ix, uint16_t w, uint8_t *dst)
+{
+    const uint8_t *p = cur->p;
+    int col = cur->col;
+    int end = ix + w;
+    while (col < end)
+    {
+        uint8_t t = p[0];
+        int n = (t & 0x3F) + 1;
+        int s = MAX(col, ix);
+        int e = MIN(col + n, end);
+        if ((t & 0xC0) == BWD_RLE_LITERAL)
+        {
+            if (e > s)
+            {
+                memcpy(&(dst[s - ix]), &(p[1 + s - col]), e - s);
+            }
+            if (col + n > end)
+            {
+                break;
+            }
+            p += 1 + n;
+        }
+        else
+        {
+            uint8_t v = ((t & 0xC0) == BWD_RLE_ZEROS) ? 0x00 : ((t & 0xC0) == BWD_RLE_ONES) ? 0xFF : p[1];
+            if (e > s)
+            {
+                memset(&(dst[s - ix]), v, e - s);
+            }
+            if (col + n > end)
+            {
+                break;
+            }
+            p += ((t & 0xC0) == BWD_RLE_REPEAT) ? 2 : 1;
+        }
+        col += n;
+    }
+    cur->p = p;
+    cur->col = col;
+}
+
+// Encodes a page row, returns the encoded size. Only measures the size if out is NULL.
+static size_t bw_disp_rle_encode_row(const uint8_t *row, int w, uint8_t *out)
+{
+    size_t size = 0;
+    int i = 0;
+    while (i < w)
+    {
+        int n = 1;
+        while (i + n < w && n < BWD_RLE_MAX_RUN && row[i + n] == row[i])
+        {
+            n++;
+        }
+        if (n >= 2 || row[i] == 0x00 || row[i] == 0xFF)
+        {
+            uint8_t t = (row[i] == 0x00) ? BWD_RLE_ZEROS : (row[i] == 0xFF) ? BWD_RLE_ONES : BWD_RLE_REPEAT;
+            if (out != NULL)
+            {
+                out[size] = t | (n - 1);
+                if (t == BWD_RLE_REPEAT)
+                {
+                    out[size + 1] = row[i];
+                }
+            }
+            size += (t == BWD_RLE_REPEAT) ? 2 : 1;
+            i += n;
+            continue;
+        }
+        // literal up to the next run
+        n = 1;
+        while (i + n < w && n < BWD_RLE_MAX_RUN && row[i + n] != 0x00 && row[i + n] != 0xFF &&
+            !(i + n + 1 < w && row[i + n + 1] == row[i + n]))
+        {
+            n++;
+        }
+        if (out != NULL)
+        {
+            out[size] = BWD_RLE_LITERAL | (n - 1);
+            memcpy(&(out[size + 1]), &(row[i]), n);
+        }
+        size += 1 + n;
+        i += n;
+    }
+    return size;
+}
+
+// Gets columns ix..ix+w-1 of the image page row
+static void bw_disp_image_row(const bw_image_t *img, int page, uint16_t ix, uint16_t w, uint8_t *dst)
+{
+    if (img->format == BWIF_RLE)
+    {
+        bwd_rle_cursor_t cur;
+        bw_disp_rle_seek(img, page, &cur);
+        bw_disp_rle_decode(&cur, ix, w, dst);
     }
-    ret = bw_disp_vline(handle, x, y, h, c);
-    if (ret != ESP_OK)
+    else
     {
-        return ret;
+        memcpy(dst, &(img->image[page * img->width + ix]), w);
     }
-    ret = bw_disp_hline(handle, x, y + h - 1, w, c);
-    if (ret != ESP_OK)
+}
+
+bw_image_t* bw_image_compress(const bw_image_t *img)
+{
+    if (img == NULL || img->format != BWIF_RAW)
     {
-        return ret;
+        ESP_LOGE(TAG, "Invalid image!");
+        return NULL;
     }
-    ret = bw_disp_vline(handle, x + w - 1, y, h, c);
-    return ret;
+    int pages = (img->height + 7) >> 3;
+    size_t size = 2 * pages;
+    for (int p = 0; p < pages; p++)
+    {
+        size_t row_size = bw_disp_rle_encode_row(&(img->image[p * img->width]), img->width, NULL);
+        if (size + row_size - 2 * pages > 0xFFFF)
+        {
+            ESP_LOGE(TAG, "Compressed image too big");
+            return NULL;
+        }
+        size += row_size;
+    }
+    bw_image_t *cimg = (bw_image_t *) malloc(sizeof(bw_image_t) + size);
+    if (cimg == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to allocate compressed image");
+        return NULL;
+    }
+    cimg->width = img->width;
+    cimg->height = img->height;
+    cimg->format = BWIF_RLE;
+    size_t offset = 0;
+    for (int p = 0; p < pages; p++)
+    {
+        cimg->image[2 * p] = offset & 0xFF;
+        cimg->image[2 * p + 1] = offset >> 8;
+        offset += bw_disp_rle_encode_row(&(img->image[p * img->width]), img->width, &(cimg->image[2 * pages + offset]));
+    }
+    return cimg;
 }
 
-esp_err_t bw_disp_fill_rect(bw_disp_handle_t handle, uint16_t x, uint16_t y, uint16_t w, uint16_t h, bw_disp_clr_t c)
+size_t bw_image_data_size(const bw_image_t *img)
 {
-    esp_err_t ret;
-    for (int i = 0; i < w; i++, x++)
+    if (img == NULL)
     {
-        ret = bw_disp_vline(handle, x, y, h, c);
-        if (ret != ESP_OK)
+        return 0;
+    }
+    int pages = (img->height + 7) >> 3;
+    if (img->format != BWIF_RLE)
+    {
+        return (size_t) img->width * pages;
+    }
+    // the last page row ends the data
+    size_t size = 2 * pages + (img->image[2 * (pages - 1)] | (img->image[2 * (pages - 1) + 1] << 8));
+    const uint8_t *p = &(img->image[size]);
+    for (int col = 0; col < img->width;)
+    {
+        uint8_t t = p[0];
+        int len = ((t & 0xC0) == BWD_RLE_LITERAL) ? 1 + (t & 0x3F) + 1 : ((t & 0xC0) == BWD_RLE_REPEAT) ? 2 : 1;
+        col += (t & 0x3F) + 1;
+        p += len;
+        size += len;
+    }
+    return size;
+}
+
+bool bw_image_is_valid(const bw_image_t *img, size_t size)
+{
+    if (img == NULL || size < offsetof(bw_image_t, image))
+    {
+        return false;
+    }
+    size -= offsetof(bw_image_t, image);
+    int pages = (img->height + 7) >> 3;
+    if (img->format == BWIF_RAW)
+    {
+        return (size_t) img->width * pages <= size;
+    }
+    if (img->format != BWIF_RLE || pages == 0 || (size_t) 2 * pages > size)
+    {
+        return false;
+    }
+    // every page row has to decode to width columns without leaving the data
+    for (int page = 0; page < pages; page++)
+    {
+        size_t pos = 2 * pages + (img->image[2 * page] | (img->image[2 * page + 1] << 8));
+        for (int col = 0; col < img->width;)
         {
-            return ret;
+            if (pos >= size)
+            {
+                return false;
+            }
+            uint8_t t = img->image[pos];
+            pos += ((t & 0xC0) == BWD_RLE_LITERAL) ? 1 + (t & 0x3F) + 1 : ((t & 0xC0) == BWD_RLE_REPEAT) ? 2 : 1;
+            col += (t & 0x3F) + 1;
+        }
+        if (pos > size)
+        {
+            return false;
         }
     }
-    return ESP_OK;
+    return true;
 }
 
+// Blits a compressed image, decoding up to BWD_RLE_CHUNK columns of one or two image page rows per display page.
+// Every image page row keeps a cursor, so it is decoded once however many chunks it takes.
+static void bw_disp_blit_rle(uint8_t *dst, int dst_stride, const bw_image_t *img, uint16_t ix, uint16_t iw, 
+    const uint8_t masks[], int page_cnt, int img_page, int last_img_page, bool has_prev, int shr, bool inv, bw_disp_img_draw_mode_t mode)
+{
+    uint8_t rows[2][BWD_RLE_CHUNK]; // previous and current image page row
+    bwd_rle_cursor_t cursors[page_cnt + 1];   // image page rows img_page - 1 ..
+    for (int p = has_prev ? 0 : 1; p <= page_cnt && img_page - 1 + p <= last_img_page; p++)
+    {
+        bw_disp_rle_seek(img, img_page - 1 + p, &(cursors[p]));
+    }
+    for (uint16_t c = 0; c < iw; c += BWD_RLE_CHUNK)
+    {
+        uint16_t w = MIN(BWD_RLE_CHUNK, iw - c);
+        if (has_prev)
+        {
+            bw_disp_rle_decode(&(cursors[0]), ix + c, w, rows[1]);
+        }
+        for (int p = 0; p < page_cnt; p++)
+        {
+            uint8_t *d = &(dst[p * dst_stride + c]);
+            if (shr == 0)
+            {
+                bw_disp_rle_decode(&(cursors[p + 1]), ix + c, w, rows[1]);
+                bw_disp_blit_aligned(d, dst_stride, rows[1], BWD_RLE_CHUNK, w, &(masks[p]), 1, inv, mode);
+                continue;
+            }
+            if (has_prev || p > 0)
+            {
+                memcpy(rows[0], rows[1], w);
+            }
+            if (img_page + p <= last_img_page)
+            {
+                bw_disp_rle_decode(&(cursors[p + 1]), ix + c, w, rows[1]);
+            }
+            else
+            {
+                memset(rows[1], 0, w);
+            }
+            bw_disp_blit_shifted(d, dst_stride, rows[1], BWD_RLE_CHUNK, w, &(masks[p]), 1, 1, has_prev || p > 0, shr, inv, mode);
+        }
+    }
+}
+
+// Computes mask of rows covered by the rectangle starting at row y, h rows high, for each page it spans.
+// Returns the number of pages.
+static int bw_disp_page_masks(uint16_t y, uint16_t h, uint8_t masks[])
+{
+    int first_page = y >> 3;
+    uint16_t ly = y + h - 1;
+    int page_cnt = (ly >> 3) - first_page + 1;
+    for (int p = 0; p < page_cnt; p++)
+    {
+        masks[p] = 0xFF;
+    }
+    masks[0] &= 0xFF << (y & 0x07);
+    masks[page_cnt - 1] &= 0xFF >> (7 - (ly & 0x07));
+    return page_cnt;
+}
+
+// Draws part of the image at buffer row y. The part must fit in the image and in the buffer (iw > 0, ih > 0).
+static void bw_disp_image_blit(bw_disp_t *inst, uint16_t x, uint16_t y, uint16_t ix, uint16_t iy, uint16_t iw, uint16_t ih, 
+    bool inv_img, bw_disp_img_draw_mode_t mode, const bw_image_t *img)
+{
+    uint8_t masks[inst->page_num];
+    int page_cnt = bw_disp_page_masks(y, ih, masks);
+    int first_page = y >> 3;            // first page in the display buffer
+    int first_img_page = iy >> 3;       // first page in the image buffer
+    int last_img_page = (iy + ih - 1) >> 3; // last page in the image buffer
+    uint16_t yo = y & 0x07;             // display y offset
+    uint16_t iyo = iy & 0x07;           // image y offset
+    uint16_t imgw = img->width;
+    uint16_t dispw = inst->disp_if->width;
+    uint8_t *dst = &(inst->pages[first_page][x]);
+    if (img->format == BWIF_RLE)
+    {
+        int img_page = (iyo > yo) ? first_img_page + 1 : first_img_page;
+        int shr = (yo == iyo) ? 0 : (iyo > yo) ? (iyo - yo) : (iyo + 8 - yo);
+        bw_disp_blit_rle(dst, dispw, img, ix, iw, masks, page_cnt, img_page, last_img_page, img_page > first_img_page, shr, inv_img, mode);
+    }
+    else if (yo == iyo)
+    {
+        bw_disp_blit_aligned(dst, dispw, &(img->image[first_img_page * imgw + ix]), imgw, iw, masks, page_cnt, inv_img, mode);
+    }
+    else
+    {
+        int img_page = (iyo > yo) ? first_img_page + 1 : first_img_page; // image page used as "current" by the first display page
+        int shr = (iyo > yo) ? (iyo - yo) : (iyo + 8 - yo);
+        bw_disp_blit_shifted(dst, dispw, &(img->image[img_page * imgw + ix]), imgw, iw, masks, page_cnt,
+            last_img_page - img_page + 1, img_page > first_img_page, shr, inv_img, mode);
+    }
+    bw_disp_set_dirty_rect(inst, x, y, iw, ih);
+}
+
+// Draws part of the image clipped to the display. Rows wrapping around the end of the buffer (scrolled display) 
+// are drawn as a separate part.
 static esp_err_t bw_disp_image_sel_priv(bw_disp_t *inst, uint16_t x, uint16_t y, uint16_t ix, uint16_t iy, uint16_t iw, uint16_t ih, 
     bool inv_img, bw_disp_img_draw_mode_t mode, bw_image_t *img)
 {
@@ -440,110 +2042,77 @@ static esp_err_t bw_disp_image_sel_priv(bw_disp_t *inst, uint16_t x, uint16_t y,
     {
         ih = inst->disp_if->height - y;
     }
-    int first_page = y >> 3;    // first page in the display buffer
-    uint16_t ly = y + ih - 1;  // last y in the display buffer
-    int last_page = ly >> 3;   // last page in the display buffer
-    
-    int first_img_page =  iy >> 3;    // first page in the image buffer
-    uint16_t ily = iy + ih - 1;  // last y in the image buffer
-    int last_img_page =  ily >> 3;    // first page in the image buffer
-
-    uint16_t imgw = img->width;
-    
-    uint16_t yo = y & 0x07; // display y offset;
-    uint16_t iyo = iy & 0x07; // image y offset;
-
-    uint16_t lyo = ly & 0x07; // display lasy y offset;
-    //uint16_t ilyo = ily & 0x07; // image last y offset;
-
-    int page = first_page;
-    int img_page = first_img_page;
-
-    if (iyo > yo)
+    if (iw == 0 || ih == 0)
     {
-        img_page++;
+        return ESP_OK;
     }
-
-    uint8_t page_mask = 0;          // display page mask
-
-    for (int i = 0; i < yo; i++)
+    uint16_t row = bw_disp_surface_row(&(inst->surface), y);
+    uint16_t ih0 = MIN(ih, inst->disp_if->height - row);
+    bw_disp_image_blit(inst, x, row, ix, iy, iw, ih0, inv_img, mode, img);
+    if (ih0 < ih)
     {
-        page_mask |= 1 << i;   
+        bw_disp_image_blit(inst, x, 0, ix, iy + ih0, iw, ih - ih0, inv_img, mode, img);
     }
+    return ESP_OK;
+}
 
-    uint8_t last_page_mask = 0;     // last display page mask
-
-    if (lyo < 7)
+static esp_err_t bw_disp_canvas_compose(bw_disp_t *inst)
+{
+    bwd_view_t *view = inst->view;
+    BWD_LOCKED_INSTANCE(disp, view->disp);
+    if (disp == NULL)
     {
-        for (int i = lyo + 1; i <= 7; i++)
-        {
-            last_page_mask |= 1 << i;   
-        }
-        if (first_page == last_page)
-        {
-            page_mask |= last_page_mask;
-        }
+        ESP_LOGE(TAG, "Display of the canvas is closed. Handle: #%d", inst->handle);
+        return ESP_ERR_INVALID_STATE;
     }
-
-    int shrp = (iyo >= yo) ? (iyo - yo) : (iyo + 8 - yo); // shift right previous image page
-    int shlc = shrp > 0 ? 8 - shrp : 0; // shift left current image page
-    
-    while (page <= last_page)
+    uint16_t w = view->width;
+    uint16_t h = view->height;
+    int dy = view->y - view->shown_y;
+    if (!view->shown || view->x != view->shown_x || abs(dy) >= h || (dy != 0 && !bw_disp_can_scroll(disp)))
+    {
+        bw_disp_image_sel_priv(disp, 0, 0, view->x, view->y, w, h, false, BWDM_OVERRIDE, view->image);
+    }
+    else
     {
-        uint8_t img_mask = ~page_mask;
-        for (int i = 0; i < iw; i++)
+        if (dy != 0)
         {
-            //uint16_t pixels = inst->pages[page][x + i] & page_mask;
-            uint16_t pixels = 0;
-            if (img_page > first_img_page && shrp > 0)
-            {
-                uint8_t ppxs = (img->image[(imgw * (img_page - 1)) + ix + i] >> shrp);
-                if (inv_img)
-                {
-                    ppxs = ~ppxs;
-                }
-                pixels |= ppxs & img_mask;
-            }            
-            if (img_page <= last_img_page)
+            // rows still in the viewport are moved by the start line, only the exposed ones are copied
+            uint16_t n = abs(dy);
+            uint16_t y = (dy > 0) ? h - n : 0;
+            bw_disp_scroll_rows(disp, dy);
+            bw_disp_image_sel_priv(disp, 0, y, view->x, view->y + y, w, n, false, BWDM_OVERRIDE, view->image);
+        }
+        // canvas changes inside the viewport
+        for (int page = 0; page < inst->page_num; page++)
+        {
+            const bw_disp_span_t *span = &(inst->dirty[page]);
+            int y0 = MAX(page * 8, view->y);
+            int y1 = MIN(page * 8 + 7, view->y + h - 1);
+            int x0 = MAX(span->x0, view->x);
+            int x1 = MIN(span->x1, view->x + w - 1);
+            if (y0 <= y1 && x0 <= x1)
             {
-                uint8_t pxs = (img->image[(imgw * img_page) + ix + i] << shlc);
-                if (inv_img)
-                {
-                    pxs = ~pxs;
-                }
-                pixels |= pxs & img_mask;
-            }
-            switch (mode)
-            {                
-            case BWDM_ADD_WHITE:
-                pixels |= inst->pages[page][x + i];
-                break;
-            case BWDM_ADD_BLACK:
-                pixels &= inst->pages[page][x + i];
-                break;
-            case BWDM_OVERRIDE:
-            default:
-                pixels |= inst->pages[page][x + i] & page_mask;
-                break;
+                bw_disp_image_sel_priv(disp, x0 - view->x, y0 - view->y, x0, y0, x1 - x0 + 1, y1 - y0 + 1, false, BWDM_OVERRIDE, view->image);
             }
-            inst->pages[page][x + i] = pixels;
         }
-        img_page++;
-        page++;        
-        page_mask = (page < last_page) ? 0 : last_page_mask;
     }
-    bw_disp_set_dirty_rect(inst, x, y, iw, ih);
+    bw_disp_clear_dirty_rect(inst);
+    view->shown = true;
+    view->shown_x = view->x;
+    view->shown_y = view->y;
     return ESP_OK;
 }
 
 esp_err_t bw_disp_image_sel_ex(bw_disp_handle_t handle, uint16_t x, uint16_t y, uint16_t ix, uint16_t iy, uint16_t iw, uint16_t ih, 
     bool inv_img, bw_disp_img_draw_mode_t mode, bw_image_t *img)
 {
-    bw_disp_t *inst = bw_disp_get_instance(handle);
+    BWD_LOCKED_INSTANCE(inst, handle);
     if (inst == NULL)
     {
         return ESP_ERR_INVALID_ARG;
     }
+    BWD_STATS_PRIM(inst, BWDP_IMAGE);
+    DISP_TRACE_SCOPE(handle, BWT_IMAGE, 0);
     if (x >= inst->disp_if->width || y >= inst->disp_if->height)
     {
         return ESP_ERR_INVALID_ARG;
@@ -573,6 +2142,264 @@ esp_err_t bw_disp_image(bw_disp_handle_t handle, uint16_t x, uint16_t y, bw_imag
     return bw_disp_image_sel(handle, x, y, 0, 0, 0xFFFF, 0xFFFF, img);
 }
 
+bw_prepared_image_t* bw_image_prepare(const bw_image_t *img, uint8_t shifts)
+{
+    if (img == NULL || shifts == 0)
+    {
+        ESP_LOGE(TAG, "Invalid image or shifts!");
+        return NULL;
+    }
+    size_t size = sizeof(bw_prepared_image_t);
+    for (int s = 0; s < 8; s++)
+    {
+        if (shifts & (1 << s))
+        {
+            // variants are kept aligned for their bw_image_t headers
+            size_t data_size = (size_t) img->width * ((s + img->height + 7) >> 3);
+            size += sizeof(bw_image_t) + ((data_size + 1) & ~((size_t) 1));
+        }
+    }
+    bw_prepared_image_t *pimg = (bw_prepared_image_t *) calloc(1, size);
+    if (pimg == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to allocate prepared image");
+        return NULL;
+    }
+    pimg->width = img->width;
+    pimg->height = img->height;
+    pimg->size = size;
+    int src_pages = (img->height + 7) >> 3;
+    uint8_t *next = (uint8_t *) (pimg + 1);
+    for (int s = 0; s < 8; s++)
+    {
+        if (!(shifts & (1 << s)))
+        {
+            continue;
+        }
+        int pages = (s + img->height + 7) >> 3;
+        size_t data_size = (size_t) img->width * pages;
+        bw_image_t *v = (bw_image_t *) next;
+        next += sizeof(bw_image_t) + ((data_size + 1) & ~((size_t) 1));
+        v->width = img->width;
+        v->height = pages * 8;
+        v->format = BWIF_RAW;
+        for (int p = 0; p < src_pages; p++)
+        {
+            bw_disp_image_row(img, p, 0, img->width, &(v->image[p * img->width]));
+        }
+        if (s > 0)
+        {
+            // shifted in place, from the last page up
+            for (int p = pages - 1; p >= 0; p--)
+            {
+                uint8_t *cur = &(v->image[p * img->width]);
+                for (int i = 0; i < img->width; i++)
+                {
+                    uint8_t b = (uint8_t) (cur[i] << s);
+                    if (p > 0)
+                    {
+                        b |= cur[i - img->width] >> (8 - s);
+                    }
+                    cur[i] = b;
+                }
+            }
+        }
+        pimg->variants[s] = v;
+    }
+    return pimg;
+}
+
+void bw_image_prepared_free(bw_prepared_image_t *pimg)
+{
+    free(pimg);
+}
+
+esp_err_t bw_disp_prepared_image(bw_disp_handle_t handle, uint16_t x, uint16_t y, bool inv_img, bw_disp_img_draw_mode_t mode, 
+    const bw_prepared_image_t *pimg)
+{
+    BWD_LOCKED_INSTANCE(inst, handle);
+    if (inst == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    BWD_STATS_PRIM(inst, BWDP_IMAGE);
+    DISP_TRACE_SCOPE(handle, BWT_IMAGE, 0);
+    if (pimg == NULL || x >= inst->disp_if->width || y >= inst->disp_if->height)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    // variants are selected by the row offset in the buffer page
+    uint8_t s = bw_disp_surface_row(&(inst->surface), y) & 0x07;
+    if (pimg->variants[s] == NULL)
+    {
+        // not prepared for this offset - another variant is shifted
+        s = 0;
+        while (pimg->variants[s] == NULL)
+        {
+            s++;
+        }
+    }
+    // image rows of the variant start at row s
+    return bw_disp_image_sel_priv(inst, x, y, 0, s, pimg->width, pimg->height, inv_img, mode, pimg->variants[s]);
+}
+
+// Gets 8 pixels starting at column x of n rows (up to 8) starting at row y: a byte per row, in the bit order 
+// of the bitmap. Missing rows are 0.
+static void bw_bitmap_gather(const bw_bitmap_t *bmp, int stride, int x, int y, int n, uint8_t rows[8])
+{
+    int s = x & 0x07;
+    const uint8_t *p = &(bmp->data[y * stride + (x >> 3)]);
+    // the next byte is read only if it holds pixels of the bitmap
+    bool next = (s != 0) && ((x | 0x07) + 1 < bmp->width);
+    for (int i = 0; i < n; i++, p += stride)
+    {
+        uint8_t b0 = p[0];
+        uint8_t b1 = next ? p[1] : 0;
+        rows[i] = bmp->msb_first ? (uint8_t) ((b0 << s) | (b1 >> (8 - s))) : (uint8_t) ((b0 >> s) | (b1 << (8 - s)));
+    }
+    for (int i = n; i < 8; i++)
+    {
+        rows[i] = 0;
+    }
+}
+
+// Transposes gathered rows into 8 page-major columns (leftmost first)
+static void bw_bitmap_columns(const bw_bitmap_t *bmp, const uint8_t rows[8], uint8_t cols[8])
+{
+    if (!bmp->msb_first)
+    {
+        bw_disp_transpose8(rows, cols);
+        return;
+    }
+    uint8_t t[8];
+    bw_disp_transpose8(rows, t);
+    for (int i = 0; i < 8; i++)
+    {
+        cols[i] = t[7 - i];
+    }
+}
+
+static int bw_bitmap_stride(const bw_bitmap_t *bmp)
+{
+    return (bmp->stride != 0) ? bmp->stride : (bmp->width + 7) >> 3;
+}
+
+esp_err_t bw_bitmap_convert(const bw_bitmap_t *bmp, bw_image_t *img)
+{
+    if (bmp == NULL || bmp->data == NULL || img == NULL || img->width != bmp->width || img->height != bmp->height)
+    {
+        ESP_LOGE(TAG, "Invalid bitmap!");
+        return ESP_ERR_INVALID_ARG;
+    }
+    int stride = bw_bitmap_stride(bmp);
+    uint8_t rows[8];
+    uint8_t cols[8];
+    img->format = BWIF_RAW;
+    for (int page = 0; page * 8 < bmp->height; page++)
+    {
+        int n = MIN(8, bmp->height - page * 8);
+        uint8_t *dst = &(img->image[page * bmp->width]);
+        for (int x = 0; x < bmp->width; x += 8)
+        {
+            bw_bitmap_gather(bmp, stride, x, page * 8, n, rows);
+            if (x + 8 <= bmp->width)
+            {
+                bw_bitmap_columns(bmp, rows, &(dst[x]));
+            }
+            else
+            {
+                bw_bitmap_columns(bmp, rows, cols);
+                memcpy(&(dst[x]), cols, bmp->width - x);
+            }
+        }
+    }
+    return ESP_OK;
+}
+
+bw_image_t* bw_image_from_bitmap(const bw_bitmap_t *bmp)
+{
+    if (bmp == NULL)
+    {
+        ESP_LOGE(TAG, "Invalid bitmap!");
+        return NULL;
+    }
+    bw_image_t *img = (bw_image_t *) malloc(sizeof(bw_image_t) + bmp->width * ((bmp->height + 7) >> 3));
+    if (img == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to allocate image");
+        return NULL;
+    }
+    img->width = bmp->width;
+    img->height = bmp->height;
+    if (bw_bitmap_convert(bmp, img) != ESP_OK)
+    {
+        free(img);
+        return NULL;
+    }
+    return img;
+}
+
+esp_err_t bw_disp_bitmap_sel_ex(bw_disp_handle_t handle, uint16_t x, uint16_t y, uint16_t ix, uint16_t iy, uint16_t iw, uint16_t ih, 
+    bool inv_img, bw_disp_img_draw_mode_t mode, const bw_bitmap_t *bmp)
+{
+    BWD_LOCKED_INSTANCE(inst, handle);
+    if (inst == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    BWD_STATS_PRIM(inst, BWDP_IMAGE);
+    DISP_TRACE_SCOPE(handle, BWT_IMAGE, 0);
+    if (bmp == NULL || bmp->data == NULL || x >= inst->disp_if->width || y >= inst->disp_if->height)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (ix >= bmp->width || iy >= bmp->height)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    // only the part on the display is transposed
+    iw = MIN(iw, MIN(bmp->width - ix, inst->disp_if->width - x));
+    ih = MIN(ih, MIN(bmp->height - iy, inst->disp_if->height - y));
+    int stride = bw_bitmap_stride(bmp);
+    uint8_t rows[8];
+    // page row of the bitmap part, drawn as an image
+    uint8_t tile_buf[sizeof(bw_image_t) + BWD_BITMAP_CHUNK] __attribute__((aligned(4)));
+    bw_image_t *tile = (bw_image_t *) tile_buf;
+    tile->format = BWIF_RAW;
+    for (uint16_t r = 0; r < ih; r += 8)
+    {
+        uint16_t n = MIN(8, ih - r);
+        for (uint16_t c = 0; c < iw; c += BWD_BITMAP_CHUNK)
+        {
+            uint16_t w = MIN(BWD_BITMAP_CHUNK, iw - c);
+            for (uint16_t k = 0; k < w; k += 8)
+            {
+                bw_bitmap_gather(bmp, stride, ix + c + k, iy + r, n, rows);
+                bw_bitmap_columns(bmp, rows, &(tile->image[k]));
+            }
+            tile->width = w;
+            tile->height = n;
+            bw_disp_image_sel_priv(inst, x + c, y + r, 0, 0, w, n, inv_img, mode, tile);
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t bw_disp_bitmap(bw_disp_handle_t handle, uint16_t x, uint16_t y, const bw_bitmap_t *bmp)
+{
+    return bw_disp_bitmap_sel_ex(handle, x, y, 0, 0, 0xFFFF, 0xFFFF, false, BWDM_OVERRIDE, bmp);
+}
+
+bw_disp_surface_t* bw_disp_get_surface(bw_disp_handle_t handle)
+{
+    bw_disp_t *inst = bw_disp_get_instance(handle);
+    if (inst == NULL)
+    {
+        return NULL;
+    }
+    return &(inst->surface);
+}
+
 uint16_t bw_disp_get_height(bw_disp_handle_t handle)
 {
     bw_disp_t *inst = bw_disp_get_instance(handle);
@@ -0,0 +1,298 @@
+// bw_disp_asset.c
+
+#include <stddef.h>
+#include <string.h>
+#include "esp_err.h"
+#include "esp_log.h"
+
+#ifdef ESP_PLATFORM
+#include "esp_partition.h"
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "bw_disp_asset.h"
+
+/** @file */
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__)
+#error "Asset packs are used in place and require a little endian target"
+#endif
+
+// payloads are used in place, so their layout has to match the structures
+_Static_assert(offsetof(bw_image_t, image) == 5, "Unexpected bw_image_t layout");
+_Static_assert(sizeof(bw_glyph_t) == 4, "Unexpected bw_glyph_t layout");
+
+#define BWA_MAGIC           "BWAP"
+#define BWA_VERSION         1
+#define BWA_HEADER_SIZE     16
+#define BWA_ENTRY_SIZE      32
+#define BWA_FONT_HEADER_SIZE 24
+
+#define TAG "BW_ASSET"
+
+static uint16_t bw_asset_rd16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t bw_asset_rd32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static uint32_t bw_asset_hash(const char *name)
+{
+    uint32_t h = 2166136261UL;
+    for (; *name != '\0'; name++)
+    {
+        h = (h ^ (uint8_t) *name) * 16777619UL;
+    }
+    return h;
+}
+
+static const uint8_t* bw_asset_entry(const bw_asset_pack_t *pack, int id)
+{
+    if (pack == NULL || pack->data == NULL || id < 0 || id >= pack->entry_num)
+    {
+        return NULL;
+    }
+    return &(pack->data[BWA_HEADER_SIZE + id * BWA_ENTRY_SIZE]);
+}
+
+esp_err_t bw_asset_pack_open_mem(const void *data, size_t size, bw_asset_pack_t *pack)
+{
+    if (data == NULL || pack == NULL || ((uintptr_t) data & 0x03) != 0)
+    {
+        ESP_LOGE(TAG, "Invalid pack data!");
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(pack, 0, sizeof(*pack));
+    const uint8_t *p = (const uint8_t *) data;
+    if (size < BWA_HEADER_SIZE || memcmp(p, BWA_MAGIC, 4) != 0 || bw_asset_rd16(&(p[4])) != BWA_VERSION)
+    {
+        ESP_LOGE(TAG, "Not an asset pack (or unsupported version)");
+        return ESP_ERR_INVALID_VERSION;
+    }
+    uint16_t entry_num = bw_asset_rd16(&(p[6]));
+    uint16_t hash_size = bw_asset_rd16(&(p[8]));
+    uint32_t pack_size = bw_asset_rd32(&(p[12]));
+    size_t index_size = BWA_HEADER_SIZE + (size_t) entry_num * BWA_ENTRY_SIZE + (size_t) hash_size * 2;
+    if (pack_size > size || index_size > pack_size || (hash_size & (hash_size - 1)) != 0 || hash_size < entry_num)
+    {
+        ESP_LOGE(TAG, "Corrupted asset pack");
+        return ESP_ERR_INVALID_SIZE;
+    }
+    for (int id = 0; id < entry_num; id++)
+    {
+        const uint8_t *e = &(p[BWA_HEADER_SIZE + id * BWA_ENTRY_SIZE]);
+        uint32_t offset = bw_asset_rd32(&(e[24]));
+        uint32_t payload_size = bw_asset_rd32(&(e[28]));
+        if ((offset & 0x03) != 0 || offset < index_size || offset > pack_size || payload_size > pack_size - offset)
+        {
+            ESP_LOGE(TAG, "Corrupted asset pack entry: %d", id);
+            return ESP_ERR_INVALID_SIZE;
+        }
+    }
+    pack->data = p;
+    pack->size = pack_size;
+    pack->entry_num = entry_num;
+    pack->hash_size = hash_size;
+    return ESP_OK;
+}
+
+#ifdef ESP_PLATFORM
+esp_err_t bw_asset_pack_open_partition(const char *label, bw_asset_pack_t *pack)
+{
+    if (label == NULL || pack == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    const esp_partition_t *part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+    if (part == NULL)
+    {
+        ESP_LOGE(TAG, "Partition not found: %s", label);
+        return ESP_ERR_NOT_FOUND;
+    }
+    const void *data = NULL;
+    esp_partition_mmap_handle_t map_handle;
+    esp_err_t ret = esp_partition_mmap(part, 0, part->size, ESP_PARTITION_MMAP_DATA, &data, &map_handle);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to map partition: %s", label);
+        return ret;
+    }
+    ret = bw_asset_pack_open_mem(data, part->size, pack);
+    if (ret != ESP_OK)
+    {
+        esp_partition_munmap(map_handle);
+        return ret;
+    }
+    // mapping handles start at 0, so they are kept off by one
+    pack->map_handle = (void *) ((uintptr_t) map_handle + 1);
+    ESP_LOGI(TAG, "Asset pack opened. Partition: %s; Assets: %d; Size: %d", label, pack->entry_num, (int) pack->size);
+    return ESP_OK;
+}
+#else
+esp_err_t bw_asset_pack_open_file(const char *path, bw_asset_pack_t *pack)
+{
+    if (path == NULL || pack == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        ESP_LOGE(TAG, "Failed to open: %s", path);
+        return ESP_ERR_NOT_FOUND;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        ESP_LOGE(TAG, "Invalid pack file: %s", path);
+        close(fd);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        ESP_LOGE(TAG, "Failed to map: %s", path);
+        return ESP_FAIL;
+    }
+    esp_err_t ret = bw_asset_pack_open_mem(data, st.st_size, pack);
+    if (ret != ESP_OK)
+    {
+        munmap(data, st.st_size);
+        return ret;
+    }
+    // the whole file is unmapped on close
+    pack->size = st.st_size;
+    pack->map_handle = data;
+    ESP_LOGI(TAG, "Asset pack opened. File: %s; Assets: %d; Size: %d", path, pack->entry_num, (int) pack->size);
+    return ESP_OK;
+}
+#endif
+
+void bw_asset_pack_close(bw_asset_pack_t *pack)
+{
+    if (pack == NULL || pack->data == NULL)
+    {
+        return;
+    }
+    if (pack->map_handle != NULL)
+    {
+#ifdef ESP_PLATFORM
+        esp_partition_munmap((esp_partition_mmap_handle_t) ((uintptr_t) pack->map_handle - 1));
+#else
+        munmap(pack->map_handle, pack->size);
+#endif
+    }
+    memset(pack, 0, sizeof(*pack));
+}
+
+int bw_asset_find(const bw_asset_pack_t *pack, const char *name)
+{
+    if (pack == NULL || pack->data == NULL || name == NULL || pack->hash_size == 0)
+    {
+        return -1;
+    }
+    const uint8_t *table = &(pack->data[BWA_HEADER_SIZE + pack->entry_num * BWA_ENTRY_SIZE]);
+    uint16_t mask = pack->hash_size - 1;
+    for (uint16_t i = bw_asset_hash(name) & mask, n = 0; n < pack->hash_size; i = (i + 1) & mask, n++)
+    {
+        uint16_t slot = bw_asset_rd16(&(table[2 * i]));
+        if (slot == 0 || slot > pack->entry_num)
+        {
+            return -1;
+        }
+        const char *entry_name = (const char *) &(pack->data[BWA_HEADER_SIZE + (slot - 1) * BWA_ENTRY_SIZE]);
+        if (strncmp(entry_name, name, BWA_NAME_MAX_LEN + 1) == 0)
+        {
+            return slot - 1;
+        }
+    }
+    return -1;
+}
+
+bw_asset_type_t bw_asset_get_type(const bw_asset_pack_t *pack, int id)
+{
+    const uint8_t *e = bw_asset_entry(pack, id);
+    if (e == NULL)
+    {
+        return BWAT_NONE;
+    }
+    return (bw_asset_type_t) e[20];
+}
+
+bw_image_t* bw_asset_image(const bw_asset_pack_t *pack, int id)
+{
+    const uint8_t *e = bw_asset_entry(pack, id);
+    // the image is drawn in place, so its data must not reach past the payload
+    if (e == NULL || e[20] != BWAT_IMAGE || !bw_image_is_valid((const bw_image_t *) &(pack->data[bw_asset_rd32(&(e[24]))]), bw_asset_rd32(&(e[28]))))
+    {
+        ESP_LOGE(TAG, "Invalid image asset: %d", id);
+        return NULL;
+    }
+    return (bw_image_t *) &(pack->data[bw_asset_rd32(&(e[24]))]);
+}
+
+// Checks that the glyph table and the glyph bitmaps of the font lie inside its payload (size bytes at f)
+static bool bw_asset_font_is_valid(const bw_font_t *font, const uint8_t *f, uint32_t size, uint32_t glyphs_offset, uint32_t bitmap_offset)
+{
+    if (bitmap_offset > size)
+    {
+        return false;
+    }
+    size_t bitmap_size = size - bitmap_offset;
+    int pages = (font->height + 7) >> 3;
+    if (glyphs_offset == 0)
+    {
+        return (size_t) font->char_num * font->width * pages <= bitmap_size;
+    }
+    if (glyphs_offset > size || ((uintptr_t) &(f[glyphs_offset]) & 0x01) != 0 || (size - glyphs_offset) / sizeof(bw_glyph_t) < font->char_num)
+    {
+        return false;
+    }
+    for (int i = 0; i < font->char_num; i++)
+    {
+        if (font->glyphs[i].offset + (size_t) font->glyphs[i].width * pages > bitmap_size)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+esp_err_t bw_asset_font(const bw_asset_pack_t *pack, int id, bw_font_t *font)
+{
+    const uint8_t *e = bw_asset_entry(pack, id);
+    if (e == NULL || font == NULL || e[20] != BWAT_FONT || bw_asset_rd32(&(e[28])) < BWA_FONT_HEADER_SIZE)
+    {
+        ESP_LOGE(TAG, "Invalid font asset: %d", id);
+        return ESP_ERR_INVALID_ARG;
+    }
+    const uint8_t *f = &(pack->data[bw_asset_rd32(&(e[24]))]);
+    uint32_t glyphs_offset = bw_asset_rd32(&(f[16]));
+    uint32_t bitmap_offset = bw_asset_rd32(&(f[20]));
+    bw_font_t asset_font;
+    asset_font.height = f[0];
+    asset_font.width = f[1];
+    asset_font.spacing = f[2];
+    asset_font.first_char = bw_asset_rd32(&(f[4]));
+    asset_font.char_num = bw_asset_rd16(&(f[8]));
+    asset_font.default_char = bw_asset_rd32(&(f[12]));
+    asset_font.glyphs = (glyphs_offset != 0) ? (const bw_glyph_t *) &(f[glyphs_offset]) : NULL;
+    asset_font.bitmap = &(f[bitmap_offset]);
+    // glyphs are drawn in place, so neither the table nor the bitmaps may reach past the payload
+    if (!bw_asset_font_is_valid(&asset_font, f, bw_asset_rd32(&(e[28])), glyphs_offset, bitmap_offset))
+    {
+        ESP_LOGE(TAG, "Invalid font asset: %d", id);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    *font = asset_font;
+    return ESP_OK;
+}
@@ -0,0 +1,311 @@
+// bw_disp_font.c
+
+#include <string.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "bw_disp_font.h"
+#include "disp_stats.h"
+#include "disp_trace.h"
+
+/** @file */
+
+/** Number of entries of the glyph cache */
+#define BW_FONT_CACHE_SIZE 64
+/** Code point returned for invalid UTF-8 sequences */
+#define BW_FONT_REPLACEMENT_CHAR 0xFFFD
+
+#define TAG "BW_FONT"
+
+/** @brief Glyph cache entry: glyph shifted down by a number of rows and padded to its advance */
+typedef struct
+{
+    const bw_font_t *font;      ///< Font of the cached glyph (NULL if entry is empty)
+    uint16_t index;             ///< Glyph index
+    uint8_t shift;              ///< Rows the glyph is shifted down by (y offset within a page)
+    size_t size;                ///< Size of the allocated image data
+    bw_image_t *img;            ///< Shifted glyph
+} bw_glyph_cache_entry_t;
+
+static bw_glyph_cache_entry_t s_bw_glyph_cache[BW_FONT_CACHE_SIZE];  ///< Direct-mapped glyph cache
+static SemaphoreHandle_t s_bw_glyph_cache_lock = NULL;                ///< Protects the cache (shared by all displays)
+static portMUX_TYPE s_bw_glyph_cache_mux = portMUX_INITIALIZER_UNLOCKED;
+
+
+// Locks the glyph cache, creating the lock on first use (false if it could not be created)
+static bool bw_font_cache_lock(void)
+{
+    if (__atomic_load_n(&s_bw_glyph_cache_lock, __ATOMIC_ACQUIRE) == NULL)
+    {
+        SemaphoreHandle_t lock = xSemaphoreCreateMutex();
+        if (lock == NULL)
+        {
+            ESP_LOGE(TAG, "Failed to create glyph cache lock");
+            return false;
+        }
+        taskENTER_CRITICAL(&s_bw_glyph_cache_mux);
+        if (s_bw_glyph_cache_lock == NULL)
+        {
+            __atomic_store_n(&s_bw_glyph_cache_lock, lock, __ATOMIC_RELEASE);
+            lock = NULL;
+        }
+        taskEXIT_CRITICAL(&s_bw_glyph_cache_mux);
+        if (lock != NULL)
+        {
+            // created by another task meanwhile
+            vSemaphoreDelete(lock);
+        }
+    }
+    xSemaphoreTake(s_bw_glyph_cache_lock, portMAX_DELAY);
+    return true;
+}
+
+
+// Decodes next code point of UTF-8 text and advances the text pointer
+static uint32_t bw_font_utf8_next(const char **text)
+{
+    const uint8_t *p = (const uint8_t *) *text;
+    uint32_t cp = *p++;
+    int n;
+    if (cp < 0x80)
+    {
+        n = 0;
+    }
+    else if ((cp & 0xE0) == 0xC0)
+    {
+        cp &= 0x1F;
+        n = 1;
+    }
+    else if ((cp & 0xF0) == 0xE0)
+    {
+        cp &= 0x0F;
+        n = 2;
+    }
+    else if ((cp & 0xF8) == 0xF0)
+    {
+        cp &= 0x07;
+        n = 3;
+    }
+    else
+    {
+        *text = (const char *) p;
+        return BW_FONT_REPLACEMENT_CHAR;
+    }
+    for (; n > 0; n--, p++)
+    {
+        if ((*p & 0xC0) != 0x80)
+        {
+            // truncated sequence - the byte is not consumed
+            *text = (const char *) p;
+            return BW_FONT_REPLACEMENT_CHAR;
+        }
+        cp = (cp << 6) | (*p & 0x3F);
+    }
+    *text = (const char *) p;
+    return cp;
+}
+
+// Returns glyph index of the code point (or of the default char), -1 if there is none
+static int bw_font_glyph_index(const bw_font_t *font, uint32_t cp)
+{
+    if (cp >= font->first_char && (cp - font->first_char) < font->char_num)
+    {
+        return cp - font->first_char;
+    }
+    if (font->default_char >= font->first_char && (font->default_char - font->first_char) < font->char_num)
+    {
+        return font->default_char - font->first_char;
+    }
+    return -1;
+}
+
+// Returns glyph bitmap and stores its width and advance
+static const uint8_t* bw_font_glyph(const bw_font_t *font, int index, uint8_t *wptr, uint8_t *aptr)
+{
+    if (font->glyphs == NULL)
+    {
+        *wptr = font->width;
+        *aptr = font->width + font->spacing;
+        return &(font->bitmap[index * font->width * ((font->height + 7) >> 3)]);
+    }
+    *wptr = font->glyphs[index].width;
+    *aptr = MAX(font->glyphs[index].advance, font->glyphs[index].width);
+    return &(font->bitmap[font->glyphs[index].offset]);
+}
+
+// Gets glyph shifted down by shift rows from the cache, creating it if needed
+static bw_image_t* bw_font_cached_glyph(const bw_font_t *font, int index, uint8_t shift)
+{
+    uint32_t hash = (uint32_t) index + shift * 23 + (uint32_t) (((uintptr_t) font) >> 2);
+    bw_glyph_cache_entry_t *entry = &(s_bw_glyph_cache[hash % BW_FONT_CACHE_SIZE]);
+    if (entry->font == font && entry->index == index && entry->shift == shift)
+    {
+        return entry->img;
+    }
+    uint8_t w;
+    uint8_t adv;
+    const uint8_t *bm = bw_font_glyph(font, index, &w, &adv);
+    int pages = (font->height + 7) >> 3;
+    int s_pages = (shift + font->height + 7) >> 3;
+    size_t size = (size_t) adv * s_pages;
+    entry->font = NULL;
+    if (entry->img == NULL || size > entry->size)
+    {
+        bw_image_t *img = (bw_image_t *) realloc(entry->img, sizeof(bw_image_t) + size);
+        if (img == NULL)
+        {
+            ESP_LOGE(TAG, "Failed to allocate glyph cache entry");
+            return NULL;
+        }
+        entry->img = img;
+        entry->size = size;
+    }
+    bw_image_t *img = entry->img;
+    img->width = adv;
+    img->height = s_pages * 8;
+    img->format = BWIF_RAW;
+    memset(img->image, 0, size);
+    for (int p = 0; p < pages; p++)
+    {
+        uint8_t *dst = &(img->image[p * adv]);
+        const uint8_t *src = &(bm[p * w]);
+        for (int i = 0; i < w; i++)
+        {
+            uint16_t v = (uint16_t) src[i] << shift;
+            dst[i] |= (uint8_t) v;
+            if (p + 1 < s_pages)
+            {
+                dst[adv + i] |= (uint8_t) (v >> 8);
+            }
+        }
+    }
+    entry->font = font;
+    entry->index = index;
+    entry->shift = shift;
+    return img;
+}
+
+void bw_font_cache_clear(void)
+{
+    if (!bw_font_cache_lock())
+    {
+        return;
+    }
+    for (int i = 0; i < BW_FONT_CACHE_SIZE; i++)
+    {
+        free(s_bw_glyph_cache[i].img);
+    }
+    memset(s_bw_glyph_cache, 0, sizeof(s_bw_glyph_cache));
+    xSemaphoreGive(s_bw_glyph_cache_lock);
+}
+
+uint16_t bw_font_get_height(const bw_font_t *font)
+{
+    return font != NULL ? font->height : 0;
+}
+
+uint16_t bw_font_text_width(const bw_font_t *font, const char *text)
+{
+    if (font == NULL || text == NULL)
+    {
+        return 0;
+    }
+    uint32_t width = 0;
+    while (*text != '\0')
+    {
+        int index = bw_font_glyph_index(font, bw_font_utf8_next(&text));
+        if (index >= 0)
+        {
+            uint8_t w;
+            uint8_t adv;
+            bw_font_glyph(font, index, &w, &adv);
+            width += adv;
+        }
+    }
+    return (uint16_t) MIN(width, 0xFFFF);
+}
+
+esp_err_t bw_disp_text_ex(bw_disp_handle_t handle, uint16_t x, uint16_t y, uint16_t max_w, const bw_font_t *font, const char *text,
+    bool inv_img, bw_disp_img_draw_mode_t mode, uint16_t *wptr)
+{
+    if (wptr != NULL)
+    {
+        *wptr = 0;
+    }
+    if (font == NULL || text == NULL)
+    {
+        ESP_LOGE(TAG, "Invalid font or text!");
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (bw_disp_lock(handle) != ESP_OK)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    BWD_STATS_PRIM_CALL(handle, BWDP_TEXT);
+    DISP_TRACE_SCOPE(handle, BWT_TEXT, strlen(text));
+    // cached glyphs are blitted straight from the cache, so it stays locked for the whole text
+    if (!bw_font_cache_lock())
+    {
+        bw_disp_unlock(handle);
+        return ESP_ERR_NO_MEM;
+    }
+    uint16_t width = bw_disp_get_width(handle);
+    uint16_t height = bw_disp_get_height(handle);
+    esp_err_t ret = ESP_OK;
+    if (x >= width || y >= height)
+    {
+        ret = ESP_ERR_INVALID_ARG;
+        max_w = 0;
+    }
+    else if (max_w > width - x)
+    {
+        max_w = width - x;
+    }
+    uint8_t shift = y & 0x07;
+    uint16_t w = 0;
+    while (*text != '\0' && w < max_w)
+    {
+        int index = bw_font_glyph_index(font, bw_font_utf8_next(&text));
+        if (index < 0)
+        {
+            continue;
+        }
+        bw_image_t *img = bw_font_cached_glyph(font, index, shift);
+        if (img == NULL)
+        {
+            ret = ESP_ERR_NO_MEM;
+            break;
+        }
+        uint16_t gw = MIN(img->width, max_w - w);
+        if (gw == 0)
+        {
+            continue;
+        }
+        // glyph rows in the cached image start at the same offset within a page as y, so it is a shift-free blit
+        ret = bw_disp_image_sel_ex(handle, x + w, y, 0, shift, gw, font->height, inv_img, mode, img);
+        if (ret != ESP_OK)
+        {
+            break;
+        }
+        w += gw;
+    }
+    xSemaphoreGive(s_bw_glyph_cache_lock);
+    bw_disp_unlock(handle);
+    if (wptr != NULL)
+    {
+        *wptr = w;
+    }
+    return ret;
+}
+
+esp_err_t bw_disp_text(bw_disp_handle_t handle, uint16_t x, uint16_t y, const bw_font_t *font, const char *text, bw_disp_clr_t c)
+{
+    if (c == BWDC_BLACK)
+    {
+        return bw_disp_text_ex(handle, x, y, 0xFFFF, font, text, true, BWDM_ADD_BLACK, NULL);
+    }
+    return bw_disp_text_ex(handle, x, y, 0xFFFF, font, text, false, BWDM_ADD_WHITE, NULL);
+}
@@ -28,6 +28,8 @@ uint8_t bw_disp_sh1106_close_commands[] =
 };
 
 esp_err_t bw_disp_sh1106_set_page_col(disp_proto_handle_t conn_handle, uint8_t page, uint16_t col);
+int bw_disp_sh1106_page_col_commands(uint8_t page, uint16_t col, uint8_t commands[]);
+int bw_disp_sh1106_flip_commands(bool flip_x, bool flip_y, uint8_t commands[]);
 
 
 bw_disp_if_t bw_disp_sh1106_128x64_if = 
@@ -41,12 +43,30 @@ bw_disp_if_t bw_disp_sh1106_128x64_if =
     .init_commands.buf = bw_disp_sh1106_init_commands,
     .close_commands.sz = sizeof(bw_disp_sh1106_close_commands),
     .close_commands.buf = bw_disp_sh1106_close_commands,
-    .set_page_col = &bw_disp_sh1106_set_page_col
+    .set_page_col = &bw_disp_sh1106_set_page_col,
+    .page_col_commands = &bw_disp_sh1106_page_col_commands,
+    .flip_commands = &bw_disp_sh1106_flip_commands
 };
 
+int bw_disp_sh1106_page_col_commands(uint8_t page, uint16_t col, uint8_t commands[])
+{
+    commands[0] = BWD_CMD_SET_PAGE_ADDR + page;
+    commands[1] = BWD_CMD_SET_COL_ADDR_LO + (col & 0x0F);
+    commands[2] = BWD_CMD_SET_COL_ADDR_HI + ((col >> 4) & 0x0F);
+    return 3;
+}
+
+int bw_disp_sh1106_flip_commands(bool flip_x, bool flip_y, uint8_t commands[])
+{
+    commands[0] = flip_x ? BWD_CMD_SET_SEGMENT_REMAP_NORMAL : BWD_CMD_SET_SEGMENT_REMAP_INVERSE;
+    commands[1] = flip_y ? BWD_CMD_SET_COM_SCAN_MODE_NORMAL : BWD_CMD_SET_COM_SCAN_MODE_REVERSE;
+    return 2;
+}
+
 esp_err_t bw_disp_sh1106_set_page_col(disp_proto_handle_t conn_handle, uint8_t page, uint16_t col)
 {
-    uint8_t commands[] = { BWD_CMD_SET_PAGE_ADDR + page, BWD_CMD_SET_COL_ADDR_LO + (col & 0x0F), BWD_CMD_SET_COL_ADDR_HI + ((col >> 4) & 0x0F) };
-    esp_err_t ret = disp_proto_write_commands(conn_handle, commands, sizeof(commands));
+    uint8_t commands[BWD_PAGE_COL_CMD_MAX_LEN];
+    int len = bw_disp_sh1106_page_col_commands(page, col, commands);
+    esp_err_t ret = disp_proto_write_commands(conn_handle, commands, len);
     return ret;
 }
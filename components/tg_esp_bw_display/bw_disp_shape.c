@@ -0,0 +1,471 @@
+// bw_disp_shape.c
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_err.h"
+#include "esp_log.h"
+
+#include "bw_disp.h"
+#include "disp_stats.h"
+#include "disp_trace.h"
+
+/** @file */
+
+/** Tolerance of sector boundary tests, so pixels on the boundary are not lost to rounding */
+#define BWS_SECTOR_EPS 0.001f
+/** Maximum number of span events of a page (every row of a polygon crosses at most all of its edges) */
+#define BWS_MAX_PAGE_EVENTS (8 * BWD_POLYGON_MAX_POINTS)
+
+#define TAG "BW_DISP_SHAPE"
+
+/** @brief Shape plotter. Pixels plotted one after another in the same page byte are collected and written
+ *  at once; the written columns are marked dirty on the surface. */
+typedef struct
+{
+    bw_disp_surface_t *s;               ///< Drawing surface
+    bw_disp_clr_t c;                    ///< Colour
+    int page;                           ///< Page of the collected byte (-1 if none)
+    int x;                              ///< Column of the collected byte
+    uint8_t mask;                       ///< Collected pixels
+} bws_plot_t;
+
+/** @brief Span start or end in a page row: bits of the row toggle at column x */
+typedef struct
+{
+    int16_t x;      ///< Column
+    uint8_t bits;   ///< Row bits
+} bws_event_t;
+
+/** @brief Circle sector (angles measured clockwise from 3 o'clock) */
+typedef struct
+{
+    float sx;       ///< Start direction - x
+    float sy;       ///< Start direction - y
+    float ex;       ///< End direction - x
+    float ey;       ///< End direction - y
+    bool wide;      ///< Sector is wider than 180 degrees
+} bws_sector_t;
+
+
+static void bw_shape_begin(bws_plot_t *p, bw_disp_surface_t *s, bw_disp_clr_t c)
+{
+    p->s = s;
+    p->c = c;
+    p->page = -1;
+    p->x = 0;
+    p->mask = 0;
+}
+
+// Applies the mask to columns x0..x1 of the buffer page
+static void bw_shape_apply(bws_plot_t *p, int page, int x0, int x1, uint8_t mask)
+{
+    uint8_t *b = &(p->s->buffer[page * p->s->width + x0]);
+    uint8_t *b_e = b + (x1 - x0 + 1);
+    if (p->c == BWDC_BLACK)
+    {
+        for (mask = ~mask; b < b_e; b++)
+        {
+            *b &= mask;
+        }
+    }
+    else
+    {
+        for (; b < b_e; b++)
+        {
+            *b |= mask;
+        }
+    }
+    bw_disp_surface_mark_dirty(p->s, page, x0, x1);
+}
+
+static void bw_shape_flush(bws_plot_t *p)
+{
+    if (p->page >= 0)
+    {
+        bw_shape_apply(p, p->page, p->x, p->x, p->mask);
+        p->page = -1;
+        p->mask = 0;
+    }
+}
+
+static inline void bw_shape_plot(bws_plot_t *p, int x, int y)
+{
+    if (x < 0 || y < 0 || x >= p->s->width || y >= p->s->height)
+    {
+        return;
+    }
+    y = bw_disp_surface_row(p->s, y);
+    int page = y >> 3;
+    if (page != p->page || x != p->x)
+    {
+        bw_shape_flush(p);
+        p->page = page;
+        p->x = x;
+    }
+    p->mask |= 1 << (y & 0x07);
+}
+
+static void bw_shape_end(bws_plot_t *p)
+{
+    bw_shape_flush(p);
+}
+
+// Adds span x0..x1 of a row (clipped to the surface) as a pair of events
+static int bw_shape_add_span(const bws_plot_t *p, bws_event_t ev[], int n, int x0, int x1, uint8_t bits)
+{
+    x0 = MAX(x0, 0);
+    x1 = MIN(x1, p->s->width - 1);
+    if (x0 > x1 || n + 2 > BWS_MAX_PAGE_EVENTS)
+    {
+        return n;
+    }
+    ev[n].x = x0;
+    ev[n].bits = bits;
+    ev[n + 1].x = x1 + 1;
+    ev[n + 1].bits = bits;
+    return n + 2;
+}
+
+// Applies the mask of rows of the display page to columns x0..x1. Rows of a scrolled display are not aligned 
+// with the buffer pages, so the mask is split between two of them.
+static void bw_shape_apply_rows(bws_plot_t *p, int page, int x0, int x1, uint8_t mask)
+{
+    uint16_t row = bw_disp_surface_row(p->s, page * 8);
+    int shift = row & 0x07;
+    int buf_page = row >> 3;
+    uint8_t m = mask << shift;
+    if (m != 0)
+    {
+        bw_shape_apply(p, buf_page, x0, x1, m);
+    }
+    m = (shift != 0) ? (mask >> (8 - shift)) : 0;
+    if (m != 0)
+    {
+        bw_shape_apply(p, (buf_page + 1) % p->s->page_num, x0, x1, m);
+    }
+}
+
+// Fills spans of the page rows described by events: between two event columns the mask of covered rows is constant
+static void bw_shape_fill_events(bws_plot_t *p, int page, bws_event_t ev[], int n)
+{
+    for (int i = 1; i < n; i++)
+    {
+        bws_event_t e = ev[i];
+        int j = i;
+        for (; j > 0 && ev[j - 1].x > e.x; j--)
+        {
+            ev[j] = ev[j - 1];
+        }
+        ev[j] = e;
+    }
+    uint8_t mask = 0;
+    for (int i = 0; i < n;)
+    {
+        int x = ev[i].x;
+        for (; i < n && ev[i].x == x; i++)
+        {
+            mask ^= ev[i].bits;
+        }
+        if (mask != 0 && i < n)
+        {
+            bw_shape_apply_rows(p, page, x, ev[i].x - 1, mask);
+        }
+    }
+}
+
+static void bw_shape_line(bws_plot_t *p, int x0, int y0, int x1, int y1)
+{
+    int dx = abs(x1 - x0);
+    int dy = -abs(y1 - y0);
+    int sx = x0 < x1 ? 1 : -1;
+    int sy = y0 < y1 ? 1 : -1;
+    int err = dx + dy;
+    while (true)
+    {
+        bw_shape_plot(p, x0, y0);
+        if (x0 == x1 && y0 == y1)
+        {
+            break;
+        }
+        int e2 = 2 * err;
+        if (e2 >= dy)
+        {
+            err += dy;
+            x0 += sx;
+        }
+        if (e2 <= dx)
+        {
+            err += dx;
+            y0 += sy;
+        }
+    }
+}
+
+static bool bw_shape_in_sector(const bws_sector_t *sector, int dx, int dy)
+{
+    float cs = sector->sx * dy - sector->sy * dx;   // > 0: point is clockwise from start
+    float ce = dx * sector->ey - dy * sector->ex;   // > 0: end is clockwise from point
+    if (!sector->wide)
+    {
+        return cs >= -BWS_SECTOR_EPS && ce >= -BWS_SECTOR_EPS;
+    }
+    return cs >= -BWS_SECTOR_EPS || ce >= -BWS_SECTOR_EPS;
+}
+
+// Draws circle (or its sector) octant by octant, so that consecutive pixels are neighbours
+static void bw_shape_circle(bws_plot_t *p, int cx, int cy, int r, const bws_sector_t *sector)
+{
+    static const int8_t oct[8][4] =
+    {
+        // x from dx, x from dy, y from dx, y from dy
+        { 1, 0, 0, -1 }, { 0, 1, -1, 0 }, { 0, 1, 1, 0 }, { 1, 0, 0, 1 },
+        { -1, 0, 0, 1 }, { 0, -1, 1, 0 }, { 0, -1, -1, 0 }, { -1, 0, 0, -1 }
+    };
+    for (int o = 0; o < 8; o++)
+    {
+        int x = 0;
+        int y = r;
+        int d = 1 - r;
+        while (x <= y)
+        {
+            int px = oct[o][0] * x + oct[o][1] * y;
+            int py = oct[o][2] * x + oct[o][3] * y;
+            if (sector == NULL || bw_shape_in_sector(sector, px, py))
+            {
+                bw_shape_plot(p, cx + px, cy + py);
+            }
+            if (d < 0)
+            {
+                d += 2 * x + 3;
+            }
+            else
+            {
+                d += 2 * (x - y) + 5;
+                y--;
+            }
+            x++;
+        }
+        bw_shape_flush(p);
+    }
+}
+
+static uint32_t bw_shape_isqrt(uint32_t v)
+{
+    uint32_t r = 0;
+    uint32_t bit = 1UL << 30;
+    while (bit > v)
+    {
+        bit >>= 2;
+    }
+    while (bit != 0)
+    {
+        if (v >= r + bit)
+        {
+            v -= r + bit;
+            r = (r >> 1) + bit;
+        }
+        else
+        {
+            r >>= 1;
+        }
+        bit >>= 2;
+    }
+    return r;
+}
+
+esp_err_t bw_disp_line(bw_disp_handle_t handle, uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, bw_disp_clr_t c)
+{
+    if (bw_disp_lock(handle) != ESP_OK)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    BWD_STATS_PRIM_CALL(handle, BWDP_LINE);
+    DISP_TRACE_SCOPE(handle, BWT_LINE, 0);
+    bw_disp_surface_t *s = bw_disp_get_surface(handle);
+    bws_plot_t p;
+    bw_shape_begin(&p, s, c);
+    bw_shape_line(&p, x0, y0, x1, y1);
+    bw_shape_end(&p);
+    bw_disp_unlock(handle);
+    return ESP_OK;
+}
+
+esp_err_t bw_disp_circle(bw_disp_handle_t handle, uint16_t cx, uint16_t cy, uint16_t r, bw_disp_clr_t c)
+{
+    if (bw_disp_lock(handle) != ESP_OK)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    BWD_STATS_PRIM_CALL(handle, BWDP_CIRCLE);
+    DISP_TRACE_SCOPE(handle, BWT_CIRCLE, 0);
+    bw_disp_surface_t *s = bw_disp_get_surface(handle);
+    bws_plot_t p;
+    bw_shape_begin(&p, s, c);
+    bw_shape_circle(&p, cx, cy, r, NULL);
+    bw_shape_end(&p);
+    bw_disp_unlock(handle);
+    return ESP_OK;
+}
+
+esp_err_t bw_disp_arc(bw_disp_handle_t handle, uint16_t cx, uint16_t cy, uint16_t r, int16_t start_angle, int16_t sweep, bw_disp_clr_t c)
+{
+    if (bw_disp_lock(handle) != ESP_OK)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    BWD_STATS_PRIM_CALL(handle, BWDP_CIRCLE);
+    DISP_TRACE_SCOPE(handle, BWT_CIRCLE, 0);
+    bw_disp_surface_t *s = bw_disp_get_surface(handle);
+    int start = start_angle;
+    int span = sweep;
+    if (span < 0)
+    {
+        start += span;
+        span = -span;
+    }
+    bws_plot_t p;
+    bw_shape_begin(&p, s, c);
+    if (span >= 360)
+    {
+        bw_shape_circle(&p, cx, cy, r, NULL);
+    }
+    else
+    {
+        bws_sector_t sector;
+        float a = start * (float) M_PI / 180.0f;
+        float b = (start + span) * (float) M_PI / 180.0f;
+        sector.sx = cosf(a);
+        sector.sy = sinf(a);
+        sector.ex = cosf(b);
+        sector.ey = sinf(b);
+        sector.wide = span > 180;
+        bw_shape_circle(&p, cx, cy, r, &sector);
+    }
+    bw_shape_end(&p);
+    bw_disp_unlock(handle);
+    return ESP_OK;
+}
+
+esp_err_t bw_disp_fill_circle(bw_disp_handle_t handle, uint16_t cx, uint16_t cy, uint16_t r, bw_disp_clr_t c)
+{
+    if (bw_disp_lock(handle) != ESP_OK)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    BWD_STATS_PRIM_CALL(handle, BWDP_CIRCLE);
+    DISP_TRACE_SCOPE(handle, BWT_CIRCLE, 0);
+    bw_disp_surface_t *s = bw_disp_get_surface(handle);
+    bws_plot_t p;
+    bw_shape_begin(&p, s, c);
+    int y0 = MAX((int) cy - r, 0);
+    int y1 = MIN((int) cy + r, s->height - 1);
+    bws_event_t ev[16];
+    for (int page = y0 >> 3; y0 <= y1 && page <= (y1 >> 3); page++)
+    {
+        int n = 0;
+        for (int y = MAX(y0, page * 8); y <= MIN(y1, page * 8 + 7); y++)
+        {
+            int dy = y - cy;
+            // rows are as wide as the pixels within radius r + 0.5
+            int64_t v = (int64_t) r * r + r - (int64_t) dy * dy;
+            int hw = bw_shape_isqrt((uint32_t) MIN(v, 0xFFFFFFFF));
+            n = bw_shape_add_span(&p, ev, n, cx - hw, cx + hw, 1 << (y & 0x07));
+        }
+        bw_shape_fill_events(&p, page, ev, n);
+    }
+    bw_shape_end(&p);
+    bw_disp_unlock(handle);
+    return ESP_OK;
+}
+
+esp_err_t bw_disp_polygon(bw_disp_handle_t handle, const bw_disp_point_t points[], int n, bw_disp_clr_t c)
+{
+    if (points == NULL || n < 2 || n > BWD_POLYGON_MAX_POINTS)
+    {
+        ESP_LOGE(TAG, "Invalid polygon points: %d", n);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (bw_disp_lock(handle) != ESP_OK)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    BWD_STATS_PRIM_CALL(handle, BWDP_POLYGON);
+    DISP_TRACE_SCOPE(handle, BWT_POLYGON, 0);
+    bw_disp_surface_t *s = bw_disp_get_surface(handle);
+    bws_plot_t p;
+    bw_shape_begin(&p, s, c);
+    for (int i = 0; i < n; i++)
+    {
+        const bw_disp_point_t *a = &(points[i]);
+        const bw_disp_point_t *b = &(points[(i + 1) % n]);
+        bw_shape_line(&p, a->x, a->y, b->x, b->y);
+    }
+    bw_shape_end(&p);
+    bw_disp_unlock(handle);
+    return ESP_OK;
+}
+
+esp_err_t bw_disp_fill_polygon(bw_disp_handle_t handle, const bw_disp_point_t points[], int n, bw_disp_clr_t c)
+{
+    if (points == NULL || n < 3 || n > BWD_POLYGON_MAX_POINTS)
+    {
+        ESP_LOGE(TAG, "Invalid polygon points: %d", n);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (bw_disp_lock(handle) != ESP_OK)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    BWD_STATS_PRIM_CALL(handle, BWDP_POLYGON);
+    DISP_TRACE_SCOPE(handle, BWT_POLYGON, 0);
+    bw_disp_surface_t *s = bw_disp_get_surface(handle);
+    int y0 = points[0].y;
+    int y1 = points[0].y;
+    for (int i = 1; i < n; i++)
+    {
+        y0 = MIN(y0, points[i].y);
+        y1 = MAX(y1, points[i].y);
+    }
+    // rows with pixel centres between the top and the bottom vertex
+    y1 = MIN(y1 - 1, s->height - 1);
+    bws_plot_t p;
+    bw_shape_begin(&p, s, c);
+    bws_event_t ev[BWS_MAX_PAGE_EVENTS];
+    float xs[BWD_POLYGON_MAX_POINTS];
+    for (int page = y0 >> 3; y0 <= y1 && page <= (y1 >> 3); page++)
+    {
+        int ev_num = 0;
+        for (int y = MAX(y0, page * 8); y <= MIN(y1, page * 8 + 7); y++)
+        {
+            int k = 0;
+            for (int i = 0; i < n; i++)
+            {
+                const bw_disp_point_t *a = &(points[i]);
+                const bw_disp_point_t *b = &(points[(i + 1) % n]);
+                if (a->y == b->y || y < MIN(a->y, b->y) || y >= MAX(a->y, b->y))
+                {
+                    continue;
+                }
+                float x = a->x + (y + 0.5f - a->y) * ((int) b->x - a->x) / (float) ((int) b->y - a->y);
+                int j = k++;
+                for (; j > 0 && xs[j - 1] > x; j--)
+                {
+                    xs[j] = xs[j - 1];
+                }
+                xs[j] = x;
+            }
+            for (int i = 0; i + 1 < k; i += 2)
+            {
+                // pixels with centres between the crossings
+                int x0 = (int) ceilf(xs[i] - 0.5f);
+                int x1 = (int) ceilf(xs[i + 1] - 0.5f) - 1;
+                ev_num = bw_shape_add_span(&p, ev, ev_num, x0, x1, 1 << (y & 0x07));
+            }
+        }
+        bw_shape_fill_events(&p, page, ev, ev_num);
+    }
+    bw_shape_end(&p);
+    bw_disp_unlock(handle);
+    return ESP_OK;
+}
@@ -0,0 +1,513 @@
+// bw_disp_sprite.c
+
+#include <string.h>
+#include "esp_err.h"
+#include "esp_log.h"
+
+#include "bw_disp_sprite.h"
+#include "disp_handle_table.h"
+
+/** @file */
+
+/** Maximum number of sprite instances */
+#define MAX_SPRITE_INST_NUM 64
+
+#define TAG "BW_SPRITE"
+
+/** @brief Rectangle on a display (empty if w or h is 0) */
+typedef struct
+{
+    uint16_t x;
+    uint16_t y;
+    uint16_t w;
+    uint16_t h;
+} bws_rect_t;
+
+/** @brief Sprite type */
+typedef struct
+{
+    bw_sprite_handle_t handle;          ///< Sprite handle
+    bw_disp_handle_t disp;              ///< Display handle
+    bw_image_t *img;                    ///< Sprite image
+    bw_prepared_image_t *prepared;      ///< Pre-shifted variants of the image (NULL if not prepared)
+    uint8_t prepared_shifts;            ///< Prepared variants (bit i - image shifted by i rows)
+    bw_disp_img_draw_mode_t mode;       ///< Image draw mode
+    int16_t z;                          ///< Z-order (higher is on top)
+    uint32_t create_seq;                ///< Sequence number of creation (equal z - later created is on top)
+    uint16_t x;                         ///< Requested position - x
+    uint16_t y;                         ///< Requested position - y
+    bool visible;                       ///< Sprite should be shown
+    bool changed;                       ///< Sprite changed since the last update
+    bool drawn;                         ///< Sprite is drawn in the display buffer (background saved under it)
+    bws_rect_t drawn_rect;              ///< Footprint of the drawn sprite
+    uint16_t drawn_scroll;              ///< Scroll of the display when the sprite was drawn
+    uint32_t drawn_seq;                 ///< Sequence number of drawing (sprites are taken off in reverse drawing order)
+    size_t save_size;                   ///< Size of the save-under buffer
+    uint8_t* save;                      ///< Background saved under the drawn sprite (page by page, drawn_rect.w bytes each)
+} bw_sprite_t;
+
+DISP_HANDLE_TABLE_DEFINE(s_bw_sprite_instances, MAX_SPRITE_INST_NUM);  ///< Sprite instances
+static uint32_t s_bw_sprite_draw_seq = 0;           ///< Sequence number of the last sprite drawing
+static uint32_t s_bw_sprite_create_seq = 0;         ///< Sequence number of the last sprite creation
+
+
+static bw_sprite_t* bw_sprite_get_instance(bw_sprite_handle_t handle)
+{
+    bw_sprite_t *inst = (bw_sprite_t *) disp_handle_get(&s_bw_sprite_instances, handle);
+    if (inst == NULL)
+    {
+        ESP_LOGE(TAG, "Invalid handle: #%d", handle);
+    }
+    return inst;
+}
+
+// Gets the sprite and locks its display - sprites are protected by the lock of their display (NULL if the handle is invalid)
+static bw_sprite_t* bw_sprite_lock_instance(bw_sprite_handle_t handle)
+{
+    bw_sprite_t *inst = bw_sprite_get_instance(handle);
+    if (inst == NULL)
+    {
+        return NULL;
+    }
+    bw_disp_handle_t disp = inst->disp;
+    if (bw_disp_lock(disp) != ESP_OK)
+    {
+        return NULL;
+    }
+    // the sprite could have been deleted while waiting for the lock
+    if (disp_handle_get(&s_bw_sprite_instances, handle) != inst)
+    {
+        ESP_LOGE(TAG, "Invalid handle: #%d", handle);
+        bw_disp_unlock(disp);
+        return NULL;
+    }
+    return inst;
+}
+
+// Unlocks display of the sprite locked by BWS_LOCKED_INSTANCE when it goes out of scope
+static inline void bw_sprite_unlock_cleanup(bw_sprite_t **instPtr)
+{
+    if (*instPtr != NULL)
+    {
+        bw_disp_unlock((*instPtr)->disp);
+    }
+}
+
+/** Declares inst - sprite of the handle, with its display locked until the end of the scope (NULL if the handle is invalid) */
+#define BWS_LOCKED_INSTANCE(inst, handle) \
+    bw_sprite_t *inst __attribute__((cleanup(bw_sprite_unlock_cleanup))) = bw_sprite_lock_instance(handle)
+
+bw_sprite_handle_t bw_sprite_create(bw_disp_handle_t disp, bw_image_t *img, bw_disp_img_draw_mode_t mode, int16_t z)
+{
+    if (bw_disp_get_surface(disp) == NULL)
+    {
+        return INVALID_HANDLE;
+    }
+    if (img == NULL)
+    {
+        ESP_LOGE(TAG, "Invalid image!");
+        return INVALID_HANDLE;
+    }
+    bw_sprite_t *inst = (bw_sprite_t *) calloc(1, sizeof(bw_sprite_t));
+    if (inst == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to allocate instance memory");
+        return INVALID_HANDLE;
+    }
+    inst->disp = disp;
+    inst->img = img;
+    inst->mode = mode;
+    inst->z = z;
+    inst->create_seq = __atomic_add_fetch(&s_bw_sprite_create_seq, 1, __ATOMIC_RELAXED);
+    // the sprite is visible to bw_sprite_update as soon as it gets its handle
+    bw_disp_lock(disp);
+    inst->handle = disp_handle_alloc(&s_bw_sprite_instances, inst);
+    bw_disp_unlock(disp);
+    if (inst->handle == INVALID_HANDLE)
+    {
+        ESP_LOGE(TAG, "Too many instances!");
+        free(inst);
+        return INVALID_HANDLE;
+    }
+    return inst->handle;
+}
+
+static void bw_sprite_footprint(const bw_sprite_t *inst, const bw_disp_surface_t *s, bws_rect_t *r)
+{
+    memset(r, 0, sizeof(*r));
+    if (!inst->visible || inst->x >= s->width || inst->y >= s->height)
+    {
+        return;
+    }
+    r->x = inst->x;
+    r->y = inst->y;
+    r->w = MIN(inst->img->width, s->width - inst->x);
+    r->h = MIN(inst->img->height, s->height - inst->y);
+}
+
+static bool bw_sprite_rects_overlap(const bws_rect_t *a, const bws_rect_t *b)
+{
+    if (a->w == 0 || a->h == 0 || b->w == 0 || b->h == 0)
+    {
+        return false;
+    }
+    return (a->x < b->x + b->w) && (b->x < a->x + a->w) && (a->y < b->y + b->h) && (b->y < a->y + a->h);
+}
+
+// Mask of rows of the page covered by the rectangle
+static uint8_t bw_sprite_page_mask(const bws_rect_t *r, int page)
+{
+    uint8_t m = 0xFF;
+    uint16_t ly = r->y + r->h - 1;
+    if (page == (r->y >> 3))
+    {
+        m &= 0xFF << (r->y & 0x07);
+    }
+    if (page == (ly >> 3))
+    {
+        m &= 0xFF >> (7 - (ly & 0x07));
+    }
+    return m;
+}
+
+// Gets the rectangle in buffer rows of a display scrolled by scroll rows: one part, or two if it wraps around
+// the end of the buffer. Returns the number of parts.
+static int bw_sprite_buffer_rects(const bws_rect_t *r, const bw_disp_surface_t *s, uint16_t scroll, bws_rect_t parts[2])
+{
+    uint16_t row = (r->y + scroll) % s->height;
+    parts[0] = *r;
+    parts[0].y = row;
+    parts[0].h = MIN(r->h, s->height - row);
+    if (parts[0].h == r->h)
+    {
+        return 1;
+    }
+    parts[1] = *r;
+    parts[1].y = 0;
+    parts[1].h = r->h - parts[0].h;
+    return 2;
+}
+
+// Gets the number of pages of the rectangle parts
+static int bw_sprite_page_count(const bws_rect_t parts[], int n)
+{
+    int cnt = 0;
+    for (int i = 0; i < n; i++)
+    {
+        cnt += ((parts[i].y + parts[i].h - 1) >> 3) - (parts[i].y >> 3) + 1;
+    }
+    return cnt;
+}
+
+// Puts the saved background back in place of the drawn sprite (in the buffer rows it was drawn to)
+static void bw_sprite_restore(bw_sprite_t *inst, bw_disp_surface_t *s, bool mark_dirty)
+{
+    bws_rect_t parts[2];
+    int n = bw_sprite_buffer_rects(&(inst->drawn_rect), s, inst->drawn_scroll, parts);
+    const uint8_t *src = inst->save;
+    for (int k = 0; k < n; k++)
+    {
+        const bws_rect_t *r = &(parts[k]);
+        int first_page = r->y >> 3;
+        int last_page = (r->y + r->h - 1) >> 3;
+        for (int page = first_page; page <= last_page; page++, src += r->w)
+        {
+            uint8_t m = bw_sprite_page_mask(r, page);
+            uint8_t *dst = &(s->buffer[page * s->width + r->x]);
+            for (int i = 0; i < r->w; i++)
+            {
+                dst[i] = (dst[i] & ~m) | (src[i] & m);
+            }
+            if (mark_dirty)
+            {
+                bw_disp_surface_mark_dirty(s, page, r->x, r->x + r->w - 1);
+            }
+        }
+    }
+    inst->drawn = false;
+}
+
+// Saves the background under the sprite footprint and draws the sprite
+static esp_err_t bw_sprite_draw(bw_sprite_t *inst, bw_disp_surface_t *s, const bws_rect_t *r, bool mark_dirty)
+{
+    bws_rect_t parts[2];
+    int n = bw_sprite_buffer_rects(r, s, s->scroll, parts);
+    size_t size = (size_t) r->w * bw_sprite_page_count(parts, n);
+    if (size > inst->save_size)
+    {
+        uint8_t *save = (uint8_t *) realloc(inst->save, size);
+        if (save == NULL)
+        {
+            ESP_LOGE(TAG, "Failed to allocate save-under buffer. Handle: #%d", inst->handle);
+            return ESP_ERR_NO_MEM;
+        }
+        inst->save = save;
+        inst->save_size = size;
+    }
+    uint8_t *dst = inst->save;
+    for (int k = 0; k < n; k++)
+    {
+        int first_page = parts[k].y >> 3;
+        int last_page = (parts[k].y + parts[k].h - 1) >> 3;
+        for (int page = first_page; page <= last_page; page++, dst += r->w)
+        {
+            memcpy(dst, &(s->buffer[page * s->width + r->x]), r->w);
+        }
+    }
+    // redrawing a sprite that did not change yields the same bytes, so its dirty spans are left as they were
+    bw_disp_span_t dirty[s->page_num];
+    if (!mark_dirty)
+    {
+        memcpy(dirty, s->dirty, s->page_num * sizeof(bw_disp_span_t));
+    }
+    esp_err_t ret;
+    if (inst->prepared != NULL)
+    {
+        ret = bw_disp_prepared_image(inst->disp, r->x, r->y, false, inst->mode, inst->prepared);
+    }
+    else
+    {
+        ret = bw_disp_image_sel_ex(inst->disp, r->x, r->y, 0, 0, r->w, r->h, false, inst->mode, inst->img);
+    }
+    if (!mark_dirty)
+    {
+        memcpy(s->dirty, dirty, s->page_num * sizeof(bw_disp_span_t));
+    }
+    if (ret != ESP_OK)
+    {
+        return ret;
+    }
+    inst->drawn = true;
+    inst->drawn_rect = *r;
+    inst->drawn_scroll = s->scroll;
+    // sprites of different displays are drawn under different locks
+    inst->drawn_seq = __atomic_add_fetch(&s_bw_sprite_draw_seq, 1, __ATOMIC_RELAXED);
+    return ESP_OK;
+}
+
+// Checks whether sprite a is drawn above sprite b (slots of the handle table are reused, so their order means nothing)
+static inline bool bw_sprite_is_above(const bw_sprite_t *a, const bw_sprite_t *b)
+{
+    return (a->z != b->z) ? (a->z > b->z) : (a->create_seq > b->create_seq);
+}
+
+// Collects sprites of the display sorted by z-order (bottom first). Returns their number.
+
+static int bw_sprite_collect(bw_disp_handle_t disp, bw_sprite_t *sprites[])
+{
+    int n = 0;
+    for (int i = 0; i < MAX_SPRITE_INST_NUM; i++)
+    {
+        bw_sprite_t *inst = (bw_sprite_t *) disp_handle_get_at(&s_bw_sprite_instances, i);
+        if (inst == NULL || inst->disp != disp)
+        {
+            continue;
+        }
+        int j = n++;
+        for (; j > 0 && bw_sprite_is_above(sprites[j - 1], inst); j--)
+        {
+            sprites[j] = sprites[j - 1];
+        }
+        sprites[j] = inst;
+    }
+    return n;
+}
+
+esp_err_t bw_sprite_update(bw_disp_handle_t disp)
+{
+    if (bw_disp_lock(disp) != ESP_OK)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    bw_disp_surface_t *s = bw_disp_get_surface(disp);
+    bw_sprite_t *sprites[MAX_SPRITE_INST_NUM];
+    bws_rect_t new_rect[MAX_SPRITE_INST_NUM];
+    bool affected[MAX_SPRITE_INST_NUM];
+    int n = bw_sprite_collect(disp, sprites);
+    for (int i = 0; i < n; i++)
+    {
+        if (sprites[i]->drawn && sprites[i]->drawn_scroll != s->scroll)
+        {
+            // moved with the scrolled content
+            sprites[i]->changed = true;
+        }
+        bw_sprite_footprint(sprites[i], s, &(new_rect[i]));
+        affected[i] = sprites[i]->changed;
+    }
+    // sprites overlapping an affected one (at old or new position) have to be taken off and drawn again as well
+    bool grown = true;
+    while (grown)
+    {
+        grown = false;
+        for (int i = 0; i < n; i++)
+        {
+            if (affected[i] || !sprites[i]->drawn)
+            {
+                continue;
+            }
+            for (int j = 0; j < n; j++)
+            {
+                if (!affected[j])
+                {
+                    continue;
+                }
+                if (bw_sprite_rects_overlap(&(sprites[i]->drawn_rect), &(new_rect[j])) ||
+                    (sprites[j]->drawn && bw_sprite_rects_overlap(&(sprites[i]->drawn_rect), &(sprites[j]->drawn_rect))))
+                {
+                    affected[i] = true;
+                    grown = true;
+                    break;
+                }
+            }
+        }
+    }
+    // take off in reverse drawing order (z-order could have changed since they were drawn)
+    while (true)
+    {
+        int top = -1;
+        for (int i = 0; i < n; i++)
+        {
+            if (affected[i] && sprites[i]->drawn && (top < 0 || sprites[i]->drawn_seq > sprites[top]->drawn_seq))
+            {
+                top = i;
+            }
+        }
+        if (top < 0)
+        {
+            break;
+        }
+        bw_sprite_restore(sprites[top], s, sprites[top]->changed);
+    }
+    esp_err_t ret = ESP_OK;
+    for (int i = 0; i < n; i++)
+    {
+        if (affected[i] && new_rect[i].w > 0 && new_rect[i].h > 0)
+        {
+            esp_err_t ret2 = bw_sprite_draw(sprites[i], s, &(new_rect[i]), sprites[i]->changed);
+            if (ret2 != ESP_OK)
+            {
+                ret = ret2;
+            }
+        }
+        sprites[i]->changed = false;
+    }
+    bw_disp_unlock(disp);
+    return ret;
+}
+
+esp_err_t bw_sprite_delete(bw_sprite_handle_t handle)
+{
+    bw_sprite_t *inst = bw_sprite_lock_instance(handle);
+    if (inst == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t ret = ESP_OK;
+    if (inst->drawn)
+    {
+        inst->visible = false;
+        inst->changed = true;
+        ret = bw_sprite_update(inst->disp);
+    }
+    disp_handle_free(&s_bw_sprite_instances, handle);
+    bw_disp_unlock(inst->disp);
+    bw_image_prepared_free(inst->prepared);
+    free(inst->save);
+    free(inst);
+    return ret;
+}
+
+esp_err_t bw_sprite_move(bw_sprite_handle_t handle, uint16_t x, uint16_t y)
+{
+    BWS_LOCKED_INSTANCE(inst, handle);
+    if (inst == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (inst->x != x || inst->y != y)
+    {
+        inst->x = x;
+        inst->y = y;
+        inst->changed = true;
+    }
+    return ESP_OK;
+}
+
+esp_err_t bw_sprite_show(bw_sprite_handle_t handle, bool visible)
+{
+    BWS_LOCKED_INSTANCE(inst, handle);
+    if (inst == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (inst->visible != visible)
+    {
+        inst->visible = visible;
+        inst->changed = true;
+    }
+    return ESP_OK;
+}
+
+esp_err_t bw_sprite_set_z(bw_sprite_handle_t handle, int16_t z)
+{
+    BWS_LOCKED_INSTANCE(inst, handle);
+    if (inst == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (inst->z != z)
+    {
+        inst->z = z;
+        inst->changed = true;
+    }
+    return ESP_OK;
+}
+
+esp_err_t bw_sprite_set_image(bw_sprite_handle_t handle, bw_image_t *img)
+{
+    BWS_LOCKED_INSTANCE(inst, handle);
+    if (inst == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (img == NULL)
+    {
+        ESP_LOGE(TAG, "Invalid image!");
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (inst->prepared_shifts != 0)
+    {
+        bw_prepared_image_t *prepared = bw_image_prepare(img, inst->prepared_shifts);
+        if (prepared == NULL)
+        {
+            return ESP_ERR_NO_MEM;
+        }
+        bw_image_prepared_free(inst->prepared);
+        inst->prepared = prepared;
+    }
+    inst->img = img;
+    inst->changed = true;
+    return ESP_OK;
+}
+
+esp_err_t bw_sprite_prepare(bw_sprite_handle_t handle, uint8_t shifts)
+{
+    BWS_LOCKED_INSTANCE(inst, handle);
+    if (inst == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    bw_prepared_image_t *prepared = NULL;
+    if (shifts != 0)
+    {
+        prepared = bw_image_prepare(inst->img, shifts);
+        if (prepared == NULL)
+        {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    bw_image_prepared_free(inst->prepared);
+    inst->prepared = prepared;
+    inst->prepared_shifts = shifts;
+    return ESP_OK;
+}
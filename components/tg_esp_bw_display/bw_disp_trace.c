@@ -0,0 +1,245 @@
+// bw_disp_trace.c
+
+#include <string.h>
+#include <stdlib.h>
+#include "esp_err.h"
+#include "esp_log.h"
+
+#include "bw_disp_trace.h"
+#include "disp_trace.h"
+
+/** @file */
+
+#define TAG "BW_TRACE"
+
+/** Binary trace format version */
+#define BWT_BIN_VERSION 1
+/** Thread id offset of protocol handles in exported traces (display handles are used as they are) */
+#define BWT_PROTO_TID 0x10000
+
+static const char* s_bw_trace_op_names[BWT_OP_NUM] =
+{
+    "fill", "pixel", "line", "rect", "circle", "polygon", "image", "text",
+    "refresh", "refresh_page",
+    "write_command", "write_commands", "write_data_byte", "write_data", "write_segments"
+};
+
+const char* bw_trace_op_name(bw_trace_op_t op)
+{
+    return (op < BWT_OP_NUM) ? s_bw_trace_op_names[op] : "unknown";
+}
+
+#if BW_DISP_TRACE
+
+_Static_assert(sizeof(bw_trace_event_t) == 16, "trace event must be 4 words");
+
+/** @brief Slot of the ring buffer. The event is stored as words, so that it can be read while being written
+ *  (the sequence number tells whether the copy is consistent). */
+typedef struct
+{
+    uint32_t seq;       ///< Number of the event + 1 (0 while the event is written)
+    uint32_t w[4];      ///< Event
+} bwt_slot_t;
+
+static bwt_slot_t s_bw_trace_ring[BW_DISP_TRACE_SIZE];  ///< Ring buffer
+static uint32_t s_bw_trace_head = 0;                    ///< Number of events claimed so far
+static uint32_t s_bw_trace_tail = 0;                    ///< Number of the first event not discarded
+static bool s_bw_trace_enabled = false;                 ///< Recording is enabled
+
+
+int64_t disp_trace_now(void)
+{
+    if (!__atomic_load_n(&s_bw_trace_enabled, __ATOMIC_RELAXED))
+    {
+        return 0;
+    }
+    int64_t now = esp_timer_get_time();
+    return (now != 0) ? now : 1;
+}
+
+void disp_trace_record(bw_trace_op_t op, uint16_t handle, uint32_t len, int64_t start_us, esp_err_t ret)
+{
+    if (start_us == 0)
+    {
+        return;
+    }
+    union
+    {
+        bw_trace_event_t ev;
+        uint32_t w[4];
+    } e =
+    {
+        .ev =
+        {
+            .ts_us = (uint32_t) start_us,
+            .dur_us = (uint32_t) (esp_timer_get_time() - start_us),
+            .len = len,
+            .handle = handle,
+            .op = op,
+            .flags = (ret != ESP_OK) ? BWT_FLAG_ERROR : 0
+        }
+    };
+    uint32_t n = __atomic_fetch_add(&s_bw_trace_head, 1, __ATOMIC_RELAXED);
+    bwt_slot_t *slot = &(s_bw_trace_ring[n % BW_DISP_TRACE_SIZE]);
+    __atomic_store_n(&(slot->seq), 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    for (int i = 0; i < 4; i++)
+    {
+        __atomic_store_n(&(slot->w[i]), e.w[i], __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&(slot->seq), n + 1, __ATOMIC_RELEASE);
+}
+
+void bw_trace_enable(bool enable)
+{
+    __atomic_store_n(&s_bw_trace_enabled, enable, __ATOMIC_RELAXED);
+}
+
+void bw_trace_clear(void)
+{
+    __atomic_store_n(&s_bw_trace_tail, __atomic_load_n(&s_bw_trace_head, __ATOMIC_ACQUIRE), __ATOMIC_RELAXED);
+}
+
+int bw_trace_snapshot(bw_trace_event_t events[], int max)
+{
+    uint32_t head = __atomic_load_n(&s_bw_trace_head, __ATOMIC_ACQUIRE);
+    uint32_t first = __atomic_load_n(&s_bw_trace_tail, __ATOMIC_RELAXED);
+    if (head - first > BW_DISP_TRACE_SIZE)
+    {
+        first = head - BW_DISP_TRACE_SIZE;
+    }
+    int num = 0;
+    for (uint32_t n = first; (n != head) && (num < max); n++)
+    {
+        bwt_slot_t *slot = &(s_bw_trace_ring[n % BW_DISP_TRACE_SIZE]);
+        union
+        {
+            bw_trace_event_t ev;
+            uint32_t w[4];
+        } e;
+        if (__atomic_load_n(&(slot->seq), __ATOMIC_ACQUIRE) != n + 1)
+        {
+            continue;
+        }
+        for (int i = 0; i < 4; i++)
+        {
+            e.w[i] = __atomic_load_n(&(slot->w[i]), __ATOMIC_RELAXED);
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        // skipped if overwritten while copied
+        if (__atomic_load_n(&(slot->seq), __ATOMIC_RELAXED) == n + 1)
+        {
+            events[num++] = e.ev;
+        }
+    }
+    return num;
+}
+
+// Gets thread id of the event in exported traces
+static uint32_t bw_trace_tid(const bw_trace_event_t *ev)
+{
+    return (ev->op >= BWT_WRITE_COMMAND) ? (BWT_PROTO_TID + ev->handle) : ev->handle;
+}
+
+// Gets the earliest start of the events (events are recorded when they end, so a parent follows its nested events)
+static uint32_t bw_trace_base_ts(const bw_trace_event_t events[], int num)
+{
+    uint32_t base = (num > 0) ? events[0].ts_us : 0;
+    for (int i = 1; i < num; i++)
+    {
+        // signed 32-bit difference - the wrap-around does not matter
+        if ((int32_t) (events[i].ts_us - base) < 0)
+        {
+            base = events[i].ts_us;
+        }
+    }
+    return base;
+}
+
+esp_err_t bw_trace_export_json(FILE *f)
+{
+    bw_trace_event_t *events = (bw_trace_event_t *) malloc(BW_DISP_TRACE_SIZE * sizeof(bw_trace_event_t));
+    if (events == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to allocate memory for trace export");
+        return ESP_ERR_NO_MEM;
+    }
+    int num = bw_trace_snapshot(events, BW_DISP_TRACE_SIZE);
+    uint32_t base = bw_trace_base_ts(events, num);
+    fprintf(f, "{\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"tg_esp_bw_display\"}}");
+    for (int i = 0; i < num; i++)
+    {
+        const bw_trace_event_t *ev = &(events[i]);
+        uint32_t tid = bw_trace_tid(ev);
+        int j = 0;
+        while ((j < i) && (bw_trace_tid(&(events[j])) != tid))
+        {
+            j++;
+        }
+        if (j == i)
+        {
+            // first event of the thread
+            fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s #%u\"}}",
+                (unsigned) tid, (tid >= BWT_PROTO_TID) ? "protocol" : "display", (unsigned) ev->handle);
+        }
+        const char *cat = (ev->op >= BWT_WRITE_COMMAND) ? "proto" : (ev->op >= BWT_REFRESH) ? "refresh" : "draw";
+        // timestamps are relative to the earliest start (32-bit differences, so the wrap-around does not matter)
+        fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%u,\"dur\":%u,\"args\":{\"len\":%u%s}}",
+            bw_trace_op_name((bw_trace_op_t) ev->op), cat, (unsigned) tid, (unsigned) (ev->ts_us - base),
+            (unsigned) ev->dur_us, (unsigned) ev->len, (ev->flags & BWT_FLAG_ERROR) ? ",\"error\":true" : "");
+    }
+    fprintf(f, "\n]}\n");
+    free(events);
+    return ferror(f) ? ESP_FAIL : ESP_OK;
+}
+
+esp_err_t bw_trace_export_bin(FILE *f)
+{
+    bw_trace_event_t *events = (bw_trace_event_t *) malloc(BW_DISP_TRACE_SIZE * sizeof(bw_trace_event_t));
+    if (events == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to allocate memory for trace export");
+        return ESP_ERR_NO_MEM;
+    }
+    uint32_t num = bw_trace_snapshot(events, BW_DISP_TRACE_SIZE);
+    // both the ESP32 and the host are little endian, so the header and the events are written as they are
+    struct
+    {
+        char magic[4];
+        uint16_t version;
+        uint16_t event_size;
+        uint32_t event_num;
+    } header = { { 'B', 'W', 'T', 'R' }, BWT_BIN_VERSION, sizeof(bw_trace_event_t), num };
+    fwrite(&header, sizeof(header), 1, f);
+    fwrite(events, sizeof(bw_trace_event_t), num, f);
+    free(events);
+    return ferror(f) ? ESP_FAIL : ESP_OK;
+}
+
+#else
+
+void bw_trace_enable(bool enable)
+{
+}
+
+void bw_trace_clear(void)
+{
+}
+
+int bw_trace_snapshot(bw_trace_event_t events[], int max)
+{
+    return 0;
+}
+
+esp_err_t bw_trace_export_json(FILE *f)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t bw_trace_export_bin(FILE *f)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+#endif
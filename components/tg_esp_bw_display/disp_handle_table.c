@@ -0,0 +1,108 @@
+// disp_handle_table.c
+
+#include "disp_handle_table.h"
+
+/** @file */
+
+// Number of handle bits holding the slot number + 1
+static inline int disp_handle_index_bits(const disp_handle_table_t *table)
+{
+    return 32 - __builtin_clz(table->capacity);
+}
+
+// Slot of the handle (-1 if out of range)
+static inline int disp_handle_slot(const disp_handle_table_t *table, uint16_t handle)
+{
+    int slot = (handle & ((1 << disp_handle_index_bits(table)) - 1)) - 1;
+    return (slot < table->capacity) ? slot : -1;
+}
+
+uint16_t disp_handle_alloc(disp_handle_table_t *table, void *item)
+{
+    uint16_t handle = 0;
+    taskENTER_CRITICAL(&(table->lock));
+    int slot = -1;
+    if (table->free_head != 0)
+    {
+        slot = table->free_head - 1;
+        table->free_head = table->slots[slot].next_free;
+    }
+    else if (table->used_num < table->capacity)
+    {
+        slot = table->used_num++;
+    }
+    if (slot >= 0)
+    {
+        disp_handle_slot_t *s = &(table->slots[slot]);
+        int bits = disp_handle_index_bits(table);
+        handle = (uint16_t) ((s->generation << bits) | (slot + 1));
+        __atomic_store_n(&(s->item), item, __ATOMIC_RELAXED);
+        // handle is published last - a lookup that finds it sees the instance
+        __atomic_store_n(&(s->handle), handle, __ATOMIC_RELEASE);
+    }
+    taskEXIT_CRITICAL(&(table->lock));
+    return handle;
+}
+
+void* disp_handle_free(disp_handle_table_t *table, uint16_t handle)
+{
+    int slot = disp_handle_slot(table, handle);
+    if (slot < 0)
+    {
+        return NULL;
+    }
+    void *item = NULL;
+    taskENTER_CRITICAL(&(table->lock));
+    disp_handle_slot_t *s = &(table->slots[slot]);
+    if (handle != 0 && s->handle == handle)
+    {
+        item = s->item;
+        __atomic_store_n(&(s->handle), 0, __ATOMIC_RELEASE);
+        __atomic_store_n(&(s->item), NULL, __ATOMIC_RELAXED);
+        s->generation++;
+        s->next_free = table->free_head;
+        table->free_head = slot + 1;
+    }
+    taskEXIT_CRITICAL(&(table->lock));
+    return item;
+}
+
+void* disp_handle_get(disp_handle_table_t *table, uint16_t handle)
+{
+    int slot = disp_handle_slot(table, handle);
+    if (slot < 0 || handle == 0)
+    {
+        return NULL;
+    }
+    disp_handle_slot_t *s = &(table->slots[slot]);
+    if (__atomic_load_n(&(s->handle), __ATOMIC_ACQUIRE) != handle)
+    {
+        return NULL;
+    }
+    void *item = __atomic_load_n(&(s->item), __ATOMIC_ACQUIRE);
+    // the slot could have been freed and reused meanwhile
+    if (__atomic_load_n(&(s->handle), __ATOMIC_ACQUIRE) != handle)
+    {
+        return NULL;
+    }
+    return item;
+}
+
+int disp_handle_index(const disp_handle_table_t *table, uint16_t handle)
+{
+    return (handle != 0) ? disp_handle_slot(table, handle) : -1;
+}
+
+void* disp_handle_get_at(disp_handle_table_t *table, int slot)
+{
+    if (slot < 0 || slot >= table->capacity)
+    {
+        return NULL;
+    }
+    disp_handle_slot_t *s = &(table->slots[slot]);
+    if (__atomic_load_n(&(s->handle), __ATOMIC_ACQUIRE) == 0)
+    {
+        return NULL;
+    }
+    return __atomic_load_n(&(s->item), __ATOMIC_ACQUIRE);
+}
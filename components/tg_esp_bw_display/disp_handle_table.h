@@ -0,0 +1,71 @@
+// disp_handle_table.h - fixed-capacity instance tables with generation-tagged handles (internal)
+
+#pragma once
+
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @file
+ *  A handle holds slot number + 1 in its low bits and the generation of the slot in the remaining ones.
+ *  The generation changes every time the slot is freed, so a stale handle never reaches an instance created later
+ *  in the same slot. Free slots are kept on a list, so allocation is O(1). Lookups do not lock - slots are never
+ *  moved and the handle of a slot is published only after its instance is set.
+ */
+
+/** @brief Slot of a handle table */
+typedef struct
+{
+    void *item;                 ///< Instance (NULL if the slot is free)
+    uint16_t handle;            ///< Handle of the instance (0 if the slot is free)
+    uint16_t generation;        ///< Generation of the slot (incremented when the slot is freed)
+    uint16_t next_free;         ///< Next free slot + 1 (free slots only; 0 - end of the list)
+} disp_handle_slot_t;
+
+/** @brief Handle table */
+typedef struct
+{
+    uint16_t capacity;          ///< Number of slots
+    uint16_t used_num;          ///< Number of slots ever used (slots above are free but not on the list)
+    uint16_t free_head;         ///< First slot + 1 of the free list (0 - empty list)
+    portMUX_TYPE lock;          ///< Protects allocation and freeing
+    disp_handle_slot_t *slots;  ///< Slots
+} disp_handle_table_t;
+
+/** Defines (static) handle table with the given capacity */
+#define DISP_HANDLE_TABLE_DEFINE(name, cap) \
+    static disp_handle_slot_t name##_slots[(cap)]; \
+    static disp_handle_table_t name = { .capacity = (cap), .lock = portMUX_INITIALIZER_UNLOCKED, .slots = name##_slots }
+
+/** @brief Allocates a slot for the instance
+ *  @return Handle of the instance or 0 if the table is full
+ */
+uint16_t disp_handle_alloc(disp_handle_table_t *table, void *item);
+
+/** @brief Frees the slot of the handle
+ *  @return Instance of the handle or NULL if the handle is not valid
+ */
+void* disp_handle_free(disp_handle_table_t *table, uint16_t handle);
+
+/** @brief Gets instance of the handle
+ *  @return Instance or NULL if the handle is not valid
+ */
+void* disp_handle_get(disp_handle_table_t *table, uint16_t handle);
+
+/** @brief Gets slot of the handle (the handle does not have to be valid)
+ *  @return Slot or -1 if the handle is out of range
+ */
+int disp_handle_index(const disp_handle_table_t *table, uint16_t handle);
+
+/** @brief Gets instance in the slot (for iterating over instances)
+ *  @return Instance or NULL if the slot is free
+ */
+void* disp_handle_get_at(disp_handle_table_t *table, int slot);
+
+#ifdef __cplusplus
+}
+#endif
@@ -7,9 +7,13 @@
 #include "freertos/task.h"
 
 #include "disp_proto.h"
+#include "disp_handle_table.h"
+#include "disp_stats.h"
+#include "disp_trace.h"
 
 
-#define MAX_INST_NUM 1024
+/** Maximum number of protocol instances (a connection per display) */
+#define MAX_INST_NUM 128
 
 #define TAG "DISP_PROTO"
 
@@ -21,80 +25,111 @@ typedef struct
     esp_err_t (*write_commands)(disp_proto_handle_t handle, void* dp_data, uint8_t commands[], int len);
     esp_err_t (*write_data_byte)(disp_proto_handle_t handle, void* dp_data, uint8_t data);
     esp_err_t (*write_data)(disp_proto_handle_t handle, void* dp_data, uint8_t data[], int len);
+    esp_err_t (*write_segments)(disp_proto_handle_t handle, void* dp_data, disp_proto_seg_t segments[], int num);
     esp_err_t (*close)(disp_proto_handle_t handle, void* dp_data);
+#if BW_DISP_STATS
+    portMUX_TYPE stats_lock;        ///< Protects the counters (operations may run in other tasks than the reader)
+    disp_proto_stats_t stats;       ///< Performance counters
+#endif
 
     uint8_t data[];
 } disp_proto_t;
 
-static int s_disp_proto_inst_num = 0; // number of protocol instances;
-static int s_disp_proto_inst_free_num = 0; // number of free (dealocated) protocol instances;
+DISP_HANDLE_TABLE_DEFINE(s_disp_proto_instances, MAX_INST_NUM); // protocol instances
 
-static disp_proto_t **s_disp_proto_instances = NULL; 
+#if BW_DISP_STATS || BW_DISP_TRACE
+// Counts command and data bytes of the segments
+static void disp_proto_seg_bytes(const disp_proto_seg_t segments[], int num, int *command_bytes, int *data_bytes)
+{
+    for (int i = 0; i < num; i++)
+    {
+        if (segments[i].type == DPS_COMMANDS)
+        {
+            *command_bytes += segments[i].len;
+        }
+        else
+        {
+            *data_bytes += segments[i].len;
+        }
+    }
+}
+#endif
+
+#if BW_DISP_STATS
+// Counts a write of len bytes (commands or data), failed or not
+static void disp_proto_stats_write(disp_proto_t *inst, uint32_t *writes, uint32_t *bytes, int len, esp_err_t ret)
+{
+    taskENTER_CRITICAL(&(inst->stats_lock));
+    (*writes)++;
+    (*bytes) += len;
+    if (ret != ESP_OK)
+    {
+        inst->stats.errors++;
+    }
+    taskEXIT_CRITICAL(&(inst->stats_lock));
+}
+
+#define DISP_PROTO_STATS_WRITE(inst, field, len, ret) \
+    disp_proto_stats_write((inst), &((inst)->stats.field##_writes), &((inst)->stats.field##_bytes), (len), (ret))
+#else
+#define DISP_PROTO_STATS_WRITE(inst, field, len, ret)
+#endif
 
 disp_proto_handle_t disp_proto_init(disp_proto_type_t proto_type, 
         esp_err_t (*write_command)(disp_proto_handle_t handle, void* dp_data, uint8_t cmd),
         esp_err_t (*write_commands)(disp_proto_handle_t handle, void* dp_data, uint8_t commands[], int len),
         esp_err_t (*write_data_byte)(disp_proto_handle_t handle, void* dp_data, uint8_t data),
         esp_err_t (*write_data)(disp_proto_handle_t handle, void* dp_data, uint8_t data[], int len),
+        esp_err_t (*write_segments)(disp_proto_handle_t handle, void* dp_data, disp_proto_seg_t segments[], int num),
         esp_err_t (*close)(disp_proto_handle_t handle, void* dp_data), 
         void *dp_data, int len)
 {
-    int inst_no = -1;
-    if (s_disp_proto_inst_free_num == 0)
-    {
-        if (s_disp_proto_inst_num >= MAX_INST_NUM)
-        {
-            ESP_LOGE(TAG, "Too many instances!");
-            return INVALID_HANDLE;
-        }
-        inst_no = s_disp_proto_inst_num;
-        disp_proto_t **instances = (disp_proto_t **) realloc(s_disp_proto_instances, (s_disp_proto_inst_num + 1) * sizeof(disp_proto_t *));
-        if (instances == NULL)
-        {
-            ESP_LOGE(TAG, "Failed to allocate memory for instances");
-            return INVALID_HANDLE;
-        }
-        s_disp_proto_instances = instances;
-        s_disp_proto_instances[s_disp_proto_inst_num] = NULL;
-        s_disp_proto_inst_num++;
-    }
-    else
+    disp_proto_t *inst = (disp_proto_t *) calloc(1, sizeof(disp_proto_t) + len);
+    if (inst == NULL)
     {
-        for (int i = 0; i < s_disp_proto_inst_num; i++)
-        {
-            if (s_disp_proto_instances[i] == NULL)
-            {
-                inst_no = i;
-                break;
-            }
-        }
+        ESP_LOGE(TAG, "Failed to allocate instance memory");
+        return INVALID_HANDLE;
     }
-    assert((inst_no >= 0) && (inst_no < s_disp_proto_inst_num));
-    s_disp_proto_instances[inst_no] = (disp_proto_t *) calloc(1, sizeof(disp_proto_t) + len);
-    if (s_disp_proto_instances[inst_no] == NULL)
+    inst->type = proto_type;
+    inst->write_command = write_command;
+    inst->write_commands = write_commands;
+    inst->write_data_byte = write_data_byte;
+    inst->write_data = write_data;    
+    inst->write_segments = write_segments;
+    inst->close = close;
+    memcpy(inst->data, dp_data, len);
+#if BW_DISP_STATS
+    portMUX_INITIALIZE(&(inst->stats_lock));
+#endif
+    // the instance is complete before its handle is published
+    inst->handle = disp_handle_alloc(&s_disp_proto_instances, inst);
+    if (inst->handle == INVALID_HANDLE)
     {
-        ESP_LOGE(TAG, "Failed to allocate instance memory");
+        ESP_LOGE(TAG, "Too many instances!");
+        free(inst);
         return INVALID_HANDLE;
     }
-    s_disp_proto_instances[inst_no]->type = proto_type;
-    s_disp_proto_instances[inst_no]->handle = inst_no + 1;
-    s_disp_proto_instances[inst_no]->write_command = write_command;
-    s_disp_proto_instances[inst_no]->write_commands = write_commands;
-    s_disp_proto_instances[inst_no]->write_data_byte = write_data_byte;
-    s_disp_proto_instances[inst_no]->write_data = write_data;    
-    s_disp_proto_instances[inst_no]->close = close;
-    memcpy(s_disp_proto_instances[inst_no]->data, dp_data, len);
-    return s_disp_proto_instances[inst_no]->handle;
+    return inst->handle;
 }
 
 static disp_proto_t* s_disp_proto_get_instance(disp_proto_handle_t handle)
 {
-    if ((handle == 0) || (handle > s_disp_proto_inst_num) || (s_disp_proto_instances[handle - 1] == NULL))
+    disp_proto_t *inst = (disp_proto_t *) disp_handle_get(&s_disp_proto_instances, handle);
+    if (inst == NULL)
     {
         ESP_LOGE(TAG, "Invalid handle: #%d", handle);
+    }
+    return inst;
+}
+
+void* disp_proto_get_data(disp_proto_handle_t handle, disp_proto_type_t proto_type)
+{
+    disp_proto_t *inst = s_disp_proto_get_instance(handle);
+    if ((inst == NULL) || (inst->type != proto_type))
+    {
         return NULL;
     }
-    return s_disp_proto_instances[handle - 1];
+    return inst->data;
 }
 
 esp_err_t disp_proto_write_command(disp_proto_handle_t handle, uint8_t cmd)
@@ -104,7 +139,10 @@ esp_err_t disp_proto_write_command(disp_proto_handle_t handle, uint8_t cmd)
     {
         return ESP_ERR_INVALID_ARG;
     }
+    DISP_TRACE_START(start);
     esp_err_t ret = inst->write_command(handle, inst->data, cmd);
+    DISP_TRACE_RECORD(BWT_WRITE_COMMAND, handle, 1, start, ret);
+    DISP_PROTO_STATS_WRITE(inst, command, 1, ret);
     if (ret != ESP_OK)
     {
         ESP_LOGE(TAG, "Write command operation failed. Handle: #%d. Code: 0x%.2X", handle, ret);
@@ -119,7 +157,10 @@ esp_err_t disp_proto_write_commands(disp_proto_handle_t handle, uint8_t commands
     {
         return ESP_ERR_INVALID_ARG;
     }
+    DISP_TRACE_START(start);
     esp_err_t ret = inst->write_commands(handle, inst->data, commands, len);
+    DISP_TRACE_RECORD(BWT_WRITE_COMMANDS, handle, len, start, ret);
+    DISP_PROTO_STATS_WRITE(inst, command, len, ret);
     if (ret != ESP_OK)
     {
         ESP_LOGE(TAG, "Write commands operation failed. Handle: #%d. Code: 0x%.2X", handle, ret);
@@ -134,7 +175,10 @@ esp_err_t disp_proto_write_data_byte(disp_proto_handle_t handle, uint8_t data)
     {
         return ESP_ERR_INVALID_ARG;
     }
+    DISP_TRACE_START(start);
     esp_err_t ret = inst->write_data_byte(handle, inst->data, data);
+    DISP_TRACE_RECORD(BWT_WRITE_DATA_BYTE, handle, 1, start, ret);
+    DISP_PROTO_STATS_WRITE(inst, data, 1, ret);
     if (ret != ESP_OK)
     {
         ESP_LOGE(TAG, "Write data byte operation failed. Handle: #%d. Code: 0x%.2X", handle, ret);
@@ -149,7 +193,10 @@ esp_err_t disp_proto_write_data(disp_proto_handle_t handle, uint8_t data[], int
     {
         return ESP_ERR_INVALID_ARG;
     }
+    DISP_TRACE_START(start);
     esp_err_t ret = inst->write_data(handle, inst->data, data, len);
+    DISP_TRACE_RECORD(BWT_WRITE_DATA, handle, len, start, ret);
+    DISP_PROTO_STATS_WRITE(inst, data, len, ret);
     if (ret != ESP_OK)
     {
         ESP_LOGE(TAG, "Write data operation failed. Handle: #%d. Code: 0x%.2X", handle, ret);
@@ -157,6 +204,123 @@ esp_err_t disp_proto_write_data(disp_proto_handle_t handle, uint8_t data[], int
     return ret;
 }
 
+esp_err_t disp_proto_write_segments(disp_proto_handle_t handle, disp_proto_seg_t segments[], int num)
+{
+    disp_proto_t *inst = s_disp_proto_get_instance(handle);
+    if (inst == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    DISP_TRACE_START(start);
+    esp_err_t ret = ESP_OK;
+    if (inst->write_segments != NULL)
+    {
+        ret = inst->write_segments(handle, inst->data, segments, num);
+    }
+    else
+    {
+        for (int i = 0; (i < num) && (ret == ESP_OK); i++)
+        {
+            if (segments[i].type == DPS_COMMANDS)
+            {
+                ret = inst->write_commands(handle, inst->data, segments[i].buf, segments[i].len);
+            }
+            else
+            {
+                ret = inst->write_data(handle, inst->data, segments[i].buf, segments[i].len);
+            }
+        }
+    }
+#if BW_DISP_STATS || BW_DISP_TRACE
+    int command_bytes = 0;
+    int data_bytes = 0;
+    disp_proto_seg_bytes(segments, num, &command_bytes, &data_bytes);
+#endif
+#if BW_DISP_STATS
+    taskENTER_CRITICAL(&(inst->stats_lock));
+    inst->stats.segment_writes++;
+    inst->stats.command_bytes += command_bytes;
+    inst->stats.data_bytes += data_bytes;
+    if (ret != ESP_OK)
+    {
+        inst->stats.errors++;
+    }
+    taskEXIT_CRITICAL(&(inst->stats_lock));
+#endif
+    DISP_TRACE_RECORD(BWT_WRITE_SEGMENTS, handle, command_bytes + data_bytes, start, ret);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Write segments operation failed. Handle: #%d. Code: 0x%.2X", handle, ret);
+    }
+    return ret;
+}
+
+esp_err_t disp_proto_get_stats(disp_proto_handle_t handle, disp_proto_stats_t *stats)
+{
+#if BW_DISP_STATS
+    disp_proto_t *inst = s_disp_proto_get_instance(handle);
+    if ((inst == NULL) || (stats == NULL))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    taskENTER_CRITICAL(&(inst->stats_lock));
+    *stats = inst->stats;
+    taskEXIT_CRITICAL(&(inst->stats_lock));
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+esp_err_t disp_proto_reset_stats(disp_proto_handle_t handle)
+{
+#if BW_DISP_STATS
+    disp_proto_t *inst = s_disp_proto_get_instance(handle);
+    if (inst == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    taskENTER_CRITICAL(&(inst->stats_lock));
+    memset(&(inst->stats), 0, sizeof(inst->stats));
+    taskEXIT_CRITICAL(&(inst->stats_lock));
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+#if BW_DISP_STATS
+void disp_latency_stats_add(disp_latency_stats_t *stats, int64_t start_us)
+{
+    int64_t elapsed = esp_timer_get_time() - start_us;
+    uint32_t us = (elapsed < 0) ? 0 : (elapsed > UINT32_MAX) ? UINT32_MAX : (uint32_t) elapsed;
+    if ((stats->count == 0) || (us < stats->min_us))
+    {
+        stats->min_us = us;
+    }
+    if (us > stats->max_us)
+    {
+        stats->max_us = us;
+    }
+    stats->count++;
+    stats->total_us += us;
+    int bucket = (us == 0) ? 0 : (32 - __builtin_clz(us));
+    stats->hist[MIN(bucket, DISP_LATENCY_HIST_SIZE - 1)]++;
+}
+
+void disp_proto_stats_transaction(disp_proto_handle_t handle, int64_t start_us)
+{
+    disp_proto_t *inst = (disp_proto_t *) disp_handle_get(&s_disp_proto_instances, handle);
+    if (inst == NULL)
+    {
+        return;
+    }
+    taskENTER_CRITICAL(&(inst->stats_lock));
+    disp_latency_stats_add(&(inst->stats.transactions), start_us);
+    taskEXIT_CRITICAL(&(inst->stats_lock));
+}
+#endif
+
 esp_err_t disp_proto_close(disp_proto_handle_t handle)
 {
     disp_proto_t *inst = s_disp_proto_get_instance(handle);
@@ -169,9 +333,8 @@ esp_err_t disp_proto_close(disp_proto_handle_t handle)
     {
         ESP_LOGE(TAG, "Protocol close operation failed for handle #%d. Code: 0x%.2X. Continuing with memory deallocation.", handle, ret);
     }
+    disp_handle_free(&s_disp_proto_instances, handle);
     free(inst);
-    s_disp_proto_instances[handle - 1] = NULL;
-    s_disp_proto_inst_free_num++;
     if (ret == ESP_OK)
     {
         ESP_LOGI(TAG, "Protocol close operation finished for handle #%d.", handle);
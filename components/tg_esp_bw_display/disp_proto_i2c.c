@@ -1,12 +1,16 @@
 ﻿// disp_proto_i2c.c
 
+#include <stdlib.h>
+#include <string.h>
 #include "esp_err.h"
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "driver/i2c.h"
 
 #include "disp_proto.h"
+#include "disp_stats.h"
 
 #define TAG "DISP_PROTO_I2C"
 
@@ -14,23 +18,120 @@
 #define I2C_CMD_STREAM    0x00
 #define I2C_DATA_STREAM   0x40
 
+/** Size of the buffer for addresses and control bytes of a batched transaction */
+#define I2C_BATCH_BUF_SIZE 256
+/** Maximum number of operations (start, write, stop) of a transaction - a batched refresh of all 8 pages takes 33 */
+#define I2C_LINK_MAX_OPS 48
+/** Size of the preallocated command link buffer */
+#define I2C_LINK_BUF_SIZE I2C_LINK_RECOMMENDED_SIZE(I2C_LINK_MAX_OPS)
+/** Maximum number of protocol instances sharing one port */
+#define I2C_BUS_MAX_DEVICES 8
+
+/** @brief I2C port shared by protocol instances (displays with different addresses) */
+typedef struct
+{
+    int ref_count;              ///< Number of instances using the port (0 - driver not installed), written under the table lock
+    gpio_num_t sda;             ///< SDA pin the port is configured with
+    gpio_num_t scl;             ///< SCL pin the port is configured with
+    int clock_speed;            ///< Clock speed the port is configured with
+    SemaphoreHandle_t lock;     ///< Protects the ownership fields below
+    bool busy;                  ///< Bus is owned by an instance (a transaction is in progress)
+    int wait_num;               ///< Number of instances waiting for the bus
+    SemaphoreHandle_t waiting[I2C_BUS_MAX_DEVICES]; ///< Turn semaphores of the waiting instances, in arrival order
+} disp_proto_i2c_bus_t;
+
 typedef struct 
 {
     i2c_port_t port;
     uint8_t address;
+    int clock_speed;
+    uint8_t *link_buf;      ///< Command link buffer - transactions are built in it, without heap operations
+    disp_proto_i2c_bus_t *bus;
+    SemaphoreHandle_t turn; ///< Given when the bus is handed over to the instance
 } disp_proto_i2c_t;
 
+static disp_proto_i2c_bus_t s_disp_proto_i2c_buses[I2C_NUM_MAX];
+static SemaphoreHandle_t s_disp_proto_i2c_buses_lock = NULL;  ///< Protects the bus table (configuration, driver, reference counts)
+static portMUX_TYPE s_disp_proto_i2c_buses_mux = portMUX_INITIALIZER_UNLOCKED;
+
 esp_err_t disp_proto_i2c_write_command(disp_proto_handle_t handle, void* dp_data_ptr, uint8_t cmd);
 esp_err_t disp_proto_i2c_write_commands(disp_proto_handle_t handle, void* dp_data_ptr, uint8_t commands[], int len);
 esp_err_t disp_proto_i2c_write_data_byte(disp_proto_handle_t handle, void* dp_data_ptr, uint8_t data);
 esp_err_t disp_proto_i2c_write_data(disp_proto_handle_t handle, void* dp_data_ptr, uint8_t data[], int len);
+esp_err_t disp_proto_i2c_write_segments(disp_proto_handle_t handle, void* dp_data_ptr, disp_proto_seg_t segments[], int num);
 esp_err_t disp_proto_i2c_close(disp_proto_handle_t handle, void* dp_data_ptr);
 
 
-disp_proto_handle_t disp_proto_init_i2c(i2c_port_t port, int clock_speed, uint8_t address, gpio_num_t sda, gpio_num_t scl)
+// Creates command link in the buffer of the instance (the link is deleted with i2c_cmd_link_delete_static)
+static i2c_cmd_handle_t disp_proto_i2c_link_create(disp_proto_i2c_t *i2cDataPtr)
 {
-    disp_proto_handle_t handle = INVALID_HANDLE;
+    return i2c_cmd_link_create_static(i2cDataPtr->link_buf, I2C_LINK_BUF_SIZE);
+}
 
+// Locks the bus table, creating the lock on first use (false if it could not be created)
+static bool disp_proto_i2c_buses_lock(void)
+{
+    if (__atomic_load_n(&s_disp_proto_i2c_buses_lock, __ATOMIC_ACQUIRE) == NULL)
+    {
+        SemaphoreHandle_t lock = xSemaphoreCreateMutex();
+        if (lock == NULL)
+        {
+            ESP_LOGE(TAG, "Failed to create I2C bus table lock");
+            return false;
+        }
+        taskENTER_CRITICAL(&s_disp_proto_i2c_buses_mux);
+        if (s_disp_proto_i2c_buses_lock == NULL)
+        {
+            __atomic_store_n(&s_disp_proto_i2c_buses_lock, lock, __ATOMIC_RELEASE);
+            lock = NULL;
+        }
+        taskEXIT_CRITICAL(&s_disp_proto_i2c_buses_mux);
+        if (lock != NULL)
+        {
+            // created by another task meanwhile
+            vSemaphoreDelete(lock);
+        }
+    }
+    xSemaphoreTake(s_disp_proto_i2c_buses_lock, portMAX_DELAY);
+    return true;
+}
+
+static void disp_proto_i2c_buses_unlock(void)
+{
+    xSemaphoreGive(s_disp_proto_i2c_buses_lock);
+}
+
+// Gets number of instances using the port. The count is only written under the table lock, so it is read
+// atomically without taking the lock (it is checked on every refresh).
+static int disp_proto_i2c_bus_devices(disp_proto_i2c_bus_t *bus)
+{
+    return __atomic_load_n(&(bus->ref_count), __ATOMIC_RELAXED);
+}
+
+// Configures the port and installs the driver for the first instance, checks the configuration for others
+// (the bus table has to be locked)
+static disp_proto_i2c_bus_t* disp_proto_i2c_bus_attach(i2c_port_t port, int clock_speed, gpio_num_t sda, gpio_num_t scl)
+{
+    disp_proto_i2c_bus_t *bus = &s_disp_proto_i2c_buses[port];
+    if (bus->ref_count > 0)
+    {
+        if ((bus->sda != sda) || (bus->scl != scl))
+        {
+            ESP_LOGE(TAG, "I2C port #%d is already used with SDA: %d; SCL: %d", port, bus->sda, bus->scl);
+            return NULL;
+        }
+        if (bus->ref_count >= I2C_BUS_MAX_DEVICES)
+        {
+            ESP_LOGE(TAG, "Too many devices on I2C port #%d", port);
+            return NULL;
+        }
+        if (bus->clock_speed != clock_speed)
+        {
+            ESP_LOGW(TAG, "I2C port #%d is already used with clock speed: %d Hz", port, bus->clock_speed);
+        }
+        __atomic_add_fetch(&(bus->ref_count), 1, __ATOMIC_RELAXED);
+        return bus;
+    }
     i2c_config_t i2c_config = 
     {
 		.mode = I2C_MODE_MASTER,
@@ -46,25 +147,153 @@ disp_proto_handle_t disp_proto_init_i2c(i2c_port_t port, int clock_speed, uint8_
     if (ret != ESP_OK)
     {
         ESP_LOGE(TAG, "Failed to set I2C configuration. Code: 0x%.2X", ret);
-        return INVALID_HANDLE;
+        return NULL;
+    }
+    bus->lock = xSemaphoreCreateMutex();
+    if (bus->lock == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to create I2C bus lock");
+        return NULL;
     }
 	ret = i2c_driver_install(port, I2C_MODE_MASTER, 0, 0, 0);
     if (ret != ESP_OK)
     {
         ESP_LOGE(TAG, "Failed to install I2C driver. Code: 0x%.2X", ret);
+        vSemaphoreDelete(bus->lock);
+        bus->lock = NULL;
+        return NULL;
+    }
+    bus->sda = sda;
+    bus->scl = scl;
+    bus->clock_speed = clock_speed;
+    bus->busy = false;
+    bus->wait_num = 0;
+    __atomic_store_n(&(bus->ref_count), 1, __ATOMIC_RELAXED);
+    return bus;
+}
+
+// Attaches an instance to the port (see disp_proto_i2c_bus_attach)
+static disp_proto_i2c_bus_t* disp_proto_i2c_bus_open(i2c_port_t port, int clock_speed, gpio_num_t sda, gpio_num_t scl)
+{
+    if ((port < 0) || (port >= I2C_NUM_MAX))
+    {
+        ESP_LOGE(TAG, "Invalid I2C port: %d", port);
+        return NULL;
+    }
+    if (!disp_proto_i2c_buses_lock())
+    {
+        return NULL;
+    }
+    disp_proto_i2c_bus_t *bus = disp_proto_i2c_bus_attach(port, clock_speed, sda, scl);
+    disp_proto_i2c_buses_unlock();
+    return bus;
+}
+
+// Releases the port, deleting the driver when the last instance is closed
+static esp_err_t disp_proto_i2c_bus_close(i2c_port_t port, disp_proto_i2c_bus_t *bus)
+{
+    esp_err_t ret = ESP_OK;
+    disp_proto_i2c_buses_lock();
+    assert(bus->ref_count > 0);
+    if (__atomic_sub_fetch(&(bus->ref_count), 1, __ATOMIC_RELAXED) == 0)
+    {
+        vSemaphoreDelete(bus->lock);
+        bus->lock = NULL;
+        ret = i2c_driver_delete(port);
+    }
+    disp_proto_i2c_buses_unlock();
+    return ret;
+}
+
+// Takes the bus for a transaction. The bus is handed over to waiting instances in arrival order, so an instance
+// sending a long batch cannot starve the others - they take turns transaction by transaction.
+static void disp_proto_i2c_bus_acquire(disp_proto_i2c_t *i2cDataPtr)
+{
+    disp_proto_i2c_bus_t *bus = i2cDataPtr->bus;
+    xSemaphoreTake(bus->lock, portMAX_DELAY);
+    if (!bus->busy)
+    {
+        bus->busy = true;
+        xSemaphoreGive(bus->lock);
+        return;
+    }
+    bus->waiting[bus->wait_num++] = i2cDataPtr->turn;
+    xSemaphoreGive(bus->lock);
+    xSemaphoreTake(i2cDataPtr->turn, portMAX_DELAY);
+}
+
+// Releases the bus, handing it over to the instance waiting longest (if any)
+static void disp_proto_i2c_bus_release(disp_proto_i2c_bus_t *bus)
+{
+    xSemaphoreTake(bus->lock, portMAX_DELAY);
+    if (bus->wait_num == 0)
+    {
+        bus->busy = false;
+    }
+    else
+    {
+        SemaphoreHandle_t next = bus->waiting[0];
+        bus->wait_num--;
+        memmove(&bus->waiting[0], &bus->waiting[1], bus->wait_num * sizeof(bus->waiting[0]));
+        xSemaphoreGive(next);
+    }
+    xSemaphoreGive(bus->lock);
+}
+
+// Executes the transaction, holding the bus
+static esp_err_t disp_proto_i2c_cmd_begin(disp_proto_handle_t handle, disp_proto_i2c_t *i2cDataPtr, i2c_cmd_handle_t cmdh, int timeout_ms)
+{
+    disp_proto_i2c_bus_acquire(i2cDataPtr);
+    // time spent waiting for the turn on a shared bus is not counted
+    DISP_STATS_START(start);
+    esp_err_t ret = i2c_master_cmd_begin(i2cDataPtr->port, cmdh, timeout_ms / portTICK_PERIOD_MS);
+    DISP_STATS_TRANSACTION(handle, start);
+    disp_proto_i2c_bus_release(i2cDataPtr->bus);
+    return ret;
+}
+
+disp_proto_handle_t disp_proto_init_i2c(i2c_port_t port, int clock_speed, uint8_t address, gpio_num_t sda, gpio_num_t scl)
+{
+    disp_proto_handle_t handle = INVALID_HANDLE;
+    disp_proto_i2c_bus_t *bus = disp_proto_i2c_bus_open(port, clock_speed, sda, scl);
+    if (bus == NULL)
+    {
         return INVALID_HANDLE;
     }
     disp_proto_i2c_t i2cData = 
     {
         .port = port,
-        .address = address
+        .address = address,
+        .clock_speed = bus->clock_speed,
+        .link_buf = (uint8_t *) malloc(I2C_LINK_BUF_SIZE),
+        .bus = bus,
+        .turn = xSemaphoreCreateBinary()
     };
+    if ((i2cData.link_buf == NULL) || (i2cData.turn == NULL))
+    {
+        ESP_LOGE(TAG, "Failed to allocate command link buffer or bus semaphore");
+        free(i2cData.link_buf);
+        if (i2cData.turn != NULL)
+        {
+            vSemaphoreDelete(i2cData.turn);
+        }
+        disp_proto_i2c_bus_close(port, bus);
+        return INVALID_HANDLE;
+    }
     handle = disp_proto_init(DP_I2C, 
-        &disp_proto_i2c_write_command, &disp_proto_i2c_write_commands, &disp_proto_i2c_write_data_byte, &disp_proto_i2c_write_data, &disp_proto_i2c_close, 
+        &disp_proto_i2c_write_command, &disp_proto_i2c_write_commands, &disp_proto_i2c_write_data_byte, &disp_proto_i2c_write_data, 
+        &disp_proto_i2c_write_segments, &disp_proto_i2c_close, 
         &i2cData, sizeof(i2cData));
-    if (handle != INVALID_HANDLE)
+    if (handle == INVALID_HANDLE)
+    {
+        free(i2cData.link_buf);
+        vSemaphoreDelete(i2cData.turn);
+        disp_proto_i2c_bus_close(port, bus);
+    }
+    else
     {
-        ESP_LOGI(TAG, "Initialized I2C connection on port #%d. SDA: %d; SCL: %d; Address: 0x%02X; Handle: #%d", port, sda, scl, address, handle);
+        ESP_LOGI(TAG, "Initialized I2C connection on port #%d. SDA: %d; SCL: %d; Address: 0x%02X; Devices on the port: %d; Handle: #%d",
+            port, sda, scl, address, disp_proto_i2c_bus_devices(bus), handle);
     }
     return handle;
 }
@@ -74,14 +303,14 @@ esp_err_t disp_proto_i2c_write_command(disp_proto_handle_t handle, void* dp_data
     disp_proto_i2c_t *i2cDataPtr = (disp_proto_i2c_t *)dp_data_ptr;    
     assert(i2cDataPtr != NULL);
     esp_err_t ret = ESP_FAIL;
-    i2c_cmd_handle_t cmdh = i2c_cmd_link_create();
+    i2c_cmd_handle_t cmdh = disp_proto_i2c_link_create(i2cDataPtr);
     i2c_master_start(cmdh);
 	i2c_master_write_byte(cmdh, (i2cDataPtr->address << 1) | I2C_MASTER_WRITE, true);
 	i2c_master_write_byte(cmdh, I2C_CMD_SINGLE, true);
     i2c_master_write_byte(cmdh, cmd, true);
     i2c_master_stop(cmdh);
-    ret = i2c_master_cmd_begin(i2cDataPtr->port, cmdh, 10/portTICK_PERIOD_MS);
-    i2c_cmd_link_delete(cmdh);
+    ret = disp_proto_i2c_cmd_begin(handle, i2cDataPtr, cmdh, 10);
+    i2c_cmd_link_delete_static(cmdh);
     return ret;
 }
 
@@ -90,14 +319,14 @@ esp_err_t disp_proto_i2c_write_commands(disp_proto_handle_t handle, void* dp_dat
     disp_proto_i2c_t *i2cDataPtr = (disp_proto_i2c_t *)dp_data_ptr;    
     assert(i2cDataPtr != NULL);
     esp_err_t ret = ESP_FAIL;
-    i2c_cmd_handle_t cmdh = i2c_cmd_link_create();
+    i2c_cmd_handle_t cmdh = disp_proto_i2c_link_create(i2cDataPtr);
     i2c_master_start(cmdh);
 	i2c_master_write_byte(cmdh, (i2cDataPtr->address << 1) | I2C_MASTER_WRITE, true);
 	i2c_master_write_byte(cmdh, I2C_CMD_STREAM, true);
     i2c_master_write(cmdh, commands, len, true);
     i2c_master_stop(cmdh);
-    ret = i2c_master_cmd_begin(i2cDataPtr->port, cmdh, 10/portTICK_PERIOD_MS);
-    i2c_cmd_link_delete(cmdh);
+    ret = disp_proto_i2c_cmd_begin(handle, i2cDataPtr, cmdh, 10);
+    i2c_cmd_link_delete_static(cmdh);
     return ret;
 }
 
@@ -106,14 +335,14 @@ esp_err_t disp_proto_i2c_write_data_byte(disp_proto_handle_t handle, void* dp_da
     disp_proto_i2c_t *i2cDataPtr = (disp_proto_i2c_t *)dp_data_ptr;    
     assert(i2cDataPtr != NULL);
     esp_err_t ret = ESP_FAIL;
-    i2c_cmd_handle_t cmdh = i2c_cmd_link_create();
+    i2c_cmd_handle_t cmdh = disp_proto_i2c_link_create(i2cDataPtr);
     i2c_master_start(cmdh);
 	i2c_master_write_byte(cmdh, (i2cDataPtr->address << 1) | I2C_MASTER_WRITE, true);
 	i2c_master_write_byte(cmdh, I2C_DATA_STREAM, true);
     i2c_master_write_byte(cmdh, data, true);
     i2c_master_stop(cmdh);
-    ret = i2c_master_cmd_begin(i2cDataPtr->port, cmdh, 10/portTICK_PERIOD_MS);
-    i2c_cmd_link_delete(cmdh);
+    ret = disp_proto_i2c_cmd_begin(handle, i2cDataPtr, cmdh, 10);
+    i2c_cmd_link_delete_static(cmdh);
     return ret;
 }
 
@@ -122,14 +351,91 @@ esp_err_t disp_proto_i2c_write_data(disp_proto_handle_t handle, void* dp_data_pt
     disp_proto_i2c_t *i2cDataPtr = (disp_proto_i2c_t *)dp_data_ptr;    
     assert(i2cDataPtr != NULL);
     esp_err_t ret = ESP_FAIL;
-    i2c_cmd_handle_t cmdh = i2c_cmd_link_create();
+    i2c_cmd_handle_t cmdh = disp_proto_i2c_link_create(i2cDataPtr);
     i2c_master_start(cmdh);
 	i2c_master_write_byte(cmdh, (i2cDataPtr->address << 1) | I2C_MASTER_WRITE, true);
 	i2c_master_write_byte(cmdh, I2C_DATA_STREAM, true);
     i2c_master_write(cmdh, data, len, true);
     i2c_master_stop(cmdh);
-    ret = i2c_master_cmd_begin(i2cDataPtr->port, cmdh, 10/portTICK_PERIOD_MS);
-    i2c_cmd_link_delete(cmdh);
+    ret = disp_proto_i2c_cmd_begin(handle, i2cDataPtr, cmdh, 10);
+    i2c_cmd_link_delete_static(cmdh);
+    return ret;
+}
+
+// Segments are sent as a single transaction. Commands are sent with control-byte continuation (Co = 1), so commands 
+// and the following data stream share the addressing. Data stream (Co = 0) lasts until the end of the transfer,
+// so a segment that follows data starts with a repeated START condition instead of STOP/START.
+// If control bytes or operations of all segments do not fit in the batch buffer or the command link,
+// the transfer is split into several transactions. On a shared port every data segment (a page of a refresh)
+// ends the transaction, so refreshes of several displays are interleaved page by page.
+esp_err_t disp_proto_i2c_write_segments(disp_proto_handle_t handle, void* dp_data_ptr, disp_proto_seg_t segments[], int num)
+{
+    disp_proto_i2c_t *i2cDataPtr = (disp_proto_i2c_t *)dp_data_ptr;    
+    assert(i2cDataPtr != NULL);
+    uint8_t ctrl_buf[I2C_BATCH_BUF_SIZE];
+    bool shared = (disp_proto_i2c_bus_devices(i2cDataPtr->bus) > 1);
+    esp_err_t ret = ESP_OK;
+    int i = 0;
+    while ((i < num) && (ret == ESP_OK))
+    {
+        i2c_cmd_handle_t cmdh = disp_proto_i2c_link_create(i2cDataPtr);
+        int ctrl_len = 0;
+        int ops = 0;
+        int bytes = 0;
+        bool restart = true;
+        bool chunk_end = false;
+        for (; (i < num) && !chunk_end; i++)
+        {
+            disp_proto_seg_t *seg = &segments[i];
+            int need = 1 + ((seg->type == DPS_COMMANDS) ? 2 * seg->len : 1);
+            // start (on restart), control bytes write, data write; one operation is kept for the stop
+            int need_ops = (restart ? 1 : 0) + 1 + ((seg->type == DPS_DATA) ? 1 : 0);
+            if ((ctrl_len + need > I2C_BATCH_BUF_SIZE) || (ops + need_ops + 1 > I2C_LINK_MAX_OPS))
+            {
+                break;
+            }
+            ops += need_ops;
+            uint8_t *ctrl = &ctrl_buf[ctrl_len];
+            if (restart)
+            {
+                i2c_master_start(cmdh);
+                ctrl_buf[ctrl_len++] = (i2cDataPtr->address << 1) | I2C_MASTER_WRITE;
+            }
+            if (seg->type == DPS_COMMANDS)
+            {
+                for (int j = 0; j < seg->len; j++)
+                {
+                    ctrl_buf[ctrl_len++] = I2C_CMD_SINGLE;
+                    ctrl_buf[ctrl_len++] = seg->buf[j];
+                }
+                restart = false;
+            }
+            else
+            {
+                ctrl_buf[ctrl_len++] = I2C_DATA_STREAM;
+                restart = true;
+            }
+            i2c_master_write(cmdh, ctrl, &ctrl_buf[ctrl_len] - ctrl, true);
+            if (seg->type == DPS_DATA)
+            {
+                i2c_master_write(cmdh, seg->buf, seg->len, true);
+                bytes += seg->len;
+                chunk_end = shared;
+            }
+        }
+        if (ctrl_len == 0)
+        {
+            // single segment does not fit in the batch buffer
+            i2c_cmd_link_delete_static(cmdh);
+            return ESP_ERR_INVALID_SIZE;
+        }
+        bytes += ctrl_len;
+        i2c_master_stop(cmdh);
+        // 10 ms (as for other operations) plus twice the time needed to send all bytes (9 clock cycles per byte)
+        int timeout_ms = 10 + (int) ((bytes * 9 * 2000LL) / i2cDataPtr->clock_speed);
+        ret = disp_proto_i2c_cmd_begin(handle, i2cDataPtr, cmdh, timeout_ms);
+        i2c_cmd_link_delete_static(cmdh);
+    }
     return ret;
 }
 
@@ -137,5 +443,9 @@ esp_err_t disp_proto_i2c_close(disp_proto_handle_t handle, void* dp_data_ptr)
 {
     disp_proto_i2c_t *i2cDataPtr = (disp_proto_i2c_t *)dp_data_ptr;    
     assert(i2cDataPtr != NULL);
-    return i2c_driver_delete(i2cDataPtr->port);
+    free(i2cDataPtr->link_buf);
+    i2cDataPtr->link_buf = NULL;
+    vSemaphoreDelete(i2cDataPtr->turn);
+    i2cDataPtr->turn = NULL;
+    return disp_proto_i2c_bus_close(i2cDataPtr->port, i2cDataPtr->bus);
 }
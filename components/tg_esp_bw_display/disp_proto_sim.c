@@ -0,0 +1,300 @@
+// disp_proto_sim.c
+
+#include <string.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "bw_disp.h"
+#include "disp_proto_sim.h"
+#include "disp_stats.h"
+
+#define TAG "DISP_PROTO_SIM"
+
+#define SIM_CMD_SET_CONTRAST            0x81
+#define SIM_CMD_SET_ENTIRE_DISPLAY_OFF  0xA4
+#define SIM_CMD_SET_ENTIRE_DISPLAY_ON   0xA5
+#define SIM_CMD_SET_NORMAL_DISPLAY      0xA6
+#define SIM_CMD_SET_REVERSE_DISPLAY     0xA7
+#define SIM_CMD_SET_MULTIPLEX_RATIO     0xA8
+#define SIM_CMD_SET_CLOCK_DIVIDE        0xD5
+#define SIM_CMD_SET_PRECHARGE_PERIOD    0xD9
+#define SIM_CMD_SET_COM_PADS            0xDA
+#define SIM_CMD_SET_VCOM_DESELECT       0xDB
+#define SIM_CMD_RMW_START               0xE0
+#define SIM_CMD_RMW_END                 0xEE
+#define SIM_CMD_NOP                     0xE3
+
+/** Wire overhead of a transaction (address byte and control byte) */
+#define SIM_TRANSACTION_OVERHEAD        2
+
+typedef struct
+{
+    disp_proto_sim_state_t state;   ///< Simulated controller state
+    disp_proto_sim_stats_t stats;   ///< Bus traffic counters
+    uint8_t pending_cmd;            ///< First byte of a two-byte command waiting for its argument (0 if none)
+    TickType_t transfer_delay;      ///< Time taken by each batched transfer
+} disp_proto_sim_t;
+
+esp_err_t disp_proto_sim_write_command(disp_proto_handle_t handle, void* dp_data_ptr, uint8_t cmd);
+esp_err_t disp_proto_sim_write_commands(disp_proto_handle_t handle, void* dp_data_ptr, uint8_t commands[], int len);
+esp_err_t disp_proto_sim_write_data_byte(disp_proto_handle_t handle, void* dp_data_ptr, uint8_t data);
+esp_err_t disp_proto_sim_write_data(disp_proto_handle_t handle, void* dp_data_ptr, uint8_t data[], int len);
+esp_err_t disp_proto_sim_write_segments(disp_proto_handle_t handle, void* dp_data_ptr, disp_proto_seg_t segments[], int num);
+esp_err_t disp_proto_sim_close(disp_proto_handle_t handle, void* dp_data_ptr);
+
+
+disp_proto_handle_t disp_proto_init_sim(void)
+{
+    disp_proto_sim_t simData;
+    memset(&simData, 0, sizeof(simData));
+    simData.state.contrast = 0x80;
+    simData.state.multiplex_ratio = 63;
+    disp_proto_handle_t handle = disp_proto_init(DP_SIM,
+        &disp_proto_sim_write_command, &disp_proto_sim_write_commands, &disp_proto_sim_write_data_byte, &disp_proto_sim_write_data,
+        &disp_proto_sim_write_segments, &disp_proto_sim_close,
+        &simData, sizeof(simData));
+    if (handle != INVALID_HANDLE)
+    {
+        ESP_LOGI(TAG, "Initialized simulated connection. Handle: #%d", handle);
+    }
+    return handle;
+}
+
+const disp_proto_sim_state_t* disp_proto_sim_get_state(disp_proto_handle_t handle)
+{
+    disp_proto_sim_t *simDataPtr = (disp_proto_sim_t *) disp_proto_get_data(handle, DP_SIM);
+    if (simDataPtr == NULL)
+    {
+        return NULL;
+    }
+    return &(simDataPtr->state);
+}
+
+esp_err_t disp_proto_sim_get_stats(disp_proto_handle_t handle, disp_proto_sim_stats_t *stats)
+{
+    disp_proto_sim_t *simDataPtr = (disp_proto_sim_t *) disp_proto_get_data(handle, DP_SIM);
+    if (simDataPtr == NULL || stats == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *stats = simDataPtr->stats;
+    return ESP_OK;
+}
+
+esp_err_t disp_proto_sim_reset_stats(disp_proto_handle_t handle)
+{
+    disp_proto_sim_t *simDataPtr = (disp_proto_sim_t *) disp_proto_get_data(handle, DP_SIM);
+    if (simDataPtr == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(&(simDataPtr->stats), 0, sizeof(simDataPtr->stats));
+    return ESP_OK;
+}
+
+esp_err_t disp_proto_sim_set_transfer_delay(disp_proto_handle_t handle, TickType_t delay)
+{
+    disp_proto_sim_t *simDataPtr = (disp_proto_sim_t *) disp_proto_get_data(handle, DP_SIM);
+    if (simDataPtr == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    simDataPtr->transfer_delay = delay;
+    return ESP_OK;
+}
+
+static void disp_proto_sim_apply_command(disp_proto_sim_t *simDataPtr, uint8_t cmd)
+{
+    disp_proto_sim_state_t *state = &(simDataPtr->state);
+    simDataPtr->stats.command_bytes++;
+    if (simDataPtr->pending_cmd != 0)
+    {
+        // argument of a two-byte command
+        switch (simDataPtr->pending_cmd)
+        {
+        case SIM_CMD_SET_CONTRAST:
+            state->contrast = cmd;
+            break;
+        case SIM_CMD_SET_MULTIPLEX_RATIO:
+            state->multiplex_ratio = cmd & 0x3F;
+            break;
+        case BWD_CMD_SET_DISPLAY_OFFSET:
+            state->display_offset = cmd & 0x3F;
+            break;
+        case BWD_CMD_SET_CHARGE_PUMP_CTRL:
+            state->charge_pump = (cmd & 0x01) != 0;
+            break;
+        default:
+            break;
+        }
+        simDataPtr->pending_cmd = 0;
+        return;
+    }
+    if (cmd <= 0x0F)
+    {
+        state->col = (state->col & 0xF0) | (cmd & 0x0F);
+    }
+    else if (cmd <= 0x1F)
+    {
+        state->col = (state->col & 0x0F) | ((cmd & 0x0F) << 4);
+    }
+    else if (cmd >= 0x30 && cmd <= 0x33)
+    {
+        // pump voltage - ignored
+    }
+    else if (cmd >= BWD_CMD_SET_DISPLAY_START_LINE && cmd <= BWD_CMD_SET_DISPLAY_START_LINE + 0x3F)
+    {
+        state->start_line = cmd - BWD_CMD_SET_DISPLAY_START_LINE;
+    }
+    else if (cmd >= BWD_CMD_SET_PAGE_ADDR && cmd <= BWD_CMD_SET_PAGE_ADDR + 0x0F)
+    {
+        state->page = cmd - BWD_CMD_SET_PAGE_ADDR;
+    }
+    else if ((cmd & 0xF0) == BWD_CMD_SET_COM_SCAN_MODE_NORMAL)
+    {
+        state->com_scan_reverse = (cmd & 0x08) != 0;
+    }
+    else
+    {
+        switch (cmd)
+        {
+        case BWD_CMD_SET_SEGMENT_REMAP_NORMAL:
+        case BWD_CMD_SET_SEGMENT_REMAP_INVERSE:
+            state->segment_remap = cmd == BWD_CMD_SET_SEGMENT_REMAP_INVERSE;
+            break;
+        case SIM_CMD_SET_NORMAL_DISPLAY:
+        case SIM_CMD_SET_REVERSE_DISPLAY:
+            state->inverse = cmd == SIM_CMD_SET_REVERSE_DISPLAY;
+            break;
+        case BWD_CMD_DISPLAY_OFF:
+        case BWD_CMD_DISPLAY_ON:
+            state->display_on = cmd == BWD_CMD_DISPLAY_ON;
+            break;
+        case SIM_CMD_SET_CONTRAST:
+        case SIM_CMD_SET_MULTIPLEX_RATIO:
+        case BWD_CMD_SET_DISPLAY_OFFSET:
+        case BWD_CMD_SET_CHARGE_PUMP_CTRL:
+        case SIM_CMD_SET_CLOCK_DIVIDE:
+        case SIM_CMD_SET_PRECHARGE_PERIOD:
+        case SIM_CMD_SET_COM_PADS:
+        case SIM_CMD_SET_VCOM_DESELECT:
+            simDataPtr->pending_cmd = cmd;
+            break;
+        case SIM_CMD_SET_ENTIRE_DISPLAY_OFF:
+        case SIM_CMD_SET_ENTIRE_DISPLAY_ON:
+        case SIM_CMD_RMW_START:
+        case SIM_CMD_RMW_END:
+        case SIM_CMD_NOP:
+            break;
+        default:
+            state->unknown_commands++;
+            break;
+        }
+    }
+}
+
+static void disp_proto_sim_apply_data(disp_proto_sim_t *simDataPtr, uint8_t data[], int len)
+{
+    disp_proto_sim_state_t *state = &(simDataPtr->state);
+    simDataPtr->stats.data_bytes += len;
+    for (int i = 0; i < len; i++)
+    {
+        if (state->page >= DP_SIM_GDDRAM_PAGES || state->col >= DP_SIM_GDDRAM_WIDTH)
+        {
+            state->overflow_bytes++;
+            continue;
+        }
+        state->gddram[state->page][state->col++] = data[i];
+    }
+}
+
+esp_err_t disp_proto_sim_write_command(disp_proto_handle_t handle, void* dp_data_ptr, uint8_t cmd)
+{
+    disp_proto_sim_t *simDataPtr = (disp_proto_sim_t *)dp_data_ptr;
+    assert(simDataPtr != NULL);
+    DISP_STATS_START(start);
+    simDataPtr->stats.transactions++;
+    simDataPtr->stats.wire_bytes += SIM_TRANSACTION_OVERHEAD + 1;
+    disp_proto_sim_apply_command(simDataPtr, cmd);
+    DISP_STATS_TRANSACTION(handle, start);
+    return ESP_OK;
+}
+
+esp_err_t disp_proto_sim_write_commands(disp_proto_handle_t handle, void* dp_data_ptr, uint8_t commands[], int len)
+{
+    disp_proto_sim_t *simDataPtr = (disp_proto_sim_t *)dp_data_ptr;
+    assert(simDataPtr != NULL);
+    DISP_STATS_START(start);
+    simDataPtr->stats.transactions++;
+    simDataPtr->stats.wire_bytes += SIM_TRANSACTION_OVERHEAD + len;
+    for (int i = 0; i < len; i++)
+    {
+        disp_proto_sim_apply_command(simDataPtr, commands[i]);
+    }
+    DISP_STATS_TRANSACTION(handle, start);
+    return ESP_OK;
+}
+
+esp_err_t disp_proto_sim_write_data_byte(disp_proto_handle_t handle, void* dp_data_ptr, uint8_t data)
+{
+    return disp_proto_sim_write_data(handle, dp_data_ptr, &data, 1);
+}
+
+esp_err_t disp_proto_sim_write_data(disp_proto_handle_t handle, void* dp_data_ptr, uint8_t data[], int len)
+{
+    disp_proto_sim_t *simDataPtr = (disp_proto_sim_t *)dp_data_ptr;
+    assert(simDataPtr != NULL);
+    DISP_STATS_START(start);
+    simDataPtr->stats.transactions++;
+    simDataPtr->stats.wire_bytes += SIM_TRANSACTION_OVERHEAD + len;
+    disp_proto_sim_apply_data(simDataPtr, data, len);
+    DISP_STATS_TRANSACTION(handle, start);
+    return ESP_OK;
+}
+
+// Wire bytes are counted as the I2C protocol sends a batch: commands with a control byte each (Co = 1),
+// data with a single control byte and an address byte (repeated START) before the segment following data.
+esp_err_t disp_proto_sim_write_segments(disp_proto_handle_t handle, void* dp_data_ptr, disp_proto_seg_t segments[], int num)
+{
+    disp_proto_sim_t *simDataPtr = (disp_proto_sim_t *)dp_data_ptr;
+    assert(simDataPtr != NULL);
+    DISP_STATS_START(start);
+    simDataPtr->stats.transactions++;
+    bool restart = true;
+    for (int i = 0; i < num; i++)
+    {
+        if (restart)
+        {
+            simDataPtr->stats.wire_bytes++;
+        }
+        if (segments[i].type == DPS_COMMANDS)
+        {
+            simDataPtr->stats.wire_bytes += 2 * segments[i].len;
+            for (int j = 0; j < segments[i].len; j++)
+            {
+                disp_proto_sim_apply_command(simDataPtr, segments[i].buf[j]);
+            }
+            restart = false;
+        }
+        else
+        {
+            simDataPtr->stats.wire_bytes += 1 + segments[i].len;
+            disp_proto_sim_apply_data(simDataPtr, segments[i].buf, segments[i].len);
+            restart = true;
+        }
+    }
+    if (simDataPtr->transfer_delay != 0)
+    {
+        vTaskDelay(simDataPtr->transfer_delay);
+    }
+    DISP_STATS_TRANSACTION(handle, start);
+    return ESP_OK;
+}
+
+esp_err_t disp_proto_sim_close(disp_proto_handle_t handle, void* dp_data_ptr)
+{
+    assert(dp_data_ptr != NULL);
+    return ESP_OK;
+}
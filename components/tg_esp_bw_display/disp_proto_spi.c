@@ -0,0 +1,268 @@
+// disp_proto_spi.c
+
+#include <string.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/gpio.h"
+#include "driver/spi_master.h"
+
+#include "disp_proto.h"
+#include "disp_stats.h"
+
+#define TAG "DISP_PROTO_SPI"
+
+/** Number of transactions queued at once */
+#define SPI_QUEUE_SIZE 8
+/** Size of the DMA buffer - a whole SH1106 frame (8 pages of 132 columns) with addressing commands fits in it */
+#define SPI_DMA_BUF_SIZE 1280
+/** Transfers up to this size are sent from the transaction itself (no DMA buffer needed) */
+#define SPI_TXDATA_SIZE 4
+
+// D/C pin number and level are passed to the pre-transfer callback in the user field of the transaction
+#define SPI_DC_USER(dc, level)  ((void *) (((uintptr_t) (dc) << 1) | (level)))
+
+typedef struct
+{
+    spi_host_device_t host;
+    spi_device_handle_t dev;
+    gpio_num_t dc;
+    int clock_speed;
+    uint8_t *dma_buf;                       ///< DMA-capable buffer for data of queued transactions
+    int dma_used;                           ///< Bytes of the DMA buffer used by queued transactions
+    int queued;                             ///< Number of transactions in flight
+    int next;                               ///< Next transaction to use
+    spi_transaction_t trans[SPI_QUEUE_SIZE];
+#if BW_DISP_STATS
+    int64_t queued_at[SPI_QUEUE_SIZE];      ///< Time each transaction was queued at
+#endif
+} disp_proto_spi_t;
+
+esp_err_t disp_proto_spi_write_command(disp_proto_handle_t handle, void* dp_data_ptr, uint8_t cmd);
+esp_err_t disp_proto_spi_write_commands(disp_proto_handle_t handle, void* dp_data_ptr, uint8_t commands[], int len);
+esp_err_t disp_proto_spi_write_data_byte(disp_proto_handle_t handle, void* dp_data_ptr, uint8_t data);
+esp_err_t disp_proto_spi_write_data(disp_proto_handle_t handle, void* dp_data_ptr, uint8_t data[], int len);
+esp_err_t disp_proto_spi_write_segments(disp_proto_handle_t handle, void* dp_data_ptr, disp_proto_seg_t segments[], int num);
+esp_err_t disp_proto_spi_close(disp_proto_handle_t handle, void* dp_data_ptr);
+
+
+// Sets D/C line before the transfer (called from the SPI interrupt)
+static void IRAM_ATTR disp_proto_spi_pre_cb(spi_transaction_t *t)
+{
+    uintptr_t user = (uintptr_t) t->user;
+    gpio_set_level((gpio_num_t) (user >> 1), user & 0x01);
+}
+
+disp_proto_handle_t disp_proto_init_spi(spi_host_device_t host, int clock_speed, gpio_num_t mosi, gpio_num_t sclk,
+    gpio_num_t cs, gpio_num_t dc, gpio_num_t rst)
+{
+    disp_proto_handle_t handle = INVALID_HANDLE;
+
+    gpio_config_t io_config =
+    {
+        .pin_bit_mask = (1ULL << dc) | ((rst != GPIO_NUM_NC) ? (1ULL << rst) : 0),
+        .mode = GPIO_MODE_OUTPUT,
+        .pull_up_en = GPIO_PULLUP_DISABLE,
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .intr_type = GPIO_INTR_DISABLE
+    };
+    esp_err_t ret = gpio_config(&io_config);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to configure D/C and RST pins. Code: 0x%.2X", ret);
+        return INVALID_HANDLE;
+    }
+    if (rst != GPIO_NUM_NC)
+    {
+        gpio_set_level(rst, 0);
+        vTaskDelay(10/portTICK_PERIOD_MS);
+        gpio_set_level(rst, 1);
+        vTaskDelay(10/portTICK_PERIOD_MS);
+    }
+    spi_bus_config_t bus_config =
+    {
+        .mosi_io_num = mosi,
+        .miso_io_num = GPIO_NUM_NC,
+        .sclk_io_num = sclk,
+        .quadwp_io_num = GPIO_NUM_NC,
+        .quadhd_io_num = GPIO_NUM_NC,
+        .max_transfer_sz = SPI_DMA_BUF_SIZE
+    };
+    ret = spi_bus_initialize(host, &bus_config, SPI_DMA_CH_AUTO);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to initialize SPI bus. Code: 0x%.2X", ret);
+        return INVALID_HANDLE;
+    }
+    spi_device_interface_config_t dev_config =
+    {
+        .clock_speed_hz = clock_speed,
+        .mode = 0,
+        .spics_io_num = cs,
+        .queue_size = SPI_QUEUE_SIZE,
+        .pre_cb = &disp_proto_spi_pre_cb
+    };
+    disp_proto_spi_t spiData =
+    {
+        .host = host,
+        .dc = dc,
+        .clock_speed = clock_speed
+    };
+    ret = spi_bus_add_device(host, &dev_config, &spiData.dev);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to add SPI device. Code: 0x%.2X", ret);
+        spi_bus_free(host);
+        return INVALID_HANDLE;
+    }
+    spiData.dma_buf = (uint8_t *) heap_caps_malloc(SPI_DMA_BUF_SIZE, MALLOC_CAP_DMA);
+    if (spiData.dma_buf == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to allocate DMA buffer");
+        spi_bus_remove_device(spiData.dev);
+        spi_bus_free(host);
+        return INVALID_HANDLE;
+    }
+    handle = disp_proto_init(DP_SPI,
+        &disp_proto_spi_write_command, &disp_proto_spi_write_commands, &disp_proto_spi_write_data_byte, &disp_proto_spi_write_data,
+        &disp_proto_spi_write_segments, &disp_proto_spi_close,
+        &spiData, sizeof(spiData));
+    if (handle == INVALID_HANDLE)
+    {
+        heap_caps_free(spiData.dma_buf);
+        spi_bus_remove_device(spiData.dev);
+        spi_bus_free(host);
+        return INVALID_HANDLE;
+    }
+    ESP_LOGI(TAG, "Initialized SPI connection on host #%d. MOSI: %d; SCLK: %d; CS: %d; D/C: %d; RST: %d; Clock: %d Hz; Handle: #%d",
+        host, mosi, sclk, cs, dc, rst, clock_speed, handle);
+    return handle;
+}
+
+// Waits until at most keep transactions are in flight
+static esp_err_t disp_proto_spi_wait(disp_proto_handle_t handle, disp_proto_spi_t *spiDataPtr, int keep)
+{
+    // 10 ms (as for I2C) plus twice the time needed to send the whole DMA buffer
+    int timeout_ms = 10 + (int) ((SPI_DMA_BUF_SIZE * 8 * 2000LL) / spiDataPtr->clock_speed);
+    while (spiDataPtr->queued > keep)
+    {
+        spi_transaction_t *t;
+        esp_err_t ret = spi_device_get_trans_result(spiDataPtr->dev, &t, timeout_ms / portTICK_PERIOD_MS);
+        if (ret != ESP_OK)
+        {
+            return ret;
+        }
+        // transactions finish in the queuing order - latency of each one is counted from queuing to its result
+        DISP_STATS_TRANSACTION(handle, spiDataPtr->queued_at[(spiDataPtr->next + SPI_QUEUE_SIZE - spiDataPtr->queued) % SPI_QUEUE_SIZE]);
+        spiDataPtr->queued--;
+    }
+    if (spiDataPtr->queued == 0)
+    {
+        spiDataPtr->dma_used = 0;
+    }
+    return ESP_OK;
+}
+
+// Queues transfer of up to SPI_DMA_BUF_SIZE bytes. Data is copied, so the caller's buffer can be reused at once.
+static esp_err_t disp_proto_spi_queue(disp_proto_handle_t handle, disp_proto_spi_t *spiDataPtr, bool data, const uint8_t *buf, int len)
+{
+    esp_err_t ret = ESP_OK;
+    if (spiDataPtr->queued == SPI_QUEUE_SIZE)
+    {
+        ret = disp_proto_spi_wait(handle, spiDataPtr, SPI_QUEUE_SIZE - 1);
+    }
+    if ((ret == ESP_OK) && (len > SPI_TXDATA_SIZE) && (spiDataPtr->dma_used + len > SPI_DMA_BUF_SIZE))
+    {
+        ret = disp_proto_spi_wait(handle, spiDataPtr, 0);
+    }
+    if (ret != ESP_OK)
+    {
+        return ret;
+    }
+    spi_transaction_t *t = &(spiDataPtr->trans[spiDataPtr->next]);
+    memset(t, 0, sizeof(*t));
+    t->length = len * 8;
+    t->user = SPI_DC_USER(spiDataPtr->dc, data ? 1 : 0);
+    if (len <= SPI_TXDATA_SIZE)
+    {
+        t->flags = SPI_TRANS_USE_TXDATA;
+        memcpy(t->tx_data, buf, len);
+    }
+    else
+    {
+        uint8_t *dst = &(spiDataPtr->dma_buf[spiDataPtr->dma_used]);
+        memcpy(dst, buf, len);
+        t->tx_buffer = dst;
+        // keep transfers word-aligned
+        spiDataPtr->dma_used += (len + 3) & ~0x03;
+    }
+#if BW_DISP_STATS
+    spiDataPtr->queued_at[spiDataPtr->next] = esp_timer_get_time();
+#endif
+    ret = spi_device_queue_trans(spiDataPtr->dev, t, portMAX_DELAY);
+    if (ret == ESP_OK)
+    {
+        spiDataPtr->queued++;
+        spiDataPtr->next = (spiDataPtr->next + 1) % SPI_QUEUE_SIZE;
+    }
+    return ret;
+}
+
+esp_err_t disp_proto_spi_write_command(disp_proto_handle_t handle, void* dp_data_ptr, uint8_t cmd)
+{
+    return disp_proto_spi_write_commands(handle, dp_data_ptr, &cmd, 1);
+}
+
+esp_err_t disp_proto_spi_write_commands(disp_proto_handle_t handle, void* dp_data_ptr, uint8_t commands[], int len)
+{
+    disp_proto_seg_t seg = { .type = DPS_COMMANDS, .len = len, .buf = commands };
+    return disp_proto_spi_write_segments(handle, dp_data_ptr, &seg, 1);
+}
+
+esp_err_t disp_proto_spi_write_data_byte(disp_proto_handle_t handle, void* dp_data_ptr, uint8_t data)
+{
+    return disp_proto_spi_write_data(handle, dp_data_ptr, &data, 1);
+}
+
+esp_err_t disp_proto_spi_write_data(disp_proto_handle_t handle, void* dp_data_ptr, uint8_t data[], int len)
+{
+    disp_proto_seg_t seg = { .type = DPS_DATA, .len = len, .buf = data };
+    return disp_proto_spi_write_segments(handle, dp_data_ptr, &seg, 1);
+}
+
+// Every segment is a separate transaction (D/C level is set per transaction). Segments are copied to the DMA buffer
+// and queued, so the whole batch (e.g. all dirty pages of a frame) is sent back to back; the function returns
+// when all transactions are done. If the DMA buffer gets full, queued transactions are finished first.
+esp_err_t disp_proto_spi_write_segments(disp_proto_handle_t handle, void* dp_data_ptr, disp_proto_seg_t segments[], int num)
+{
+    disp_proto_spi_t *spiDataPtr = (disp_proto_spi_t *)dp_data_ptr;
+    assert(spiDataPtr != NULL);
+    esp_err_t ret = ESP_OK;
+    for (int i = 0; (i < num) && (ret == ESP_OK); i++)
+    {
+        disp_proto_seg_t *seg = &segments[i];
+        for (int done = 0; (done < seg->len) && (ret == ESP_OK); done += SPI_DMA_BUF_SIZE)
+        {
+            ret = disp_proto_spi_queue(handle, spiDataPtr, seg->type == DPS_DATA, &(seg->buf[done]), MIN(seg->len - done, SPI_DMA_BUF_SIZE));
+        }
+    }
+    esp_err_t wait_ret = disp_proto_spi_wait(handle, spiDataPtr, 0);
+    return (ret != ESP_OK) ? ret : wait_ret;
+}
+
+esp_err_t disp_proto_spi_close(disp_proto_handle_t handle, void* dp_data_ptr)
+{
+    disp_proto_spi_t *spiDataPtr = (disp_proto_spi_t *)dp_data_ptr;
+    assert(spiDataPtr != NULL);
+    esp_err_t ret = spi_bus_remove_device(spiDataPtr->dev);
+    heap_caps_free(spiDataPtr->dma_buf);
+    spiDataPtr->dma_buf = NULL;
+    if (ret == ESP_OK)
+    {
+        ret = spi_bus_free(spiDataPtr->host);
+    }
+    return ret;
+}
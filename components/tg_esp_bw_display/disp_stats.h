@@ -0,0 +1,48 @@
+// disp_stats.h - performance counters (internal)
+
+#pragma once
+
+#include <stdint.h>
+#include "esp_timer.h"
+#include "bw_disp.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @file
+ *  Counters are collected only if the component is built with BW_DISP_STATS set to 1. Otherwise the macros below
+ *  expand to nothing, instances carry no counters, and the get/reset functions return ESP_ERR_NOT_SUPPORTED.
+ */
+
+#ifndef BW_DISP_STATS
+#define BW_DISP_STATS 0
+#endif
+
+#if BW_DISP_STATS
+
+/** Declares var holding the start time of a measured operation */
+#define DISP_STATS_START(var)                       int64_t var = esp_timer_get_time()
+/** Records a bus transaction of a protocol instance started at start (for use by protocol implementations) */
+#define DISP_STATS_TRANSACTION(handle, start)       disp_proto_stats_transaction((handle), (start))
+/** Counts call of a drawing primitive of a display (the display must be locked) */
+#define BWD_STATS_PRIM_CALL(handle, prim)           bw_disp_stats_prim((handle), (prim))
+
+/** @brief Adds latency of an operation started at start_us (esp_timer_get_time) */
+void disp_latency_stats_add(disp_latency_stats_t *stats, int64_t start_us);
+/** @brief Records a bus transaction started at start_us */
+void disp_proto_stats_transaction(disp_proto_handle_t handle, int64_t start_us);
+/** @brief Counts call of a drawing primitive */
+void bw_disp_stats_prim(bw_disp_handle_t handle, bw_disp_prim_t prim);
+
+#else
+
+#define DISP_STATS_START(var)
+#define DISP_STATS_TRANSACTION(handle, start)
+#define BWD_STATS_PRIM_CALL(handle, prim)
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
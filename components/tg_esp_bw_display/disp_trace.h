@@ -0,0 +1,62 @@
+// disp_trace.h - operation trace recording (internal)
+
+#pragma once
+
+#include <stdint.h>
+#include "esp_timer.h"
+#include "bw_disp_trace.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @file
+ *  Events are recorded only if the component is built with BW_DISP_TRACE set to 1; otherwise the macros below
+ *  expand to nothing. When built in but not enabled, recording costs a single flag check.
+ */
+
+#ifndef BW_DISP_TRACE
+#define BW_DISP_TRACE 0
+#endif
+
+#if BW_DISP_TRACE
+
+/** @brief Gets start time of a traced operation (0 if recording is disabled) */
+int64_t disp_trace_now(void);
+/** @brief Records operation started at start_us (nothing if start_us is 0) */
+void disp_trace_record(bw_trace_op_t op, uint16_t handle, uint32_t len, int64_t start_us, esp_err_t ret);
+
+/** @brief Operation traced until the end of a scope */
+typedef struct
+{
+    int64_t start;
+    uint32_t len;
+    uint16_t handle;
+    uint8_t op;
+} disp_trace_scope_t;
+
+static inline void disp_trace_scope_end(disp_trace_scope_t *scope)
+{
+    disp_trace_record((bw_trace_op_t) scope->op, scope->handle, scope->len, scope->start, ESP_OK);
+}
+
+/** Declares var holding the start time of a traced operation */
+#define DISP_TRACE_START(var)                           int64_t var = disp_trace_now()
+/** Records operation started at start */
+#define DISP_TRACE_RECORD(op, handle, len, start, ret)  disp_trace_record((op), (handle), (len), (start), (ret))
+/** Traces operation from here to the end of the scope */
+#define DISP_TRACE_SCOPE(scope_handle, scope_op, scope_len) \
+    disp_trace_scope_t disp_trace_scope __attribute__((cleanup(disp_trace_scope_end))) = \
+        { .start = disp_trace_now(), .len = (scope_len), .handle = (scope_handle), .op = (scope_op) }
+
+#else
+
+#define DISP_TRACE_START(var)
+#define DISP_TRACE_RECORD(op, handle, len, start, ret)
+#define DISP_TRACE_SCOPE(handle, op, len)
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
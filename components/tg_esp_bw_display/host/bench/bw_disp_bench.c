@@ -0,0 +1,786 @@
+// bw_disp_bench.c - drawing and refresh benchmark (host build, simulated display protocol)
+//
+// Usage: bw_disp_bench [-n iterations] [-csv] [-trace file.json]
+//
+// Every workload is run in both refresh modes. For each one the benchmark reports CPU time per drawing
+// operation, CPU time per refresh, bytes and transactions that bw_disp_refresh puts on the bus per frame,
+// and heap operations (malloc, calloc, realloc, free) done by bw_disp_refresh - the refresh path is expected to do none.
+// After every refresh the simulated display RAM is checked against the display content; the benchmark exits
+// with 1 if any workload left the panel showing something else.
+// With -trace (build with BW_DISP_TRACE) the last recorded operations are written as Chrome trace-event JSON.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+
+#include "esp_log.h"
+#include "bw_disp.h"
+#include "bw_disp_sprite.h"
+#include "bw_disp_font.h"
+#include "bw_disp_trace.h"
+#include "disp_proto_sim.h"
+
+#define DEFAULT_ITERATIONS 200
+/** First column of the 128x64 panel in the display RAM */
+#define BENCH_FIRST_COL 2
+/** Panel size */
+#define BENCH_PANEL_WIDTH 128
+#define BENCH_PANEL_HEIGHT 64
+
+typedef struct
+{
+    bw_disp_handle_t disp;
+    bw_disp_handle_t screen;        ///< Display (disp is a canvas in canvas workloads)
+    bw_disp_rotation_t rotation;    ///< Rotation of the display
+    disp_proto_handle_t proto;
+    int iterations;
+    uint32_t seed;
+    uint64_t draw_ns;       ///< CPU time spent drawing
+    uint64_t refresh_ns;    ///< CPU time spent in bw_disp_refresh
+    uint64_t ops;           ///< Number of drawing operations
+    uint64_t frames;        ///< Number of refreshed frames
+    uint64_t heap_ops;      ///< Number of heap operations done by bw_disp_refresh
+    uint64_t bad_frames;    ///< Number of refreshes after which the panel did not show the display content
+} bench_ctx_t;
+
+typedef struct
+{
+    const char *name;
+    void (*run)(bench_ctx_t *ctx);
+} bench_workload_t;
+
+static bw_image_t img_tennis_ball =
+{
+    .width = 32,
+    .height = 32,
+    .image =
+    {
+        0x00, 0x00, 0x80, 0xC0, 0xE0, 0xB0, 0x98, 0x9C, 0x8C, 0x86, 0x86, 0x03, 0x03, 0x03, 0x03, 0x03,
+        0x03, 0x03, 0x03, 0x03, 0x07, 0x06, 0x0E, 0x3E, 0x7C, 0xF8, 0xB8, 0x70, 0xE0, 0xC0, 0x00, 0x00,
+        0xF8, 0xFE, 0x0F, 0x07, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x07, 0x0F, 0x3E, 0xFC, 0xF0, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x03, 0xFF, 0xFC, 0x03, 0xFF, 0xFC,
+        0x1F, 0x7F, 0xE0, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1F, 0x3F, 0x78,
+        0xE0, 0xC0, 0xC0, 0xC0, 0xC0, 0xC0, 0xC0, 0xC0, 0xE0, 0x70, 0x38, 0x1F, 0x87, 0xE0, 0xFF, 0x1F,
+        0x00, 0x00, 0x01, 0x03, 0x06, 0x0C, 0x18, 0x30, 0x70, 0x60, 0x60, 0xC0, 0xC0, 0xC0, 0xC0, 0xC0,
+        0xC0, 0xC0, 0xC0, 0xC1, 0xC1, 0x61, 0x60, 0x70, 0x30, 0x18, 0x1C, 0x0E, 0x07, 0x01, 0x00, 0x00
+    }
+};
+
+// Heap functions are wrapped (see --wrap in CMakeLists.txt) and counted while s_bench_heap_ops is not NULL
+static uint64_t *s_bench_heap_ops = NULL;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t num, size_t size);
+void* __real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+void* __wrap_malloc(size_t size)
+{
+    if (s_bench_heap_ops != NULL)
+    {
+        (*s_bench_heap_ops)++;
+    }
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t num, size_t size)
+{
+    if (s_bench_heap_ops != NULL)
+    {
+        (*s_bench_heap_ops)++;
+    }
+    return __real_calloc(num, size);
+}
+
+void* __wrap_realloc(void *ptr, size_t size)
+{
+    if (s_bench_heap_ops != NULL)
+    {
+        (*s_bench_heap_ops)++;
+    }
+    return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void *ptr)
+{
+    if (s_bench_heap_ops != NULL)
+    {
+        (*s_bench_heap_ops)++;
+    }
+    __real_free(ptr);
+}
+
+static uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint32_t bench_rand(bench_ctx_t *ctx)
+{
+    // xorshift32 - deterministic across platforms and releases
+    uint32_t x = ctx->seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    ctx->seed = x;
+    return x;
+}
+
+static uint64_t bench_draw_start;
+
+static void bench_draw_begin(bench_ctx_t *ctx)
+{
+    bench_draw_start = bench_now_ns();
+}
+
+static void bench_draw_end(bench_ctx_t *ctx, int ops)
+{
+    ctx->draw_ns += bench_now_ns() - bench_draw_start;
+    ctx->ops += ops;
+}
+
+// Checks whether the panel (display RAM as seen through the start line, segment remap and COM scan direction)
+// shows the display content
+static bool bench_panel_matches(bench_ctx_t *ctx)
+{
+    const disp_proto_sim_state_t *s = disp_proto_sim_get_state(ctx->proto);
+    uint16_t width = bw_disp_get_width(ctx->screen);
+    uint16_t height = bw_disp_get_height(ctx->screen);
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            // panel position (rotation is clockwise)
+            int px = x;
+            int py = y;
+            switch (ctx->rotation)
+            {
+            case BWD_ROTATE_90:
+                px = BENCH_PANEL_WIDTH - 1 - y;
+                py = x;
+                break;
+            case BWD_ROTATE_180:
+                px = BENCH_PANEL_WIDTH - 1 - x;
+                py = BENCH_PANEL_HEIGHT - 1 - y;
+                break;
+            case BWD_ROTATE_270:
+                px = y;
+                py = BENCH_PANEL_HEIGHT - 1 - x;
+                break;
+            default:
+                break;
+            }
+            int col = s->segment_remap ? (BENCH_FIRST_COL + px) : (BENCH_FIRST_COL + BENCH_PANEL_WIDTH - 1 - px);
+            int row = s->com_scan_reverse ? py : (BENCH_PANEL_HEIGHT - 1 - py);
+            row = (row + s->start_line) % BENCH_PANEL_HEIGHT;
+            bw_disp_clr_t c;
+            bw_disp_get_pixel(ctx->screen, x, y, &c);
+            if (((s->gddram[row >> 3][col] >> (row & 7)) & 1) != (c == BWDC_WHITE))
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static void bench_refresh(bench_ctx_t *ctx)
+{
+    uint64_t t = bench_now_ns();
+    s_bench_heap_ops = &(ctx->heap_ops);
+    bw_disp_refresh(ctx->disp);
+    s_bench_heap_ops = NULL;
+    ctx->refresh_ns += bench_now_ns() - t;
+    ctx->frames++;
+    if (!bench_panel_matches(ctx))
+    {
+        ctx->bad_frames++;
+    }
+}
+
+static void bench_full_fill(bench_ctx_t *ctx)
+{
+    for (int i = 0; i < ctx->iterations; i++)
+    {
+        bench_draw_begin(ctx);
+        bw_disp_fill(ctx->disp, (i & 1) ? BWDC_BLACK : BWDC_WHITE);
+        bench_draw_end(ctx, 1);
+        bench_refresh(ctx);
+    }
+}
+
+static void bench_full_fill_rect(bench_ctx_t *ctx)
+{
+    uint16_t width = bw_disp_get_width(ctx->disp);
+    uint16_t height = bw_disp_get_height(ctx->disp);
+    for (int i = 0; i < ctx->iterations; i++)
+    {
+        bench_draw_begin(ctx);
+        bw_disp_fill_rect(ctx->disp, 0, 0, width, height, (i & 1) ? BWDC_BLACK : BWDC_WHITE);
+        bench_draw_end(ctx, 1);
+        bench_refresh(ctx);
+    }
+}
+
+// the main.c loop: erase the ball, move it, draw it again
+static void bench_bouncing_ball(bench_ctx_t *ctx)
+{
+    uint16_t width = bw_disp_get_width(ctx->disp);
+    uint16_t height = bw_disp_get_height(ctx->disp);
+    uint16_t iw = img_tennis_ball.width;
+    uint16_t ih = img_tennis_ball.height;
+    uint16_t x = 0;
+    uint16_t y = 16;
+    int dx = 1;
+    int dy = 1;
+    bw_disp_image(ctx->disp, x, y, &img_tennis_ball);
+    bw_disp_refresh(ctx->disp);
+    for (int i = 0; i < ctx->iterations; i++)
+    {
+        bench_draw_begin(ctx);
+        bw_disp_fill_rect(ctx->disp, x, y, iw, ih, BWDC_BLACK);
+        x += dx;
+        if (x == 0 || (x == (width - iw)))
+        {
+            dx = -dx;
+        }
+        y += dy;
+        if (y == 0 || (y == (height - ih)))
+        {
+            dy = -dy;
+        }
+        bw_disp_image(ctx->disp, x, y, &img_tennis_ball);
+        bench_draw_end(ctx, 2);
+        bench_refresh(ctx);
+    }
+}
+
+static void bench_pixel_storm(bench_ctx_t *ctx)
+{
+    const int pixels = 256;
+    uint16_t width = bw_disp_get_width(ctx->disp);
+    uint16_t height = bw_disp_get_height(ctx->disp);
+    for (int i = 0; i < ctx->iterations; i++)
+    {
+        bench_draw_begin(ctx);
+        for (int j = 0; j < pixels; j++)
+        {
+            uint32_t r = bench_rand(ctx);
+            bw_disp_set_pixel(ctx->disp, r % width, (r >> 8) % height, (r >> 16) & 1 ? BWDC_WHITE : BWDC_BLACK);
+        }
+        bench_draw_end(ctx, pixels);
+        bench_refresh(ctx);
+    }
+}
+
+// the same pixels drawn through the surface pointer with inline operations
+static void bench_pixel_storm_surface(bench_ctx_t *ctx)
+{
+    const int pixels = 256;
+    bw_disp_surface_t *s = bw_disp_get_surface(ctx->disp);
+    for (int i = 0; i < ctx->iterations; i++)
+    {
+        bench_draw_begin(ctx);
+        for (int j = 0; j < pixels; j++)
+        {
+            uint32_t r = bench_rand(ctx);
+            bw_disp_surface_set_pixel(s, r % s->width, (r >> 8) % s->height, (r >> 16) & 1 ? BWDC_WHITE : BWDC_BLACK);
+        }
+        bench_draw_end(ctx, pixels);
+        bench_refresh(ctx);
+    }
+}
+
+// scatter plot drawn with a single bw_disp_set_pixels call per frame
+static void bench_scatter_batch(bench_ctx_t *ctx)
+{
+    const int pixels = 256;
+    bw_disp_point_t points[256];
+    uint16_t width = bw_disp_get_width(ctx->disp);
+    uint16_t height = bw_disp_get_height(ctx->disp);
+    for (int i = 0; i < ctx->iterations; i++)
+    {
+        for (int j = 0; j < pixels; j++)
+        {
+            uint32_t r = bench_rand(ctx);
+            points[j].x = r % width;
+            points[j].y = (r >> 8) % height;
+        }
+        bench_draw_begin(ctx);
+        bw_disp_set_pixels(ctx->disp, points, pixels, (i & 1) ? BWDC_BLACK : BWDC_WHITE);
+        bench_draw_end(ctx, pixels);
+        bench_refresh(ctx);
+    }
+}
+
+// text-like pattern: rows of 5x7 "glyphs" built from short horizontal and vertical strokes
+static void bench_text_lines(bench_ctx_t *ctx)
+{
+    uint16_t width = bw_disp_get_width(ctx->disp);
+    uint16_t height = bw_disp_get_height(ctx->disp);
+    for (int i = 0; i < ctx->iterations; i++)
+    {
+        int ops = 0;
+        bench_draw_begin(ctx);
+        bw_disp_fill_rect(ctx->disp, 0, 0, width, height, BWDC_BLACK);
+        ops++;
+        for (uint16_t y = 1 + (i & 3); y + 7 <= height; y += 9)
+        {
+            for (uint16_t x = 1; x + 5 <= width; x += 6)
+            {
+                uint32_t r = bench_rand(ctx);
+                if (r & 0x01) { bw_disp_hline(ctx->disp, x, y, 5, BWDC_WHITE); ops++; }
+                if (r & 0x02) { bw_disp_hline(ctx->disp, x, y + 3, 5, BWDC_WHITE); ops++; }
+                if (r & 0x04) { bw_disp_hline(ctx->disp, x, y + 6, 5, BWDC_WHITE); ops++; }
+                if (r & 0x08) { bw_disp_vline(ctx->disp, x, y, 7, BWDC_WHITE); ops++; }
+                if (r & 0x10) { bw_disp_vline(ctx->disp, x + 4, y, 7, BWDC_WHITE); ops++; }
+                if (r & 0x20) { bw_disp_vline(ctx->disp, x + 2, y, 4, BWDC_WHITE); ops++; }
+            }
+        }
+        bench_draw_end(ctx, ops);
+        bench_refresh(ctx);
+    }
+}
+
+// image blits at every vertical offset, in every draw mode, plain and inverted
+static void bench_image_blits(bench_ctx_t *ctx)
+{
+    static const bw_disp_img_draw_mode_t modes[] = { BWDM_OVERRIDE, BWDM_ADD_WHITE, BWDM_ADD_BLACK };
+    for (int i = 0; i < ctx->iterations; i++)
+    {
+        int ops = 0;
+        bench_draw_begin(ctx);
+        for (int yo = 0; yo < 8; yo++)
+        {
+            for (int m = 0; m < 3; m++)
+            {
+                for (int inv = 0; inv < 2; inv++)
+                {
+                    uint16_t x = (uint16_t) ((yo * 12 + m * 4 + inv * 2 + i) % 96);
+                    uint16_t y = (uint16_t) (yo + 8 * ((m + inv) % 4));
+                    bw_disp_image_sel_ex(ctx->disp, x, y, 0, 0, 0xFFFF, 0xFFFF, inv != 0, modes[m], &img_tennis_ball);
+                    ops++;
+                }
+            }
+        }
+        bench_draw_end(ctx, ops);
+        bench_refresh(ctx);
+    }
+}
+
+// Row-major bitmap (a 33x33 QR code module pattern scaled to 66x66, XBM bit order) blitted at every vertical offset 
+// without conversion
+static void bench_bitmap_blits(bench_ctx_t *ctx)
+{
+    static uint8_t data[66 * 9];
+    for (int y = 0; y < 66; y++)
+    {
+        for (int x = 0; x < 66; x++)
+        {
+            uint32_t h = (uint32_t) ((x / 2) * 73 + (y / 2) * 151) * 2654435761U;
+            if ((h >> 28) & 1)
+            {
+                data[y * 9 + x / 8] |= 1 << (x % 8);
+            }
+        }
+    }
+    const bw_bitmap_t bmp = { .width = 66, .height = 66, .stride = 9, .msb_first = false, .data = data };
+    for (int i = 0; i < ctx->iterations; i++)
+    {
+        bench_draw_begin(ctx);
+        bw_disp_clear(ctx->disp);
+        for (int yo = 0; yo < 8; yo++)
+        {
+            bw_disp_bitmap_sel_ex(ctx->disp, (uint16_t) ((yo * 9 + i) % 62), (uint16_t) yo, 0, 0, 0xFFFF, 0xFFFF, false, 
+                (yo & 1) ? BWDM_ADD_WHITE : BWDM_OVERRIDE, &bmp);
+        }
+        bench_draw_end(ctx, 8);
+        bench_refresh(ctx);
+    }
+}
+
+// Dashboard: 5 lines of 20 glyphs at unaligned rows, redrawn every frame
+static void bench_text(bench_ctx_t *ctx)
+{
+    char line[40];
+    for (int i = 0; i < ctx->iterations; i++)
+    {
+        bench_draw_begin(ctx);
+        bw_disp_clear(ctx->disp);
+        for (int l = 0; l < 5; l++)
+        {
+            snprintf(line, sizeof(line), "L%d T=%5d.%d V=%04X", l, i * 7 + l, (i + l) % 10, (i * 31 + l) & 0xFFFF);
+            bw_disp_text(ctx->disp, 2, (uint16_t) (1 + l * 12 + (i & 3)), &bw_font_6x8, line, BWDC_WHITE);
+        }
+        bench_draw_end(ctx, 5 * 20);
+        bench_refresh(ctx);
+    }
+}
+
+// Event log of 8 text lines, a line added every frame: whole log redrawn
+static void bench_log_redraw(bench_ctx_t *ctx)
+{
+    char line[24];
+    for (int i = 0; i < ctx->iterations; i++)
+    {
+        bench_draw_begin(ctx);
+        bw_disp_clear(ctx->disp);
+        for (int l = 0; l < 8; l++)
+        {
+            snprintf(line, sizeof(line), "#%05d event %d", i + l, (i + l) % 7);
+            bw_disp_text(ctx->disp, 0, (uint16_t) (l * 8), &bw_font_6x8, line, BWDC_WHITE);
+        }
+        bench_draw_end(ctx, 8);
+        bench_refresh(ctx);
+    }
+}
+
+// Event log on the display rotated by 90 degrees (16 lines of 10 characters): whole log redrawn,
+// dirty blocks transposed by the refresh
+static void bench_log_redraw_90(bench_ctx_t *ctx)
+{
+    char line[24];
+    bw_disp_set_rotation(ctx->disp, BWD_ROTATE_90);
+    ctx->rotation = BWD_ROTATE_90;
+    for (int i = 0; i < ctx->iterations; i++)
+    {
+        bench_draw_begin(ctx);
+        bw_disp_clear(ctx->disp);
+        for (int l = 0; l < 16; l++)
+        {
+            snprintf(line, sizeof(line), "#%04d ev%d", (i + l) % 10000, (i + l) % 7);
+            bw_disp_text(ctx->disp, 2, (uint16_t) (l * 8), &bw_font_6x8, line, BWDC_WHITE);
+        }
+        bench_draw_end(ctx, 16);
+        bench_refresh(ctx);
+    }
+    bw_disp_set_rotation(ctx->disp, BWD_ROTATE_0);
+    ctx->rotation = BWD_ROTATE_0;
+}
+
+// The same event log scrolled with the display start line: only the new line is drawn
+static void bench_log_scroll(bench_ctx_t *ctx)
+{
+    char line[24];
+    for (int i = 0; i < ctx->iterations; i++)
+    {
+        bench_draw_begin(ctx);
+        bw_disp_scroll(ctx->disp, 8, BWDC_BLACK);
+        snprintf(line, sizeof(line), "#%05d event %d", i + 7, (i + 7) % 7);
+        bw_disp_text(ctx->disp, 0, 56, &bw_font_6x8, line, BWDC_WHITE);
+        bench_draw_end(ctx, 1);
+        bench_refresh(ctx);
+    }
+}
+
+// Map on a 256x128 canvas drawn once, panned by the viewport: vertical pans use the display start line
+static void bench_map_pan(bench_ctx_t *ctx)
+{
+    bw_disp_handle_t disp = ctx->disp;
+    bw_disp_handle_t canvas = bw_disp_canvas_create(disp, 256, 128);
+    if (canvas == INVALID_HANDLE)
+    {
+        return;
+    }
+    char label[8];
+    for (int y = 0; y < 128; y += 16)
+    {
+        bw_disp_hline(canvas, 0, (uint16_t) y, 256, BWDC_WHITE);
+        for (int x = 0; x < 256; x += 32)
+        {
+            bw_disp_vline(canvas, (uint16_t) x, (uint16_t) y, 16, BWDC_WHITE);
+            snprintf(label, sizeof(label), "%c%d", 'A' + x / 32, y / 16);
+            bw_disp_text(canvas, (uint16_t) (x + 4), (uint16_t) (y + 5), &bw_font_6x8, label, BWDC_WHITE);
+        }
+    }
+    ctx->disp = canvas;
+    bench_refresh(ctx);
+    int vy = 0;
+    int dy = 2;
+    for (int i = 0; i < ctx->iterations; i++)
+    {
+        bench_draw_begin(ctx);
+        if (vy + dy < 0 || vy + dy > 64)
+        {
+            dy = -dy;
+        }
+        vy += dy;
+        // a sideways step every 32 frames
+        uint16_t vx = (uint16_t) (((i / 32) % 8) * 16);
+        bw_disp_set_viewport(canvas, vx, (uint16_t) vy);
+        bench_draw_end(ctx, 1);
+        bench_refresh(ctx);
+    }
+    ctx->disp = disp;
+    bw_disp_close(canvas);
+}
+
+// Analog gauge: static scale, needle erased and redrawn every frame
+static void bench_gauge(bench_ctx_t *ctx)
+{
+    const uint16_t cx = 64;
+    const uint16_t cy = 60;
+    const uint16_t r = 50;
+    bw_disp_arc(ctx->disp, cx, cy, r + 2, 180, 180, BWDC_WHITE);
+    for (int a = 180; a <= 360; a += 30)
+    {
+        float rad = a * (float) M_PI / 180.0f;
+        bw_disp_line(ctx->disp, cx + (int) (cosf(rad) * (r - 4)), cy + (int) (sinf(rad) * (r - 4)),
+            cx + (int) (cosf(rad) * r), cy + (int) (sinf(rad) * r), BWDC_WHITE);
+    }
+    bw_disp_refresh(ctx->disp);
+    uint16_t nx = cx;
+    uint16_t ny = cy;
+    for (int i = 0; i < ctx->iterations; i++)
+    {
+        float rad = (180 + (i * 7) % 180) * (float) M_PI / 180.0f;
+        bench_draw_begin(ctx);
+        bw_disp_line(ctx->disp, cx, cy, nx, ny, BWDC_BLACK);
+        nx = cx + (int) (cosf(rad) * (r - 6));
+        ny = cy + (int) (sinf(rad) * (r - 6));
+        bw_disp_line(ctx->disp, cx, cy, nx, ny, BWDC_WHITE);
+        bw_disp_fill_circle(ctx->disp, cx, cy, 3, BWDC_WHITE);
+        bench_draw_end(ctx, 3);
+        bench_refresh(ctx);
+    }
+}
+
+// Moving indicators over a static background
+static void bench_sprites(bench_ctx_t *ctx)
+{
+    uint16_t width = bw_disp_get_width(ctx->disp);
+    uint16_t height = bw_disp_get_height(ctx->disp);
+    for (uint16_t x = 0; x < width; x += 4)
+    {
+        bw_disp_vline(ctx->disp, x, 0, height, BWDC_WHITE);
+    }
+    bw_disp_refresh(ctx->disp);
+    bw_sprite_handle_t sprites[4];
+    int x[4];
+    int y[4];
+    int dx[4];
+    int dy[4];
+    for (int s = 0; s < 4; s++)
+    {
+        sprites[s] = bw_sprite_create(ctx->disp, &img_tennis_ball, s == 0 ? BWDM_OVERRIDE : BWDM_ADD_WHITE, s);
+        x[s] = s * 24;
+        y[s] = s * 8;
+        dx[s] = (s & 1) ? -1 : 1;
+        dy[s] = (s & 2) ? -1 : 1;
+        bw_sprite_move(sprites[s], x[s], y[s]);
+        bw_sprite_show(sprites[s], true);
+    }
+    bw_sprite_update(ctx->disp);
+    bw_disp_refresh(ctx->disp);
+    for (int i = 0; i < ctx->iterations; i++)
+    {
+        bench_draw_begin(ctx);
+        for (int s = 0; s < 4; s++)
+        {
+            if (x[s] + dx[s] < 0 || x[s] + dx[s] > width - img_tennis_ball.width)
+            {
+                dx[s] = -dx[s];
+            }
+            if (y[s] + dy[s] < 0 || y[s] + dy[s] > height - img_tennis_ball.height)
+            {
+                dy[s] = -dy[s];
+            }
+            x[s] += dx[s];
+            y[s] += dy[s];
+            bw_sprite_move(sprites[s], x[s], y[s]);
+        }
+        bw_sprite_update(ctx->disp);
+        bench_draw_end(ctx, 4);
+        bench_refresh(ctx);
+    }
+    for (int s = 0; s < 4; s++)
+    {
+        bw_sprite_delete(sprites[s]);
+    }
+}
+
+// The same blits as image_blits, from pre-shifted variants
+static void bench_prepared_blits(bench_ctx_t *ctx)
+{
+    static const bw_disp_img_draw_mode_t modes[] = { BWDM_OVERRIDE, BWDM_ADD_WHITE, BWDM_ADD_BLACK };
+    bw_prepared_image_t *pimg = bw_image_prepare(&img_tennis_ball, 0xFF);
+    for (int i = 0; i < ctx->iterations; i++)
+    {
+        int ops = 0;
+        bench_draw_begin(ctx);
+        for (int yo = 0; yo < 8; yo++)
+        {
+            for (int m = 0; m < 3; m++)
+            {
+                for (int inv = 0; inv < 2; inv++)
+                {
+                    uint16_t x = (uint16_t) ((yo * 12 + m * 4 + inv * 2 + i) % 96);
+                    uint16_t y = (uint16_t) (yo + 8 * ((m + inv) % 4));
+                    bw_disp_prepared_image(ctx->disp, x, y, inv != 0, modes[m], pimg);
+                    ops++;
+                }
+            }
+        }
+        bench_draw_end(ctx, ops);
+        bench_refresh(ctx);
+    }
+    bw_image_prepared_free(pimg);
+}
+
+// The same blits as image_blits, from a compressed image
+static void bench_rle_blits(bench_ctx_t *ctx)
+{
+    static const bw_disp_img_draw_mode_t modes[] = { BWDM_OVERRIDE, BWDM_ADD_WHITE, BWDM_ADD_BLACK };
+    bw_image_t *cimg = bw_image_compress(&img_tennis_ball);
+    for (int i = 0; i < ctx->iterations; i++)
+    {
+        int ops = 0;
+        bench_draw_begin(ctx);
+        for (int yo = 0; yo < 8; yo++)
+        {
+            for (int m = 0; m < 3; m++)
+            {
+                for (int inv = 0; inv < 2; inv++)
+                {
+                    uint16_t x = (uint16_t) ((yo * 12 + m * 4 + inv * 2 + i) % 96);
+                    uint16_t y = (uint16_t) (yo + 8 * ((m + inv) % 4));
+                    bw_disp_image_sel_ex(ctx->disp, x, y, 0, 0, 0xFFFF, 0xFFFF, inv != 0, modes[m], cimg);
+                    ops++;
+                }
+            }
+        }
+        bench_draw_end(ctx, ops);
+        bench_refresh(ctx);
+    }
+    free(cimg);
+}
+
+static const bench_workload_t s_workloads[] =
+{
+    { "full_fill", &bench_full_fill },
+    { "full_fill_rect", &bench_full_fill_rect },
+    { "bouncing_ball", &bench_bouncing_ball },
+    { "pixel_storm", &bench_pixel_storm },
+    { "pixel_storm_surf", &bench_pixel_storm_surface },
+    { "scatter_batch", &bench_scatter_batch },
+    { "text_lines", &bench_text_lines },
+    { "image_blits", &bench_image_blits },
+    { "prepared_blits", &bench_prepared_blits },
+    { "rle_blits", &bench_rle_blits },
+    { "bitmap_blits", &bench_bitmap_blits },
+    { "sprites", &bench_sprites },
+    { "text", &bench_text },
+    { "log_redraw", &bench_log_redraw },
+    { "log_scroll", &bench_log_scroll },
+    { "log_redraw_90", &bench_log_redraw_90 },
+    { "map_pan", &bench_map_pan },
+    { "gauge", &bench_gauge },
+};
+
+static const char* s_mode_names[] = { "dirty", "diff" };
+
+int main(int argc, char **argv)
+{
+    int iterations = DEFAULT_ITERATIONS;
+    int result = 0;
+    bool csv = false;
+    const char *trace_path = NULL;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+        {
+            iterations = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-csv") == 0)
+        {
+            csv = true;
+        }
+        else if (strcmp(argv[i], "-trace") == 0 && i + 1 < argc)
+        {
+            trace_path = argv[++i];
+        }
+        else
+        {
+            fprintf(stderr, "Usage: %s [-n iterations] [-csv] [-trace file.json]\n", argv[0]);
+            return 1;
+        }
+    }
+    bw_trace_enable(trace_path != NULL);
+    esp_log_level_set("*", ESP_LOG_ERROR);
+    if (csv)
+    {
+        printf("workload,mode,frames,ops,draw_ns_per_op,refresh_ns_per_frame,bytes_per_frame,data_bytes_per_frame,transactions_per_frame,heap_ops_per_frame\n");
+    }
+    else
+    {
+        printf("%-16s %-6s %8s %10s %12s %14s %12s %12s %10s %8s\n", "workload", "mode", "frames", "ops",
+            "draw ns/op", "refresh ns/fr", "bytes/fr", "data B/fr", "trans/fr", "heap/fr");
+    }
+    for (int w = 0; w < (int) (sizeof(s_workloads) / sizeof(s_workloads[0])); w++)
+    {
+        for (int mode = BWDR_DIRTY; mode <= BWDR_DIFF; mode++)
+        {
+            bench_ctx_t ctx;
+            memset(&ctx, 0, sizeof(ctx));
+            ctx.iterations = iterations;
+            ctx.seed = 0x12345678;
+            ctx.proto = disp_proto_init_sim();
+            ctx.disp = bw_disp_init(ctx.proto, BWD_SH1106_128X64);
+            if (ctx.disp == INVALID_HANDLE)
+            {
+                fprintf(stderr, "Display initialization failed!\n");
+                return 1;
+            }
+            ctx.screen = ctx.disp;
+            ctx.rotation = BWD_ROTATE_0;
+            bw_disp_set_refresh_mode(ctx.disp, (bw_disp_refresh_mode_t) mode);
+            bw_disp_refresh(ctx.disp);
+            disp_proto_sim_reset_stats(ctx.proto);
+
+            s_workloads[w].run(&ctx);
+
+            disp_proto_sim_stats_t stats;
+            disp_proto_sim_get_stats(ctx.proto, &stats);
+            double frames = ctx.frames > 0 ? (double) ctx.frames : 1.0;
+            double ops = ctx.ops > 0 ? (double) ctx.ops : 1.0;
+            if (csv)
+            {
+                printf("%s,%s,%llu,%llu,%.1f,%.1f,%.1f,%.1f,%.2f,%.2f\n", s_workloads[w].name, s_mode_names[mode],
+                    (unsigned long long) ctx.frames, (unsigned long long) ctx.ops, ctx.draw_ns / ops, ctx.refresh_ns / frames,
+                    stats.wire_bytes / frames, stats.data_bytes / frames, stats.transactions / frames, ctx.heap_ops / frames);
+            }
+            else
+            {
+                printf("%-16s %-6s %8llu %10llu %12.1f %14.1f %12.1f %12.1f %10.2f %8.2f\n", s_workloads[w].name, s_mode_names[mode],
+                    (unsigned long long) ctx.frames, (unsigned long long) ctx.ops, ctx.draw_ns / ops, ctx.refresh_ns / frames,
+                    stats.wire_bytes / frames, stats.data_bytes / frames, stats.transactions / frames, ctx.heap_ops / frames);
+            }
+            if (ctx.bad_frames != 0)
+            {
+                fprintf(stderr, "%s (%s): panel does not show the display content after %llu of %llu frames\n",
+                    s_workloads[w].name, s_mode_names[mode], (unsigned long long) ctx.bad_frames, (unsigned long long) ctx.frames);
+                result = 1;
+            }
+            bw_disp_close(ctx.disp);
+        }
+    }
+    if (trace_path != NULL)
+    {
+        FILE *f = fopen(trace_path, "w");
+        esp_err_t ret = (f != NULL) ? bw_trace_export_json(f) : ESP_FAIL;
+        if (f != NULL)
+        {
+            fclose(f);
+        }
+        if (ret != ESP_OK)
+        {
+            fprintf(stderr, "Failed to write trace to %s (built without BW_DISP_TRACE?)\n", trace_path);
+            return 1;
+        }
+    }
+    return result;
+}
@@ -0,0 +1,318 @@
+// freertos_shim.c - FreeRTOS, esp_log and esp_timer subset implemented with POSIX threads (host builds)
+
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+
+esp_log_level_t esp_log_shim_level = ESP_LOG_INFO;
+
+void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+    (void) tag;
+    esp_log_shim_level = level;
+}
+
+typedef struct
+{
+    TaskFunction_t task_code;
+    void *params;
+} shim_task_start_t;
+
+static void* shim_task_entry(void *arg)
+{
+    shim_task_start_t start = *(shim_task_start_t *) arg;
+    free(arg);
+    start.task_code(start.params);
+    return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task_code, const char *name, uint32_t stack_depth, void *params,
+    UBaseType_t priority, TaskHandle_t *created_task, BaseType_t core_id)
+{
+    (void) name;
+    (void) stack_depth;
+    (void) priority;
+    (void) core_id;
+    shim_task_start_t *start = (shim_task_start_t *) malloc(sizeof(shim_task_start_t));
+    if (start == NULL)
+    {
+        return pdFAIL;
+    }
+    start->task_code = task_code;
+    start->params = params;
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, &shim_task_entry, start) != 0)
+    {
+        free(start);
+        return pdFAIL;
+    }
+    pthread_detach(thread);
+    if (created_task != NULL)
+    {
+        *created_task = (TaskHandle_t) thread;
+    }
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    assert(task == NULL);
+    pthread_exit(NULL);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    usleep((useconds_t) ticks * portTICK_PERIOD_MS * 1000);
+}
+
+int64_t esp_timer_get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (TickType_t) ((ts.tv_sec * 1000 + ts.tv_nsec / 1000000) / portTICK_PERIOD_MS);
+}
+
+// Converts timeout in ticks to an absolute CLOCK_REALTIME time (as needed by pthread_cond_timedwait)
+static struct timespec shim_deadline(TickType_t ticks)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    uint64_t ns = (uint64_t) ticks * portTICK_PERIOD_MS * 1000000ULL + ts.tv_nsec;
+    ts.tv_sec += ns / 1000000000ULL;
+    ts.tv_nsec = ns % 1000000000ULL;
+    return ts;
+}
+
+typedef enum
+{
+    SHIM_SEM_MUTEX,
+    SHIM_SEM_RECURSIVE_MUTEX,
+    SHIM_SEM_BINARY
+} shim_sem_type_t;
+
+struct shim_semaphore
+{
+    shim_sem_type_t type;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int count;              ///< 1 if the semaphore is available
+    pthread_t owner;        ///< Owner of a recursive mutex
+    int depth;              ///< Recursion depth of a recursive mutex
+};
+
+static SemaphoreHandle_t shim_semaphore_create(shim_sem_type_t type, int count)
+{
+    SemaphoreHandle_t sem = (SemaphoreHandle_t) calloc(1, sizeof(struct shim_semaphore));
+    if (sem == NULL)
+    {
+        return NULL;
+    }
+    sem->type = type;
+    sem->count = count;
+    pthread_mutex_init(&(sem->mutex), NULL);
+    pthread_cond_init(&(sem->cond), NULL);
+    return sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return shim_semaphore_create(SHIM_SEM_MUTEX, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex(void)
+{
+    return shim_semaphore_create(SHIM_SEM_RECURSIVE_MUTEX, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return shim_semaphore_create(SHIM_SEM_BINARY, 0);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks)
+{
+    struct timespec deadline = shim_deadline(ticks);
+    BaseType_t ret = pdTRUE;
+    pthread_mutex_lock(&(sem->mutex));
+    while (sem->count == 0)
+    {
+        if (ticks == 0)
+        {
+            ret = pdFALSE;
+            break;
+        }
+        if (ticks == portMAX_DELAY)
+        {
+            pthread_cond_wait(&(sem->cond), &(sem->mutex));
+        }
+        else if (pthread_cond_timedwait(&(sem->cond), &(sem->mutex), &deadline) == ETIMEDOUT)
+        {
+            ret = (sem->count > 0) ? pdTRUE : pdFALSE;
+            break;
+        }
+    }
+    if (ret == pdTRUE)
+    {
+        sem->count = 0;
+    }
+    pthread_mutex_unlock(&(sem->mutex));
+    return ret;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+    pthread_mutex_lock(&(sem->mutex));
+    BaseType_t ret = (sem->count == 0) ? pdTRUE : pdFALSE;
+    sem->count = 1;
+    pthread_cond_signal(&(sem->cond));
+    pthread_mutex_unlock(&(sem->mutex));
+    return ret;
+}
+
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t sem, TickType_t ticks)
+{
+    pthread_t self = pthread_self();
+    pthread_mutex_lock(&(sem->mutex));
+    if (sem->depth > 0 && pthread_equal(sem->owner, self))
+    {
+        sem->depth++;
+        pthread_mutex_unlock(&(sem->mutex));
+        return pdTRUE;
+    }
+    pthread_mutex_unlock(&(sem->mutex));
+    if (xSemaphoreTake(sem, ticks) != pdTRUE)
+    {
+        return pdFALSE;
+    }
+    pthread_mutex_lock(&(sem->mutex));
+    sem->owner = self;
+    sem->depth = 1;
+    pthread_mutex_unlock(&(sem->mutex));
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t sem)
+{
+    pthread_mutex_lock(&(sem->mutex));
+    if (sem->depth == 0 || !pthread_equal(sem->owner, pthread_self()))
+    {
+        pthread_mutex_unlock(&(sem->mutex));
+        return pdFALSE;
+    }
+    bool release = --sem->depth == 0;
+    pthread_mutex_unlock(&(sem->mutex));
+    if (release)
+    {
+        xSemaphoreGive(sem);
+    }
+    return pdTRUE;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem)
+{
+    pthread_cond_destroy(&(sem->cond));
+    pthread_mutex_destroy(&(sem->mutex));
+    free(sem);
+}
+
+struct shim_event_group
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    EventBits_t bits;
+};
+
+EventGroupHandle_t xEventGroupCreate(void)
+{
+    EventGroupHandle_t group = (EventGroupHandle_t) calloc(1, sizeof(struct shim_event_group));
+    if (group == NULL)
+    {
+        return NULL;
+    }
+    pthread_mutex_init(&(group->mutex), NULL);
+    pthread_cond_init(&(group->cond), NULL);
+    return group;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear_on_exit, BaseType_t wait_for_all, TickType_t ticks)
+{
+    struct timespec deadline = shim_deadline(ticks);
+    pthread_mutex_lock(&(group->mutex));
+    while (true)
+    {
+        EventBits_t set = group->bits & bits;
+        if (wait_for_all ? (set == bits) : (set != 0))
+        {
+            break;
+        }
+        if (ticks == 0)
+        {
+            break;
+        }
+        if (ticks == portMAX_DELAY)
+        {
+            pthread_cond_wait(&(group->cond), &(group->mutex));
+        }
+        else if (pthread_cond_timedwait(&(group->cond), &(group->mutex), &deadline) == ETIMEDOUT)
+        {
+            break;
+        }
+    }
+    EventBits_t ret = group->bits;
+    EventBits_t set = ret & bits;
+    if (clear_on_exit && (wait_for_all ? (set == bits) : (set != 0)))
+    {
+        group->bits &= ~bits;
+    }
+    pthread_mutex_unlock(&(group->mutex));
+    return ret;
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    pthread_mutex_lock(&(group->mutex));
+    group->bits |= bits;
+    EventBits_t ret = group->bits;
+    pthread_cond_broadcast(&(group->cond));
+    pthread_mutex_unlock(&(group->mutex));
+    return ret;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    pthread_mutex_lock(&(group->mutex));
+    EventBits_t ret = group->bits;
+    group->bits &= ~bits;
+    pthread_mutex_unlock(&(group->mutex));
+    return ret;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group)
+{
+    pthread_mutex_lock(&(group->mutex));
+    EventBits_t ret = group->bits;
+    pthread_mutex_unlock(&(group->mutex));
+    return ret;
+}
+
+void vEventGroupDelete(EventGroupHandle_t group)
+{
+    pthread_cond_destroy(&(group->cond));
+    pthread_mutex_destroy(&(group->mutex));
+    free(group);
+}
@@ -0,0 +1,19 @@
+// i2c.h - host build shim (types used by the public headers only - there is no I2C on the host)
+
+#pragma once
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef int i2c_port_t;
+typedef int gpio_num_t;
+
+#define I2C_NUM_0   0
+#define I2C_NUM_1   1
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,18 @@
+// spi_master.h - host build shim (types used by the public headers only - there is no SPI on the host)
+
+#pragma once
+
+#include "driver/i2c.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef int spi_host_device_t;
+
+#define SPI2_HOST   1
+#define SPI3_HOST   2
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,16 @@
+// esp_timer.h - host build shim
+
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Gets time since startup in microseconds (CLOCK_MONOTONIC) */
+int64_t esp_timer_get_time(void);
+
+#ifdef __cplusplus
+}
+#endif
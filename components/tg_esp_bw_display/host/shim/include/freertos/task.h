@@ -0,0 +1,30 @@
+// task.h - host build shim (POSIX threads)
+
+#pragma once
+
+#include "FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void* TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+/** @brief Creates a task (POSIX thread). Stack size, priority and core are ignored. */
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task_code, const char *name, uint32_t stack_depth, void *params,
+    UBaseType_t priority, TaskHandle_t *created_task, BaseType_t core_id);
+
+/** @brief Deletes a task (only the calling task can be deleted - task must be NULL) */
+void vTaskDelete(TaskHandle_t task);
+
+void vTaskDelay(TickType_t ticks);
+
+TickType_t xTaskGetTickCount(void);
+
+#define taskENTER_CRITICAL(mux)     pthread_mutex_lock(mux)
+#define taskEXIT_CRITICAL(mux)      pthread_mutex_unlock(mux)
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,637 @@
+// bw_disp_test.c - display tests (host build, simulated display protocol)
+//
+// Usage: bw_disp_test
+//
+// Content is drawn through the public API and refreshed in both refresh modes, synchronously and by the refresh task.
+// After every refresh the display RAM of the simulated SH1106 (as seen through its start line, segment remap
+// and COM scan direction) has to match the content read back with bw_disp_get_pixel.
+// Returns non-zero if any check fails.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "bw_disp.h"
+#include "bw_disp_font.h"
+#include "bw_disp_asset.h"
+#include "bw_disp_sprite.h"
+#include "disp_proto_sim.h"
+
+/** Number of drawing rounds (each followed by a refresh) per test case */
+#define TEST_ROUNDS 50
+/** Number of drawing operations per round */
+#define TEST_OPS 12
+/** Number of sprites in the sprite test */
+#define TEST_SPRITES 8
+/** First column of the 128x64 panel in the display RAM */
+#define TEST_FIRST_COL 2
+/** Panel size */
+#define TEST_PANEL_WIDTH 128
+#define TEST_PANEL_HEIGHT 64
+
+#define TEST_CHECK(cond) test_check((cond), #cond, __FILE__, __LINE__)
+
+static int s_test_failures = 0;
+static uint32_t s_test_seed = 12345;
+
+static void test_check(bool ok, const char *expr, const char *file, int line)
+{
+    if (!ok)
+    {
+        printf("%s:%d: check failed: %s\n", file, line, expr);
+        s_test_failures++;
+    }
+}
+
+static uint32_t test_rand(void)
+{
+    // xorshift32
+    s_test_seed ^= s_test_seed << 13;
+    s_test_seed ^= s_test_seed >> 17;
+    s_test_seed ^= s_test_seed << 5;
+    return s_test_seed;
+}
+
+// Gets pixel shown at the given position of the panel (0, 0 - top left corner at rotation 0)
+static int test_panel_pixel(const disp_proto_sim_state_t *s, int x, int y)
+{
+    int col = s->segment_remap ? (TEST_FIRST_COL + x) : (TEST_FIRST_COL + TEST_PANEL_WIDTH - 1 - x);
+    int row = s->com_scan_reverse ? y : (TEST_PANEL_HEIGHT - 1 - y);
+    row = (row + s->start_line) % TEST_PANEL_HEIGHT;
+    return (s->gddram[row >> 3][col] >> (row & 7)) & 1;
+}
+
+// Gets panel position of the content pixel (rotation is clockwise)
+static void test_panel_pos(bw_disp_rotation_t rotation, int x, int y, int *px, int *py)
+{
+    switch (rotation)
+    {
+    case BWD_ROTATE_90:
+        *px = TEST_PANEL_WIDTH - 1 - y;
+        *py = x;
+        break;
+    case BWD_ROTATE_180:
+        *px = TEST_PANEL_WIDTH - 1 - x;
+        *py = TEST_PANEL_HEIGHT - 1 - y;
+        break;
+    case BWD_ROTATE_270:
+        *px = y;
+        *py = TEST_PANEL_HEIGHT - 1 - x;
+        break;
+    default:
+        *px = x;
+        *py = y;
+        break;
+    }
+}
+
+// Compares content of the display with the panel, returns number of different pixels
+static int test_compare(bw_disp_handle_t disp, disp_proto_handle_t proto, bw_disp_rotation_t rotation)
+{
+    const disp_proto_sim_state_t *s = disp_proto_sim_get_state(proto);
+    int width = bw_disp_get_width(disp);
+    int height = bw_disp_get_height(disp);
+    int diff = 0;
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            bw_disp_clr_t c;
+            int px, py;
+            bw_disp_get_pixel(disp, x, y, &c);
+            test_panel_pos(rotation, x, y, &px, &py);
+            diff += (test_panel_pixel(s, px, py) != (c == BWDC_WHITE));
+        }
+    }
+    return diff;
+}
+
+static bw_image_t* test_random_image(uint16_t width, uint16_t height)
+{
+    size_t sz = width * ((height + 7) / 8);
+    bw_image_t *img = (bw_image_t *) calloc(1, sizeof(bw_image_t) + sz);
+    img->width = width;
+    img->height = height;
+    img->format = BWIF_RAW;
+    for (size_t i = 0; i < sz; i++)
+    {
+        img->image[i] = (uint8_t) test_rand();
+    }
+    return img;
+}
+
+// Draws random content (scrolling as well if allowed)
+static void test_draw_random(bw_disp_handle_t disp, const bw_image_t *img, int n, bool scroll)
+{
+    int width = bw_disp_get_width(disp);
+    int height = bw_disp_get_height(disp);
+    for (int i = 0; i < n; i++)
+    {
+        int x = test_rand() % width;
+        int y = test_rand() % height;
+        bw_disp_clr_t c = (bw_disp_clr_t) (test_rand() & 1);
+        switch (test_rand() % 9)
+        {
+        case 0:
+            bw_disp_set_pixel(disp, x, y, c);
+            break;
+        case 1:
+            bw_disp_fill_rect(disp, x, y, 1 + test_rand() % (width - x), 1 + test_rand() % (height - y), c);
+            break;
+        case 2:
+            bw_disp_hline(disp, x, y, 1 + test_rand() % (width - x), c);
+            break;
+        case 3:
+            bw_disp_vline(disp, x, y, 1 + test_rand() % (height - y), c);
+            break;
+        case 4:
+            bw_disp_line(disp, x, y, test_rand() % width, test_rand() % height, c);
+            break;
+        case 5:
+            bw_disp_circle(disp, x, y, test_rand() % 20, c);
+            break;
+        case 6:
+            bw_disp_image_sel_ex(disp, x, y, test_rand() % 8, test_rand() % 8, 1 + test_rand() % img->width,
+                1 + test_rand() % img->height, test_rand() & 1, (bw_disp_img_draw_mode_t) (test_rand() % 3),
+                (bw_image_t *) img);
+            break;
+        case 7:
+            bw_disp_text(disp, x, y, &bw_font_6x8, "Tg 0123", c);
+            break;
+        case 8:
+            if (scroll)
+            {
+                bw_disp_scroll(disp, (int16_t) ((int) (test_rand() % 41) - 20), c);
+            }
+            break;
+        }
+    }
+}
+
+// Refreshes the display (by the refresh task if async is set)
+static esp_err_t test_refresh(bw_disp_handle_t disp, bool async)
+{
+    if (!async)
+    {
+        return bw_disp_refresh(disp);
+    }
+    esp_err_t ret = bw_disp_refresh_async(disp);
+    return (ret == ESP_OK) ? bw_disp_refresh_wait(disp, portMAX_DELAY) : ret;
+}
+
+// Random drawing in the given refresh mode, the panel is checked after every refresh
+static void test_refresh_mode(bw_disp_refresh_mode_t mode, bool async, bw_disp_rotation_t rotation)
+{
+    disp_proto_handle_t proto = disp_proto_init_sim();
+    bw_disp_handle_t disp = bw_disp_init(proto, BWD_SH1106_128X64);
+    TEST_CHECK(disp != 0);
+    TEST_CHECK(bw_disp_set_rotation(disp, rotation) == ESP_OK);
+    TEST_CHECK(bw_disp_set_refresh_mode(disp, mode) == ESP_OK);
+    if (async)
+    {
+        TEST_CHECK(bw_disp_start_async(disp, 5, tskNO_AFFINITY) == ESP_OK);
+    }
+    bw_image_t *img = test_random_image(40, 27);
+    bool scroll = (rotation == BWD_ROTATE_0 || rotation == BWD_ROTATE_180);
+    for (int round = 0; round < TEST_ROUNDS; round++)
+    {
+        test_draw_random(disp, img, TEST_OPS, scroll);
+        TEST_CHECK(test_refresh(disp, async) == ESP_OK);
+        int diff = test_compare(disp, proto, rotation);
+        if (diff != 0)
+        {
+            printf("mode %d, async %d, rotation %d, round %d: %d pixels differ\n", mode, async, rotation, round, diff);
+            TEST_CHECK(diff == 0);
+            break;
+        }
+    }
+    TEST_CHECK(bw_disp_close(disp) == ESP_OK);
+    free(img);
+}
+
+// DIFF mode enabled with content not sent yet - the dirty bytes are sent whatever their content
+static void test_diff_enable_dirty(void)
+{
+    disp_proto_handle_t proto = disp_proto_init_sim();
+    bw_disp_handle_t disp = bw_disp_init(proto, BWD_SH1106_128X64);
+    TEST_CHECK(disp != 0);
+    TEST_CHECK(bw_disp_refresh(disp) == ESP_OK);
+    // the dirty span is sent as it is
+    TEST_CHECK(bw_disp_fill_rect(disp, 10, 0, 20, 4, BWDC_WHITE) == ESP_OK);
+    TEST_CHECK(bw_disp_set_refresh_mode(disp, BWDR_DIFF) == ESP_OK);
+    TEST_CHECK(bw_disp_refresh(disp) == ESP_OK);
+    TEST_CHECK(test_compare(disp, proto, BWD_ROTATE_0) == 0);
+    // bytes of the dirty span are 0x0F when the mode is enabled, then drawn to 0xF0 (the panel still shows 0x00)
+    TEST_CHECK(bw_disp_set_refresh_mode(disp, BWDR_DIRTY) == ESP_OK);
+    TEST_CHECK(bw_disp_fill_rect(disp, 40, 0, 20, 4, BWDC_WHITE) == ESP_OK);
+    TEST_CHECK(bw_disp_set_refresh_mode(disp, BWDR_DIFF) == ESP_OK);
+    TEST_CHECK(bw_disp_fill_rect(disp, 40, 0, 20, 8, BWDC_WHITE) == ESP_OK);
+    TEST_CHECK(bw_disp_fill_rect(disp, 40, 0, 20, 4, BWDC_BLACK) == ESP_OK);
+    TEST_CHECK(bw_disp_refresh(disp) == ESP_OK);
+    TEST_CHECK(test_compare(disp, proto, BWD_ROTATE_0) == 0);
+    TEST_CHECK(bw_disp_close(disp) == ESP_OK);
+}
+
+/** @brief Sprite of the sprite test with its expected state */
+typedef struct
+{
+    bw_sprite_handle_t handle;
+    uint32_t order;                 ///< Creation order
+    bw_image_t *img;
+    bw_disp_img_draw_mode_t mode;
+    int16_t z;
+    uint16_t x;
+    uint16_t y;
+    bool visible;
+} test_sprite_t;
+
+static void test_sprite_create(bw_disp_handle_t disp, test_sprite_t *sprite, bw_image_t *img, uint32_t order)
+{
+    sprite->img = img;
+    sprite->mode = (bw_disp_img_draw_mode_t) (test_rand() % 3);
+    sprite->z = (int16_t) (test_rand() % 2);
+    sprite->order = order;
+    sprite->handle = bw_sprite_create(disp, img, sprite->mode, sprite->z);
+    sprite->x = test_rand() % bw_disp_get_width(disp);
+    sprite->y = test_rand() % bw_disp_get_height(disp);
+    sprite->visible = true;
+    TEST_CHECK(sprite->handle != INVALID_HANDLE);
+    TEST_CHECK(bw_sprite_move(sprite->handle, sprite->x, sprite->y) == ESP_OK);
+    TEST_CHECK(bw_sprite_show(sprite->handle, true) == ESP_OK);
+}
+
+// Sprites moved, shown, hidden, reordered, deleted and created again (slots of deleted sprites are reused);
+// equal z values are frequent. After every update the display has to match a reference display
+// with the background and the visible sprites drawn as images by z-order and creation order.
+static void test_sprite_order(void)
+{
+    disp_proto_handle_t proto = disp_proto_init_sim();
+    bw_disp_handle_t disp = bw_disp_init(proto, BWD_SH1106_128X64);
+    bw_disp_handle_t ref = bw_disp_init(disp_proto_init_sim(), BWD_SH1106_128X64);
+    TEST_CHECK(disp != 0 && ref != 0);
+    bw_image_t *imgs[3] = { test_random_image(24, 19), test_random_image(16, 16), test_random_image(9, 30) };
+    bw_image_t *bg_img = test_random_image(40, 27);
+    uint32_t bg_seed = test_rand();
+    uint32_t seed = s_test_seed;
+    s_test_seed = bg_seed;
+    test_draw_random(disp, bg_img, TEST_OPS, false);
+    s_test_seed = seed;
+    test_sprite_t sprites[TEST_SPRITES];
+    uint32_t order = 0;
+    for (int i = 0; i < TEST_SPRITES; i++)
+    {
+        test_sprite_create(disp, &(sprites[i]), imgs[i % 3], order++);
+    }
+    for (int round = 0; round < TEST_ROUNDS; round++)
+    {
+        for (int i = 0; i < TEST_SPRITES; i++)
+        {
+            test_sprite_t *sprite = &(sprites[test_rand() % TEST_SPRITES]);
+            switch (test_rand() % 5)
+            {
+            case 0:
+                sprite->x = test_rand() % bw_disp_get_width(disp);
+                sprite->y = test_rand() % bw_disp_get_height(disp);
+                TEST_CHECK(bw_sprite_move(sprite->handle, sprite->x, sprite->y) == ESP_OK);
+                break;
+            case 1:
+                sprite->visible = !sprite->visible;
+                TEST_CHECK(bw_sprite_show(sprite->handle, sprite->visible) == ESP_OK);
+                break;
+            case 2:
+                sprite->z = (int16_t) (test_rand() % 2);
+                TEST_CHECK(bw_sprite_set_z(sprite->handle, sprite->z) == ESP_OK);
+                break;
+            case 3:
+                TEST_CHECK(bw_sprite_delete(sprite->handle) == ESP_OK);
+                test_sprite_create(disp, sprite, imgs[test_rand() % 3], order++);
+                break;
+            default:
+                break;
+            }
+        }
+        TEST_CHECK(bw_sprite_update(disp) == ESP_OK);
+        TEST_CHECK(bw_disp_refresh(disp) == ESP_OK);
+        // reference: background, then sprites from the bottom
+        TEST_CHECK(bw_disp_clear(ref) == ESP_OK);
+        seed = s_test_seed;
+        s_test_seed = bg_seed;
+        test_draw_random(ref, bg_img, TEST_OPS, false);
+        s_test_seed = seed;
+        bool drawn[TEST_SPRITES] = { false };
+        for (int n = 0; n < TEST_SPRITES; n++)
+        {
+            int bottom = -1;
+            for (int i = 0; i < TEST_SPRITES; i++)
+            {
+                if (!drawn[i] && (bottom < 0 || sprites[i].z < sprites[bottom].z ||
+                    (sprites[i].z == sprites[bottom].z && sprites[i].order < sprites[bottom].order)))
+                {
+                    bottom = i;
+                }
+            }
+            drawn[bottom] = true;
+            test_sprite_t *sprite = &(sprites[bottom]);
+            if (sprite->visible)
+            {
+                bw_disp_image_sel_ex(ref, sprite->x, sprite->y, 0, 0, sprite->img->width, sprite->img->height,
+                    false, sprite->mode, sprite->img);
+            }
+        }
+        int diff = 0;
+        for (int y = 0; y < bw_disp_get_height(disp); y++)
+        {
+            for (int x = 0; x < bw_disp_get_width(disp); x++)
+            {
+                bw_disp_clr_t c, r;
+                bw_disp_get_pixel(disp, x, y, &c);
+                bw_disp_get_pixel(ref, x, y, &r);
+                diff += (c != r);
+            }
+        }
+        if (diff != 0)
+        {
+            printf("sprites, round %d: %d pixels differ from the reference\n", round, diff);
+            TEST_CHECK(diff == 0);
+            break;
+        }
+        TEST_CHECK(test_compare(disp, proto, BWD_ROTATE_0) == 0);
+    }
+    for (int i = 0; i < TEST_SPRITES; i++)
+    {
+        TEST_CHECK(bw_sprite_delete(sprites[i].handle) == ESP_OK);
+    }
+    TEST_CHECK(bw_disp_close(disp) == ESP_OK);
+    TEST_CHECK(bw_disp_close(ref) == ESP_OK);
+    for (int i = 0; i < 3; i++)
+    {
+        free(imgs[i]);
+    }
+    free(bg_img);
+}
+
+// A canvas much taller than the display is drawn to and panned; the panel shows its viewport
+static void test_tall_canvas(void)
+{
+    disp_proto_handle_t proto = disp_proto_init_sim();
+    bw_disp_handle_t disp = bw_disp_init(proto, BWD_SH1106_128X64);
+    bw_disp_handle_t canvas = bw_disp_canvas_create(disp, 160, 600);
+    TEST_CHECK(disp != 0 && canvas != 0);
+    bw_image_t *img = test_random_image(37, 29);
+    for (int round = 0; round < TEST_ROUNDS; round++)
+    {
+        test_draw_random(canvas, img, TEST_OPS, false);
+        uint16_t vx = test_rand() % (160 - TEST_PANEL_WIDTH + 1);
+        uint16_t vy = test_rand() % (600 - TEST_PANEL_HEIGHT + 1);
+        TEST_CHECK(bw_disp_set_viewport(canvas, vx, vy) == ESP_OK);
+        TEST_CHECK(bw_disp_refresh(canvas) == ESP_OK);
+        int diff = 0;
+        for (int y = 0; y < TEST_PANEL_HEIGHT; y++)
+        {
+            for (int x = 0; x < TEST_PANEL_WIDTH; x++)
+            {
+                bw_disp_clr_t c;
+                bw_disp_get_pixel(canvas, vx + x, vy + y, &c);
+                diff += (test_panel_pixel(disp_proto_sim_get_state(proto), x, y) != (c == BWDC_WHITE));
+            }
+        }
+        TEST_CHECK(diff == 0);
+    }
+    free(img);
+    bw_disp_close(canvas);
+    bw_disp_close(disp);
+}
+
+// Parts of a compressed image wider than a decoded chunk are drawn as the raw image is
+static void test_rle_wide(void)
+{
+    bw_disp_handle_t disp = bw_disp_init(disp_proto_init_sim(), BWD_SH1106_128X64);
+    bw_disp_handle_t raw_canvas = bw_disp_canvas_create(disp, 500, 80);
+    bw_disp_handle_t rle_canvas = bw_disp_canvas_create(disp, 500, 80);
+    TEST_CHECK(disp != 0 && raw_canvas != 0 && rle_canvas != 0);
+    // runs of all token types and literals
+    bw_image_t *img = test_random_image(450, 37);
+    for (int i = 0; i < 450 * 5; i++)
+    {
+        uint32_t r = test_rand() % 4;
+        img->image[i] = (r == 0) ? 0x00 : (r == 1) ? 0xFF : (r == 2 && i > 0) ? img->image[i - 1] : img->image[i];
+    }
+    bw_image_t *cimg = bw_image_compress(img);
+    TEST_CHECK(cimg != NULL);
+    for (int i = 0; i < TEST_ROUNDS; i++)
+    {
+        uint16_t ix = test_rand() % 450;
+        uint16_t iy = test_rand() % 37;
+        uint16_t iw = 1 + test_rand() % (450 - ix);
+        uint16_t ih = 1 + test_rand() % (37 - iy);
+        uint16_t x = test_rand() % 50;
+        uint16_t y = test_rand() % 40;
+        bw_disp_img_draw_mode_t mode = (bw_disp_img_draw_mode_t) (test_rand() % 3);
+        bool inv = test_rand() & 1;
+        bw_disp_image_sel_ex(raw_canvas, x, y, ix, iy, iw, ih, inv, mode, img);
+        bw_disp_image_sel_ex(rle_canvas, x, y, ix, iy, iw, ih, inv, mode, cimg);
+        TEST_CHECK(memcmp(bw_disp_get_canvas_image(raw_canvas)->image, bw_disp_get_canvas_image(rle_canvas)->image, 500 * 10) == 0);
+    }
+    free(cimg);
+    free(img);
+    bw_disp_close(rle_canvas);
+    bw_disp_close(raw_canvas);
+    bw_disp_close(disp);
+}
+
+/** Size of the asset pack buffer of the asset test */
+#define TEST_PACK_SIZE 4096
+
+static void test_wr32(uint8_t *p, uint32_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = v >> 24;
+}
+
+// Opens a pack with a single asset (id 0) of the given type and payload
+static bool test_open_pack(uint32_t *pack, uint8_t type, const void *payload, uint32_t size, bw_asset_pack_t *view)
+{
+    uint8_t *p = (uint8_t *) pack;
+    uint32_t offset = 16 + 32 + 2;
+    offset = (offset + 3) & ~3U;
+    memset(p, 0, offset);
+    memcpy(p, "BWAP", 4);
+    p[4] = 1;       // version
+    p[6] = 1;       // entries
+    p[8] = 1;       // hash table size
+    test_wr32(&(p[12]), offset + size);
+    p[16] = 'a';
+    p[16 + 20] = type;
+    test_wr32(&(p[16 + 24]), offset);
+    test_wr32(&(p[16 + 28]), size);
+    memcpy(&(p[offset]), payload, size);
+    return bw_asset_pack_open_mem(pack, offset + size, view) == ESP_OK;
+}
+
+// Assets with contents reaching past their payload are rejected
+static void test_asset_bounds(void)
+{
+    static uint32_t pack[TEST_PACK_SIZE / 4];
+    uint8_t payload[1024];
+    bw_asset_pack_t view;
+    bw_font_t font;
+    // raw image: 20x12 needs 2 pages of 20 bytes
+    bw_image_t *img = test_random_image(20, 12);
+    TEST_CHECK(test_open_pack(pack, BWAT_IMAGE, img, 5 + 40, &view) && bw_asset_image(&view, 0) != NULL);
+    TEST_CHECK(test_open_pack(pack, BWAT_IMAGE, img, 5 + 39, &view) && bw_asset_image(&view, 0) == NULL);
+    free(img);
+    // compressed image: the row table and the rows have to fit
+    img = test_random_image(150, 30);
+    bw_image_t *cimg = bw_image_compress(img);
+    TEST_CHECK(cimg != NULL);
+    uint32_t size = 5 + bw_image_data_size(cimg);
+    TEST_CHECK(size <= sizeof(payload));
+    TEST_CHECK(test_open_pack(pack, BWAT_IMAGE, cimg, size, &view) && bw_asset_image(&view, 0) != NULL);
+    TEST_CHECK(test_open_pack(pack, BWAT_IMAGE, cimg, size - 1, &view) && bw_asset_image(&view, 0) == NULL);
+    TEST_CHECK(test_open_pack(pack, BWAT_IMAGE, cimg, 5 + 6, &view) && bw_asset_image(&view, 0) == NULL);
+    memcpy(payload, cimg, size);
+    payload[5 + 3] = 0xF0;  // offset of the second page row (high byte)
+    TEST_CHECK(test_open_pack(pack, BWAT_IMAGE, payload, size, &view) && bw_asset_image(&view, 0) == NULL);
+    free(cimg);
+    free(img);
+    // fixed font: 3 glyphs of 6 columns, 2 pages each
+    memset(payload, 0x55, sizeof(payload));
+    memset(payload, 0, 24);
+    payload[0] = 10;
+    payload[1] = 6;
+    test_wr32(&(payload[4]), 'A');
+    payload[8] = 3;
+    test_wr32(&(payload[12]), 'A');
+    test_wr32(&(payload[20]), 24);
+    TEST_CHECK(test_open_pack(pack, BWAT_FONT, payload, 24 + 36, &view) && bw_asset_font(&view, 0, &font) == ESP_OK);
+    TEST_CHECK(test_open_pack(pack, BWAT_FONT, payload, 24 + 35, &view) && bw_asset_font(&view, 0, &font) != ESP_OK);
+    // proportional font: glyph table at 24, bitmap at 36 (glyphs 0 - 4 columns at 0, 1 - 5 columns at 8, 2 - 1 column at 18)
+    payload[1] = 0;
+    test_wr32(&(payload[16]), 24);
+    test_wr32(&(payload[20]), 36);
+    const uint8_t glyphs[12] = { 4, 5, 0, 0, 5, 6, 8, 0, 1, 2, 18, 0 };
+    memcpy(&(payload[24]), glyphs, sizeof(glyphs));
+    TEST_CHECK(test_open_pack(pack, BWAT_FONT, payload, 36 + 20, &view) && bw_asset_font(&view, 0, &font) == ESP_OK);
+    TEST_CHECK(test_open_pack(pack, BWAT_FONT, payload, 36 + 19, &view) && bw_asset_font(&view, 0, &font) != ESP_OK);
+    payload[8] = 100;       // glyph table past the payload
+    TEST_CHECK(test_open_pack(pack, BWAT_FONT, payload, 36 + 20, &view) && bw_asset_font(&view, 0, &font) != ESP_OK);
+    payload[8] = 3;
+    test_wr32(&(payload[20]), 5000);     // bitmap past the payload
+    TEST_CHECK(test_open_pack(pack, BWAT_FONT, payload, 36 + 20, &view) && bw_asset_font(&view, 0, &font) != ESP_OK);
+}
+
+typedef struct
+{
+    bw_disp_handle_t disp;
+    esp_err_t ret;
+} test_thread_arg_t;
+
+// Fills the display from another thread (blocks while the display is locked)
+static void *test_fill_thread(void *arg)
+{
+    test_thread_arg_t *fill = arg;
+    fill->ret = bw_disp_fill(fill->disp, BWDC_WHITE);
+    return NULL;
+}
+
+// Closing a display wakes up the tasks waiting for its lock, the slot can be used again
+static void test_close_while_locked(void)
+{
+    bw_disp_handle_t disp = bw_disp_init(disp_proto_init_sim(), BWD_SH1106_128X64);
+    TEST_CHECK(disp != 0);
+    TEST_CHECK(bw_disp_lock(disp) == ESP_OK);
+    TEST_CHECK(bw_disp_lock(disp) == ESP_OK);
+    test_thread_arg_t fill = { .disp = disp, .ret = ESP_FAIL };
+    pthread_t thread;
+    TEST_CHECK(pthread_create(&thread, NULL, test_fill_thread, &fill) == 0);
+    usleep(50000);
+    bw_disp_close(disp);
+    pthread_join(thread, NULL);
+    TEST_CHECK(fill.ret == ESP_ERR_INVALID_ARG);
+    TEST_CHECK(bw_disp_fill(disp, BWDC_WHITE) == ESP_ERR_INVALID_ARG);
+    // the new display gets the same slot (and its lock), which must not be held any more
+    bw_disp_handle_t disp2 = bw_disp_init(disp_proto_init_sim(), BWD_SH1106_128X64);
+    TEST_CHECK(disp2 != 0 && disp2 != disp);
+    fill.disp = disp2;
+    fill.ret = ESP_FAIL;
+    TEST_CHECK(pthread_create(&thread, NULL, test_fill_thread, &fill) == 0);
+    pthread_join(thread, NULL);
+    TEST_CHECK(fill.ret == ESP_OK);
+    bw_disp_close(disp2);
+}
+
+// Refreshes the display from another thread
+static void *test_refresh_thread(void *arg)
+{
+    test_thread_arg_t *refresh = arg;
+    refresh->ret = bw_disp_refresh(refresh->disp);
+    return NULL;
+}
+
+// Other tasks can draw while an asynchronous refresh is being waited for
+static void test_draw_during_refresh(void)
+{
+    disp_proto_handle_t proto = disp_proto_init_sim();
+    bw_disp_handle_t disp = bw_disp_init(proto, BWD_SH1106_128X64);
+    TEST_CHECK(disp != 0);
+    TEST_CHECK(bw_disp_start_async(disp, 5, tskNO_AFFINITY) == ESP_OK);
+    TEST_CHECK(disp_proto_sim_set_transfer_delay(proto, pdMS_TO_TICKS(200)) == ESP_OK);
+    TEST_CHECK(bw_disp_fill(disp, BWDC_WHITE) == ESP_OK);
+    test_thread_arg_t refresh = { .disp = disp, .ret = ESP_FAIL };
+    pthread_t thread;
+    TEST_CHECK(pthread_create(&thread, NULL, test_refresh_thread, &refresh) == 0);
+    usleep(20000);
+    TickType_t start = xTaskGetTickCount();
+    TEST_CHECK(bw_disp_fill_rect(disp, 10, 10, 30, 20, BWDC_BLACK) == ESP_OK);
+    // drawing does not wait for the frame being sent
+    TEST_CHECK(xTaskGetTickCount() - start < pdMS_TO_TICKS(100));
+    pthread_join(thread, NULL);
+    TEST_CHECK(refresh.ret == ESP_OK);
+    TEST_CHECK(disp_proto_sim_set_transfer_delay(proto, 0) == ESP_OK);
+    TEST_CHECK(bw_disp_refresh(disp) == ESP_OK);
+    TEST_CHECK(test_compare(disp, proto, BWD_ROTATE_0) == 0);
+    // the refresh task is stopped while a task still waits for the frame
+    TEST_CHECK(disp_proto_sim_set_transfer_delay(proto, pdMS_TO_TICKS(100)) == ESP_OK);
+    TEST_CHECK(bw_disp_fill(disp, BWDC_BLACK) == ESP_OK);
+    refresh.ret = ESP_FAIL;
+    TEST_CHECK(pthread_create(&thread, NULL, test_refresh_thread, &refresh) == 0);
+    usleep(20000);
+    TEST_CHECK(bw_disp_close(disp) == ESP_OK);
+    pthread_join(thread, NULL);
+    TEST_CHECK(refresh.ret == ESP_OK);
+}
+
+int main(int argc, char *argv[])
+{
+    esp_log_level_set("*", ESP_LOG_NONE);
+    static const bw_disp_rotation_t rotations[] = { BWD_ROTATE_0, BWD_ROTATE_90, BWD_ROTATE_180, BWD_ROTATE_270 };
+    for (int async = 0; async < 2; async++)
+    {
+        for (int r = 0; r < sizeof(rotations) / sizeof(rotations[0]); r++)
+        {
+            test_refresh_mode(BWDR_DIRTY, async, rotations[r]);
+            test_refresh_mode(BWDR_DIFF, async, rotations[r]);
+        }
+    }
+    test_diff_enable_dirty();
+    test_sprite_order();
+    test_tall_canvas();
+    test_rle_wide();
+    test_asset_bounds();
+    test_close_while_locked();
+    test_draw_during_refresh();
+    if (s_test_failures != 0)
+    {
+        printf("%d check(s) failed\n", s_test_failures);
+        return 1;
+    }
+    printf("All tests passed\n");
+    return 0;
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "freertos/FreeRTOS.h"
 #include "disp_proto.h"
 
 #ifdef __cplusplus
@@ -32,6 +33,14 @@ extern "C" {
 #define BWD_CMD_SET_COL_ADDR_LO             0x00
 #define BWD_CMD_SET_COL_ADDR_HI             0x10
 
+/** Maximum number of commands needed to set page and column address */
+#define BWD_PAGE_COL_CMD_MAX_LEN            4
+/** Maximum number of commands needed to mirror the display */
+#define BWD_FLIP_CMD_MAX_LEN                2
+
+/** Maximum number of pages of a panel (canvases and rotated displays are sized separately) */
+#define BWD_MAX_PAGE_NUM                    8
+
 typedef enum
 {
     BWD_SH1106_128X64
@@ -50,6 +59,20 @@ typedef enum
     BWDM_ADD_BLACK
 } bw_disp_img_draw_mode_t;
 
+typedef enum
+{
+    BWDR_DIRTY,     ///< Refresh sends whole dirty column span of each page
+    BWDR_DIFF       ///< Refresh sends only bytes that differ from the last content sent to the display
+} bw_disp_refresh_mode_t;
+
+typedef enum
+{
+    BWD_ROTATE_0,   ///< Default orientation
+    BWD_ROTATE_90,  ///< Content rotated clockwise by 90 degrees (width and height swapped)
+    BWD_ROTATE_180, ///< Content rotated by 180 degrees
+    BWD_ROTATE_270  ///< Content rotated clockwise by 270 degrees (width and height swapped)
+} bw_disp_rotation_t;
+
 typedef struct 
 {
     size_t sz;
@@ -60,7 +83,7 @@ typedef struct
 {
     uint16_t width;
     uint16_t height;
-    uint8_t page_num;
+    uint16_t page_num;
     uint16_t first_col;
     uint8_t max_contrast;
 
@@ -68,24 +91,175 @@ typedef struct
     buf_sz_t close_commands;
     
     esp_err_t (*set_page_col)(disp_proto_handle_t conn_handle, uint8_t page, uint16_t col);
+    int (*page_col_commands)(uint8_t page, uint16_t col, uint8_t commands[]);  ///< Stores page/column address commands, returns their number
+    int (*flip_commands)(bool flip_x, bool flip_y, uint8_t commands[]);         ///< Stores commands mirroring the display (relative to the init commands), returns their number
 } bw_disp_if_t; ///< Display interface type
 
+typedef enum
+{
+    BWIF_RAW,       ///< Raw page-major bytes
+    BWIF_RLE        ///< Run-length encoded page-major bytes (see bw_image_compress)
+} bw_image_format_t;
+
 typedef struct
 {
     uint16_t width;
     uint16_t height;
+    uint8_t format;     ///< Image data format (bw_image_format_t)
     uint8_t image[];
 } bw_image_t; ///< Black & white image type
 
+/** @brief Row-major bitmap, 1 bit per pixel (XBM and PBM data, generated QR codes, camera thumbnails). 
+ *  Converted to page-major layout by bw_image_from_bitmap or drawn directly by bw_disp_bitmap*. */
+typedef struct
+{
+    uint16_t width;
+    uint16_t height;
+    uint16_t stride;        ///< Bytes per row (0 - rows are packed: (width + 7) / 8 bytes)
+    bool msb_first;         ///< Leftmost pixel of a byte is its most significant bit (PBM); the least significant one otherwise (XBM)
+    const uint8_t *data;    ///< Rows of the bitmap
+} bw_bitmap_t;
+
+/** @brief Image with pre-shifted variants, blitted at any y without shifting. Variant i is the image
+ *  shifted down by i rows within its pages; all variants share a single allocation. */
+typedef struct
+{
+    uint16_t width;             ///< Image width
+    uint16_t height;            ///< Image height
+    size_t size;                ///< Size of the allocation
+    bw_image_t *variants[8];    ///< Image shifted down by i rows (NULL if not prepared)
+} bw_prepared_image_t;
+
 
 typedef uint16_t bw_disp_handle_t; ///< Handle to a display
 
+typedef struct
+{
+    uint16_t x;
+    uint16_t y;
+} bw_disp_point_t; ///< Point on a display
+
+typedef struct
+{
+    uint16_t x0;    ///< First column
+    uint16_t x1;    ///< Last column (the span is empty if x0 > x1)
+} bw_disp_span_t; ///< Column span of a single page
+
+/** @brief Drawing primitives counted by the performance counters. 
+ *  Every call counts once; calls made by other drawing functions count as well (bw_disp_rect draws four lines, 
+ *  text is drawn glyph by glyph as images). */
+typedef enum
+{
+    BWDP_FILL,      ///< bw_disp_fill, bw_disp_clear
+    BWDP_PIXEL,     ///< bw_disp_set_pixel, bw_disp_set_pixels
+    BWDP_LINE,      ///< bw_disp_hline, bw_disp_vline, bw_disp_line
+    BWDP_RECT,      ///< bw_disp_rect, bw_disp_fill_rect
+    BWDP_CIRCLE,    ///< bw_disp_circle, bw_disp_fill_circle, bw_disp_arc
+    BWDP_POLYGON,   ///< bw_disp_polygon, bw_disp_fill_polygon
+    BWDP_IMAGE,     ///< Image blits (bw_disp_image*, bw_disp_prepared_image and bw_disp_bitmap*)
+    BWDP_TEXT,      ///< Text (bw_disp_text*)
+    BWDP_NUM        ///< Number of primitives
+} bw_disp_prim_t;
+
+/** @brief Performance counters of a display.
+ *  Collected only if the component is built with BW_DISP_STATS (e.g. idf.py -DBW_DISP_STATS=1 build). */
+typedef struct
+{
+    uint32_t refreshes;                     ///< Number of frames sent (refreshes of a display with dirty areas)
+    uint32_t refresh_errors;                ///< Number of failed refreshes
+    uint32_t transfers;                     ///< Number of batched transfers
+    uint32_t pages;                         ///< Number of pages sent (every frame counts each page once)
+    uint32_t runs;                          ///< Number of column runs sent (each with its own addressing)
+    uint32_t columns;                       ///< Number of columns (data bytes) sent
+    uint32_t command_bytes;                 ///< Number of addressing command bytes sent
+    uint32_t primitives[BWDP_NUM];          ///< Number of drawing function calls, by primitive
+    disp_latency_stats_t refresh_latency;   ///< Time of sending a frame (by bw_disp_refresh or by the refresh task)
+} bw_disp_stats_t;
+
+/** @brief Drawing surface of a display: page-major buffer and "dirty" column span of each page.
+ *  Obtained once with bw_disp_get_surface, then used by the inline bw_disp_surface_* operations,
+ *  which skip the handle lookup and locking (hold bw_disp_lock if other tasks draw to the display as well).
+ *  The buffer mirrors the display RAM, which is a ring when the display is scrolled (bw_disp_scroll):
+ *  row y is stored in buffer row bw_disp_surface_row(s, y). Surface stays valid until the display is closed. */
+typedef struct
+{
+    uint16_t width;             ///< Width in pixels
+    uint16_t height;            ///< Height in pixels
+    uint16_t page_num;          ///< Number of pages
+    uint16_t scroll;            ///< Buffer row of row 0 (0 unless the display is scrolled)
+    uint8_t* buffer;            ///< Display buffer (byte of column x in buffer page p is at p * width + x)
+    bw_disp_span_t* dirty;      ///< "Dirty" column span of each buffer page
+} bw_disp_surface_t;
+
 
 bw_disp_handle_t bw_disp_init(disp_proto_handle_t conn_handle, bw_disp_type_t disp_type);
+/** @brief Closes the display (stopping its refresh task first). Tasks waiting for its lock meanwhile get an error
+ *  (invalid handle). A lock held by the calling task with bw_disp_lock is released as well. */
+esp_err_t bw_disp_close(bw_disp_handle_t handle);
+
+/** @brief Locks the display for the calling task (the lock is recursive).
+ *  Drawing functions lock the display themselves, so several tasks can draw to it; an explicit lock makes 
+ *  a sequence of operations atomic, protects direct surface access, and makes the nested locking nearly free. */
+esp_err_t bw_disp_lock(bw_disp_handle_t handle);
+/** @brief Unlocks the display locked with bw_disp_lock */
+esp_err_t bw_disp_unlock(bw_disp_handle_t handle);
+
+/** @brief Gets snapshot of performance counters of the display 
+ *  (ESP_ERR_NOT_SUPPORTED if the component is built without BW_DISP_STATS). 
+ *  Bus counters are kept by the communication protocol (disp_proto_get_stats). */
+esp_err_t bw_disp_get_stats(bw_disp_handle_t handle, bw_disp_stats_t *stats);
+/** @brief Resets performance counters of the display */
+esp_err_t bw_disp_reset_stats(bw_disp_handle_t handle);
 
 esp_err_t bw_disp_clear(bw_disp_handle_t handle);
 esp_err_t bw_disp_fill(bw_disp_handle_t handle, bw_disp_clr_t c);
 esp_err_t bw_disp_refresh(bw_disp_handle_t handle);
+esp_err_t bw_disp_set_refresh_mode(bw_disp_handle_t handle, bw_disp_refresh_mode_t mode);
+/** @brief Sets rotation of the display content. 0 and 180 degrees only switch the segment remap and COM scan direction 
+ *  of the display (the buffer is kept as it is). 90 and 270 degrees swap width and height: drawing functions work 
+ *  on a rotated buffer, whose dirty 8x8 blocks are transposed into the frame sent by the refresh 
+ *  (the remaining mirroring is done by the display). Switching between the two groups clears the buffer, 
+ *  so it is meant to be done before drawing (sprites and canvases have to be created after it). 
+ *  Scrolling is supported at 0 and 180 degrees only. Cannot be changed while the refresh task is running.
+ */
+esp_err_t bw_disp_set_rotation(bw_disp_handle_t handle, bw_disp_rotation_t rotation);
+
+/** @brief Creates a canvas of the display: a drawing target larger than the display, shown through a viewport 
+ *  (at 0, 0 initially). The canvas has its own handle, accepted by all drawing functions, bw_disp_get_surface 
+ *  and sprites; drawing to it does not touch the display. bw_disp_refresh of the canvas copies to the display buffer 
+ *  only the dirty areas inside the viewport and the rows exposed by a vertical pan (the rest is moved 
+ *  with the display start line, see bw_disp_scroll), then refreshes the display. The display must not be drawn to directly while it shows a canvas, 
+ *  and the canvas must be closed (bw_disp_close) before the display.
+ *  @param disp     Display handle
+ *  @param width    Canvas width (at least the display width)
+ *  @param height   Canvas height (at least the display height, the buffer - width * pages - has to fit in 64 KiB)
+ *  @return Canvas handle or INVALID_HANDLE in case of error
+ */
+bw_disp_handle_t bw_disp_canvas_create(bw_disp_handle_t disp, uint16_t width, uint16_t height);
+/** @brief Moves viewport of the canvas to (x, y). The viewport has to fit in the canvas. 
+ *  Takes effect on the next refresh; drawing functions are not involved. */
+esp_err_t bw_disp_set_viewport(bw_disp_handle_t canvas, uint16_t x, uint16_t y);
+/** @brief Gets content of the canvas as a raw image (valid until the canvas is closed; NULL if not a canvas) */
+const bw_image_t* bw_disp_get_canvas_image(bw_disp_handle_t canvas);
+
+/** @brief Scrolls content up by rows (down if rows is negative) with the display start line. 
+ *  The buffer is not moved: it is kept as a ring and drawing functions translate rows, so only the rows exposed 
+ *  at the bottom (top) are filled with c and marked "dirty". The next refresh sends them and a single start line 
+ *  command. Sprites should be hidden while scrolling - drawn ones move with the content until the next 
+ *  bw_sprite_update. */
+esp_err_t bw_disp_scroll(bw_disp_handle_t handle, int16_t rows, bw_disp_clr_t c);
+
+/** @brief Starts refresh task of the display (pinned to core_id, or tskNO_AFFINITY). 
+ *  While it runs, bw_disp_refresh submits the frame to the task and waits for the transfer. */
+esp_err_t bw_disp_start_async(bw_disp_handle_t handle, UBaseType_t priority, BaseType_t core_id);
+/** @brief Waits for pending transfers and stops refresh task of the display */
+esp_err_t bw_disp_stop_async(bw_disp_handle_t handle);
+/** @brief Submits the current frame to the refresh task and returns without waiting for the transfer. 
+ *  Drawing can continue right away. Frames submitted during a transfer are coalesced into the next one. */
+esp_err_t bw_disp_refresh_async(bw_disp_handle_t handle);
+/** @brief Waits until all submitted frames are sent. Returns the error of a failed transfer, if any.
+ *  The display is not locked while waiting - other tasks can draw meanwhile. */
+esp_err_t bw_disp_refresh_wait(bw_disp_handle_t handle, TickType_t timeout);
 esp_err_t bw_disp_set_pixel(bw_disp_handle_t handle, uint16_t x, uint16_t y, bw_disp_clr_t c);
 esp_err_t bw_disp_get_pixel(bw_disp_handle_t handle, uint16_t x, uint16_t y, bw_disp_clr_t *cptr);
 
@@ -94,14 +268,156 @@ esp_err_t bw_disp_hline(bw_disp_handle_t handle, uint16_t x, uint16_t y, uint16_
 esp_err_t bw_disp_rect(bw_disp_handle_t handle, uint16_t x, uint16_t y, uint16_t w, uint16_t h, bw_disp_clr_t c);
 esp_err_t bw_disp_fill_rect(bw_disp_handle_t handle, uint16_t x, uint16_t y, uint16_t w, uint16_t h, bw_disp_clr_t c);
 
+/** Maximum number of polygon points */
+#define BWD_POLYGON_MAX_POINTS 16
+
+/** @brief Draws line from (x0, y0) to (x1, y1), both ends included. Shapes are clipped to the display. */
+esp_err_t bw_disp_line(bw_disp_handle_t handle, uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, bw_disp_clr_t c);
+/** @brief Draws circle with centre (cx, cy) and radius r */
+esp_err_t bw_disp_circle(bw_disp_handle_t handle, uint16_t cx, uint16_t cy, uint16_t r, bw_disp_clr_t c);
+/** @brief Draws filled circle with centre (cx, cy) and radius r */
+esp_err_t bw_disp_fill_circle(bw_disp_handle_t handle, uint16_t cx, uint16_t cy, uint16_t r, bw_disp_clr_t c);
+/** @brief Draws arc of a circle starting at start_angle and spanning sweep degrees. 
+ *  Angles are measured clockwise from 3 o'clock; negative sweep goes anticlockwise. */
+esp_err_t bw_disp_arc(bw_disp_handle_t handle, uint16_t cx, uint16_t cy, uint16_t r, int16_t start_angle, int16_t sweep, bw_disp_clr_t c);
+/** @brief Draws closed polygon outline of n points (at most BWD_POLYGON_MAX_POINTS) */
+esp_err_t bw_disp_polygon(bw_disp_handle_t handle, const bw_disp_point_t points[], int n, bw_disp_clr_t c);
+/** @brief Fills polygon of n points (at most BWD_POLYGON_MAX_POINTS), convex or concave, with the even-odd rule.
+ *  Pixels with centres inside the polygon are filled. */
+esp_err_t bw_disp_fill_polygon(bw_disp_handle_t handle, const bw_disp_point_t points[], int n, bw_disp_clr_t c);
+
 esp_err_t bw_disp_image(bw_disp_handle_t handle, uint16_t x, uint16_t y, bw_image_t *img);
 esp_err_t bw_disp_image_sel(bw_disp_handle_t handle, uint16_t x, uint16_t y, uint16_t ix, uint16_t iy, uint16_t iw, uint16_t ih, bw_image_t *img);
 esp_err_t bw_disp_image_sel_ex(bw_disp_handle_t handle, uint16_t x, uint16_t y, uint16_t ix, uint16_t iy, uint16_t iw, uint16_t ih, 
     bool inv_img, bw_disp_img_draw_mode_t mode, bw_image_t *img);
 
+/** @brief Compresses raw image (BWIF_RLE). Every page row is encoded separately and found through an offset table, 
+ *  so compressed images are blitted by decoding straight into the display buffer. 
+ *  Returns NULL if the image is not raw, it does not compress to less than 64 KB or allocation fails. */
+bw_image_t* bw_image_compress(const bw_image_t *img);
+/** @brief Gets size of the image data (in bytes, without the header) */
+size_t bw_image_data_size(const bw_image_t *img);
+/** @brief Checks that the image (header included) fits in size bytes, so drawing it does not read past them */
+bool bw_image_is_valid(const bw_image_t *img, size_t size);
+
+/** @brief Builds variants of the image shifted down by 0-7 rows. Bit i of shifts selects variant i (0xFF - all).
+ *  Returns NULL if allocation fails. */
+bw_prepared_image_t* bw_image_prepare(const bw_image_t *img, uint8_t shifts);
+/** @brief Frees prepared image */
+void bw_image_prepared_free(bw_prepared_image_t *pimg);
+/** @brief Draws prepared image. If the variant for y is prepared, the image is drawn with masked copies only;
+ *  otherwise another variant is shifted as with bw_disp_image_sel_ex. */
+esp_err_t bw_disp_prepared_image(bw_disp_handle_t handle, uint16_t x, uint16_t y, bool inv_img, bw_disp_img_draw_mode_t mode, 
+    const bw_prepared_image_t *pimg);
+
+/** @brief Converts row-major bitmap into raw image img (BWIF_RAW). Width and height of img have to match the bitmap 
+ *  and its data has to hold width * ((height + 7) / 8) bytes. Blocks of 8x8 pixels are transposed as 32-bit words. */
+esp_err_t bw_bitmap_convert(const bw_bitmap_t *bmp, bw_image_t *img);
+/** @brief Converts row-major bitmap into a new raw image (freed with free). Returns NULL in case of error. */
+bw_image_t* bw_image_from_bitmap(const bw_bitmap_t *bmp);
+esp_err_t bw_disp_bitmap(bw_disp_handle_t handle, uint16_t x, uint16_t y, const bw_bitmap_t *bmp);
+/** @brief Draws part of the row-major bitmap as bw_disp_image_sel_ex draws an image. Pixels are transposed 
+ *  in 8x8 blocks into a small buffer on the stack and drawn from there - nothing is allocated. */
+esp_err_t bw_disp_bitmap_sel_ex(bw_disp_handle_t handle, uint16_t x, uint16_t y, uint16_t ix, uint16_t iy, uint16_t iw, uint16_t ih, 
+    bool inv_img, bw_disp_img_draw_mode_t mode, const bw_bitmap_t *bmp);
+
 uint16_t bw_disp_get_width(bw_disp_handle_t handle);
 uint16_t bw_disp_get_height(bw_disp_handle_t handle);
 
+/** @brief Sets n pixels to the same colour. Dirty spans are updated once for the whole batch. 
+ *  Points outside of the display are skipped (ESP_ERR_INVALID_ARG is returned after drawing the rest). */
+esp_err_t bw_disp_set_pixels(bw_disp_handle_t handle, const bw_disp_point_t points[], int n, bw_disp_clr_t c);
+
+/** @brief Gets drawing surface of the display (NULL if the handle is invalid) */
+bw_disp_surface_t* bw_disp_get_surface(bw_disp_handle_t handle);
+
+/** @brief Gets buffer row of row y (y < height) */
+static inline uint16_t bw_disp_surface_row(const bw_disp_surface_t *s, uint16_t y)
+{
+    uint16_t row = y + s->scroll;
+    return (row >= s->height) ? row - s->height : row;
+}
+
+/** @brief Marks columns x0..x1 of the buffer page as "dirty" */
+static inline void bw_disp_surface_mark_dirty(bw_disp_surface_t *s, int page, uint16_t x0, uint16_t x1)
+{
+    bw_disp_span_t *span = &(s->dirty[page]);
+    if (x0 < span->x0)
+    {
+        span->x0 = x0;
+    }
+    if (x1 > span->x1)
+    {
+        span->x1 = x1;
+    }
+}
+
+/** @brief Sets pixel (pixels outside of the surface are ignored) */
+static inline void bw_disp_surface_set_pixel(bw_disp_surface_t *s, uint16_t x, uint16_t y, bw_disp_clr_t c)
+{
+    if (x >= s->width || y >= s->height)
+    {
+        return;
+    }
+    y = bw_disp_surface_row(s, y);
+    int page = y >> 3;
+    uint8_t *p = &(s->buffer[page * s->width + x]);
+    uint8_t y_bit = 1 << (y & 0x07);
+    if (c == BWDC_BLACK)
+    {
+        *p &= ~y_bit;
+    }
+    else
+    {
+        *p |= y_bit;
+    }
+    bw_disp_surface_mark_dirty(s, page, x, x);
+}
+
+/** @brief Gets pixel (pixels outside of the surface are black) */
+static inline bw_disp_clr_t bw_disp_surface_get_pixel(const bw_disp_surface_t *s, uint16_t x, uint16_t y)
+{
+    if (x >= s->width || y >= s->height)
+    {
+        return BWDC_BLACK;
+    }
+    y = bw_disp_surface_row(s, y);
+    return (s->buffer[(y >> 3) * s->width + x] & (1 << (y & 0x07))) ? BWDC_WHITE : BWDC_BLACK;
+}
+
+/** @brief Sets horizontal span of w pixels starting at (x, y) (clipped to the surface) */
+static inline void bw_disp_surface_span(bw_disp_surface_t *s, uint16_t x, uint16_t y, uint16_t w, bw_disp_clr_t c)
+{
+    if (x >= s->width || y >= s->height || w == 0)
+    {
+        return;
+    }
+    if (w > s->width - x)
+    {
+        w = s->width - x;
+    }
+    y = bw_disp_surface_row(s, y);
+    int page = y >> 3;
+    uint8_t *p = &(s->buffer[page * s->width + x]);
+    uint8_t *p_e = p + w;
+    uint8_t y_bit = 1 << (y & 0x07);
+    if (c == BWDC_BLACK)
+    {
+        for (y_bit = ~y_bit; p < p_e; p++)
+        {
+            *p &= y_bit;
+        }
+    }
+    else
+    {
+        for (; p < p_e; p++)
+        {
+            *p |= y_bit;
+        }
+    }
+    bw_disp_surface_mark_dirty(s, page, x, x + w - 1);
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "bw_disp.h"
+#include "bw_disp_font.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @file
+ *  Asset pack: read-only container of named images and fonts, built by tools/bw_asset_pack.py.
+ *  The pack is used in place (memory-mapped flash partition or file); images are returned as pointers
+ *  into it and blitted by the image routines without copying.
+ *
+ *  Layout (little endian, payloads 4-byte aligned):
+ *  - header: "BWAP", version (u16), entry number (u16), hash table size (u16, power of 2), reserved (u16), pack size (u32)
+ *  - entries: name (20 bytes, NUL padded), type (u8), reserved (3 bytes), payload offset (u32), payload size (u32)
+ *  - hash table: u16 entry number + 1 for FNV-1a hash of the name, linear probing (0 - empty slot)
+ *  - payloads: images in bw_image_t layout; fonts as a font header, bw_glyph_t table and page-major bitmap
+ */
+
+/** Maximum length of an asset name */
+#define BWA_NAME_MAX_LEN 19
+
+typedef enum
+{
+    BWAT_NONE,      ///< No asset
+    BWAT_IMAGE,     ///< Image (bw_image_t)
+    BWAT_FONT       ///< Font (bw_font_t)
+} bw_asset_type_t;
+
+typedef struct
+{
+    const uint8_t *data;    ///< Pack data
+    size_t size;            ///< Pack size
+    uint16_t entry_num;     ///< Number of assets
+    uint16_t hash_size;     ///< Size of the name hash table
+    void *map_handle;       ///< Mapping to release on close (NULL for packs in memory)
+} bw_asset_pack_t; ///< Asset pack view
+
+/** @brief Opens pack already in memory (e.g. embedded in the firmware). Data must stay valid and 4-byte aligned. */
+esp_err_t bw_asset_pack_open_mem(const void *data, size_t size, bw_asset_pack_t *pack);
+#ifdef ESP_PLATFORM
+/** @brief Opens pack stored in a data partition, memory-mapping it */
+esp_err_t bw_asset_pack_open_partition(const char *label, bw_asset_pack_t *pack);
+#else
+/** @brief Opens pack file, memory-mapping it */
+esp_err_t bw_asset_pack_open_file(const char *path, bw_asset_pack_t *pack);
+#endif
+/** @brief Closes pack, releasing its mapping. Assets of the pack must not be used afterwards. */
+void bw_asset_pack_close(bw_asset_pack_t *pack);
+
+/** @brief Finds asset by name, returns its id (-1 if not found). Ids are also generated by the pack builder. */
+int bw_asset_find(const bw_asset_pack_t *pack, const char *name);
+/** @brief Gets type of the asset */
+bw_asset_type_t bw_asset_get_type(const bw_asset_pack_t *pack, int id);
+/** @brief Gets image asset (pointer into the pack, read-only), NULL if the id is not an image or its data does not fit in the payload */
+bw_image_t* bw_asset_image(const bw_asset_pack_t *pack, int id);
+/** @brief Fills font descriptor of the font asset; its glyphs and bitmap point into the pack (ESP_ERR_INVALID_SIZE if they do not fit in the payload) */
+esp_err_t bw_asset_font(const bw_asset_pack_t *pack, int id, bw_font_t *font);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "bw_disp.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @file */
+
+typedef struct
+{
+    uint8_t width;      ///< Glyph width (number of bitmap columns)
+    uint8_t advance;    ///< Horizontal advance (width and spacing after the glyph)
+    uint16_t offset;    ///< Offset of the glyph bitmap in the font bitmap
+} bw_glyph_t; ///< Glyph of a proportional font
+
+/** @brief Bitmap font. Glyph bitmaps are stored page-major, like bw_image_t: (height + 7) / 8 pages
+ *  of width bytes each. Font covers a single range of code points; others are drawn as default_char. */
+typedef struct
+{
+    uint8_t height;             ///< Glyph height in pixels
+    uint8_t width;              ///< Glyph width of a fixed font (0 for a proportional font)
+    uint8_t spacing;            ///< Columns after each glyph of a fixed font
+    uint32_t first_char;        ///< First code point
+    uint16_t char_num;          ///< Number of code points
+    uint32_t default_char;      ///< Code point drawn in place of the ones not in the font
+    const bw_glyph_t *glyphs;   ///< Glyphs of a proportional font (NULL for a fixed font)
+    const uint8_t *bitmap;      ///< Glyph bitmaps (for a fixed font glyph i is at i * width * pages)
+} bw_font_t;
+
+extern const bw_font_t bw_font_6x8;    ///< Fixed 5x7 font in 6x8 cells (ASCII 0x20-0x7E)
+
+/** @brief Gets glyph height of the font */
+uint16_t bw_font_get_height(const bw_font_t *font);
+/** @brief Gets width of UTF-8 text drawn with the font */
+uint16_t bw_font_text_width(const bw_font_t *font, const char *text);
+
+/** @brief Frees cached glyphs. Needed before a font that was drawn is modified or freed. */
+void bw_font_cache_clear(void);
+
+/** @brief Draws UTF-8 text in colour c with transparent background, glyph tops at row y.
+ *  Text is clipped at the display edge. */
+esp_err_t bw_disp_text(bw_disp_handle_t handle, uint16_t x, uint16_t y, const bw_font_t *font, const char *text, bw_disp_clr_t c);
+/** @brief Draws UTF-8 text clipped to max_w columns. Glyphs are drawn as images (with inv_img and mode,
+ *  spacing columns included). Pre-shifted glyphs are cached, so text is drawn with whole-byte operations
+ *  at any y. If wptr is not NULL, width of the drawn text is stored there. */
+esp_err_t bw_disp_text_ex(bw_disp_handle_t handle, uint16_t x, uint16_t y, uint16_t max_w, const bw_font_t *font, const char *text,
+    bool inv_img, bw_disp_img_draw_mode_t mode, uint16_t *wptr);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "bw_disp.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @file */
+
+typedef uint16_t bw_sprite_handle_t; ///< Handle to a sprite
+
+/** @brief Creates a hidden sprite showing the image on the display. Sprites with higher z are drawn on top;
+ *  sprites with equal z are drawn in the order of creation. The image is not copied and must stay valid. */
+bw_sprite_handle_t bw_sprite_create(bw_disp_handle_t disp, bw_image_t *img, bw_disp_img_draw_mode_t mode, int16_t z);
+/** @brief Removes the sprite from the display (restoring the background under it) and deletes it.
+ *  Sprites must be deleted before their display is closed. */
+esp_err_t bw_sprite_delete(bw_sprite_handle_t handle);
+
+/** @brief Moves the sprite. Takes effect on the next bw_sprite_update. */
+esp_err_t bw_sprite_move(bw_sprite_handle_t handle, uint16_t x, uint16_t y);
+/** @brief Shows or hides the sprite. Takes effect on the next bw_sprite_update. */
+esp_err_t bw_sprite_show(bw_sprite_handle_t handle, bool visible);
+/** @brief Changes z-order of the sprite. Takes effect on the next bw_sprite_update. */
+esp_err_t bw_sprite_set_z(bw_sprite_handle_t handle, int16_t z);
+/** @brief Changes image of the sprite. Takes effect on the next bw_sprite_update. */
+esp_err_t bw_sprite_set_image(bw_sprite_handle_t handle, bw_image_t *img);
+
+/** @brief Draws the sprite from pre-shifted variants of its image (see bw_image_prepare; 0 - not prepared).
+ *  Variants are rebuilt when the image changes. */
+esp_err_t bw_sprite_prepare(bw_sprite_handle_t handle, uint8_t shifts);
+
+/** @brief Applies pending sprite changes to the display buffer.
+ *  Changed sprites are taken off (the background saved under them is restored), then drawn at their new positions,
+ *  saving the background again. Only the old and new footprints of changed sprites are marked "dirty".
+ *  The background under a drawn sprite should not be drawn over; hide the sprite first. */
+esp_err_t bw_sprite_update(bw_disp_handle_t disp);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stdio.h>
+#include "bw_disp.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @file
+ *  Operation trace: ring buffer of timestamped events recorded by drawing primitives, refreshes (whole frames and
+ *  single pages) and protocol writes. Collected only if the component is built with BW_DISP_TRACE
+ *  (e.g. idf.py -DBW_DISP_TRACE=1 build) and recording is enabled with bw_trace_enable; otherwise the functions
+ *  do nothing (export functions return ESP_ERR_NOT_SUPPORTED).
+ *  Recording is lock-free: tasks claim ring slots with an atomic counter, the oldest events are overwritten.
+ *
+ *  Exported as Chrome trace-event JSON (chrome://tracing, Perfetto) or as a compact binary dump
+ *  converted to JSON by tools/bw_trace_convert.py. Binary layout (little endian):
+ *  - header: "BWTR", version (u16), event size (u16), event number (u32)
+ *  - events (in the order they ended - a nested operation precedes its parent): bw_trace_event_t
+ */
+
+/** Number of events kept in the trace ring buffer (default) */
+#ifndef BW_DISP_TRACE_SIZE
+#define BW_DISP_TRACE_SIZE 512
+#endif
+
+/** @brief Traced operation. Drawing primitives have the values of bw_disp_prim_t. */
+typedef enum
+{
+    BWT_FILL = BWDP_FILL,           ///< Primitives (display handle; len - number of points for pixels, bytes for text)
+    BWT_PIXEL = BWDP_PIXEL,
+    BWT_LINE = BWDP_LINE,
+    BWT_RECT = BWDP_RECT,
+    BWT_CIRCLE = BWDP_CIRCLE,
+    BWT_POLYGON = BWDP_POLYGON,
+    BWT_IMAGE = BWDP_IMAGE,
+    BWT_TEXT = BWDP_TEXT,
+    BWT_REFRESH = BWDP_NUM,         ///< Frame sent (display handle; len - number of dirty pages)
+    BWT_REFRESH_PAGE,               ///< Page of a frame prepared for sending (display handle; len - dirty columns)
+    BWT_WRITE_COMMAND,              ///< Protocol operations (protocol handle; len - bytes)
+    BWT_WRITE_COMMANDS,
+    BWT_WRITE_DATA_BYTE,
+    BWT_WRITE_DATA,
+    BWT_WRITE_SEGMENTS,
+    BWT_OP_NUM                      ///< Number of operations
+} bw_trace_op_t;
+
+/** Event flag: operation failed */
+#define BWT_FLAG_ERROR 0x01
+
+/** @brief Trace event */
+typedef struct
+{
+    uint32_t ts_us;     ///< Start time (low 32 bits of esp_timer_get_time, us)
+    uint32_t dur_us;    ///< Duration (us)
+    uint32_t len;       ///< Length (meaning depends on the operation)
+    uint16_t handle;    ///< Display handle (primitives, refreshes) or communication protocol handle (writes)
+    uint8_t op;         ///< Operation (bw_trace_op_t)
+    uint8_t flags;      ///< Flags (BWT_FLAG_*)
+} bw_trace_event_t;
+
+/** @brief Enables or disables recording (disabled at startup) */
+void bw_trace_enable(bool enable);
+/** @brief Discards recorded events */
+void bw_trace_clear(void);
+/** @brief Gets name of the operation */
+const char* bw_trace_op_name(bw_trace_op_t op);
+/** @brief Copies up to max recorded events (in the order they ended), returns their number.
+ *  Events being recorded meanwhile are skipped. */
+int bw_trace_snapshot(bw_trace_event_t events[], int max);
+/** @brief Writes recorded events as Chrome trace-event JSON (a thread per display and protocol handle) */
+esp_err_t bw_trace_export_json(FILE *f);
+/** @brief Writes recorded events in the binary format (see above) */
+esp_err_t bw_trace_export_bin(FILE *f);
+
+#ifdef __cplusplus
+}
+#endif
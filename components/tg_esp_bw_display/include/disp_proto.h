@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "driver/i2c.h"
+#include "driver/spi_master.h"
 
 
 #ifdef __cplusplus
@@ -29,20 +30,65 @@ extern "C" {
 typedef enum
 {
     DP_I2C, ///< I2C communication protocol
-    DP_SPI  ///< SPI communication protocol
+    DP_SPI, ///< SPI communication protocol
+    DP_SIM  ///< Simulated display (no hardware - host builds, testing)
 } disp_proto_type_t;
 
 typedef uint16_t disp_proto_handle_t; ///< handle to a display communication protocol
 
+/** @brief Type of a transfer segment */
+typedef enum
+{
+    DPS_COMMANDS,   ///< Segment contains commands
+    DPS_DATA        ///< Segment contains data bytes
+} disp_proto_seg_type_t;
+
+/** @brief Transfer segment (a part of a batched transfer) */
+typedef struct
+{
+    disp_proto_seg_type_t type; ///< Segment type
+    int len;                    ///< Number of bytes
+    uint8_t *buf;               ///< Commands or data bytes
+} disp_proto_seg_t;
+
 /** Invalid handle */
 #define INVALID_HANDLE 0x0000
 
+/** Number of buckets of latency histograms */
+#define DISP_LATENCY_HIST_SIZE 20
+
+/** @brief Latency statistics.
+ *  Bucket 0 of the histogram counts latencies below 1 us, bucket i (i > 0) latencies from 2^(i-1) to 2^i - 1 us,
+ *  the last bucket also everything longer. */
+typedef struct
+{
+    uint32_t count;                         ///< Number of measurements
+    uint32_t min_us;                        ///< Shortest latency (us)
+    uint32_t max_us;                        ///< Longest latency (us)
+    uint64_t total_us;                      ///< Sum of latencies (us) - average is total_us / count
+    uint32_t hist[DISP_LATENCY_HIST_SIZE];  ///< Log2 histogram of latencies
+} disp_latency_stats_t;
+
+/** @brief Performance counters of a communication protocol instance.
+ *  Collected only if the component is built with BW_DISP_STATS (e.g. idf.py -DBW_DISP_STATS=1 build). */
+typedef struct
+{
+    uint32_t command_writes;            ///< Number of command writes (single commands and command blocks)
+    uint32_t command_bytes;             ///< Number of command bytes
+    uint32_t data_writes;               ///< Number of data writes (single bytes and blocks)
+    uint32_t data_bytes;                ///< Number of data bytes
+    uint32_t segment_writes;            ///< Number of batched (segment) writes; their bytes are counted as well
+    uint32_t errors;                    ///< Number of failed operations
+    disp_latency_stats_t transactions;  ///< Number and latency of bus transactions (e.g. i2c_master_cmd_begin calls)
+} disp_proto_stats_t;
+
 /** @brief Initializes display communication protocol
  *  @param proto_type        Communication protocol type
  *  @param write_command     Pointer to the write command function
  *  @param write_commands    Pointer to the write commands function
  *  @param write_data_byte   Pointer to the write data byte function
  *  @param write_data        Pointer to the write data function
+ *  @param write_segments    Pointer to the write segments function (optional - if NULL, segments are written one by one)
  *  @param close             Pointer to the close function
  *  @return
  *          - Non-zero handle if successful
@@ -53,10 +99,14 @@ disp_proto_handle_t disp_proto_init(disp_proto_type_t proto_type,
         esp_err_t (*write_commands)(disp_proto_handle_t handle, void* dp_data, uint8_t commands[], int len),
         esp_err_t (*write_data_byte)(disp_proto_handle_t handle, void* dp_data, uint8_t data),
         esp_err_t (*write_data)(disp_proto_handle_t handle, void* dp_data, uint8_t data[], int len),
+        esp_err_t (*write_segments)(disp_proto_handle_t handle, void* dp_data, disp_proto_seg_t segments[], int num),
         esp_err_t (*close)(disp_proto_handle_t handle, void* dp_data), 
         void *dp_data, int len);
 
-/** @brief Initializes I2C display communication protocol
+/** @brief Initializes I2C display communication protocol.
+ *  Several displays (with different addresses) can share a port: the first one configures the port and installs
+ *  the driver, the others must use the same pins; the driver is deleted when the last one is closed.
+ *  Displays sharing a port take turns: transactions are sent in request order and refreshes are interleaved page by page.
  *  @param port         Communication port (e.g. I2C_NUM_0)
  *  @param clock_speed  I2C clock speed (in Hz) 
  *  @param address      Display address
@@ -68,6 +118,29 @@ disp_proto_handle_t disp_proto_init(disp_proto_type_t proto_type,
  */
 disp_proto_handle_t disp_proto_init_i2c(i2c_port_t port, int clock_speed, uint8_t address, gpio_num_t sda, gpio_num_t scl);
 
+/** @brief Initializes SPI display communication protocol (4-wire: D/C line selects commands or data).
+ *  Transfers are queued and sent by DMA. The SPI bus is initialized and owned by the display.
+ *  @param host         SPI host (e.g. SPI2_HOST)
+ *  @param clock_speed  SPI clock speed (in Hz, e.g. 8000000)
+ *  @param mosi         MOSI (display SDA/DIN) GPIO pin number
+ *  @param sclk         SCLK GPIO pin number
+ *  @param cs           CS GPIO pin number (GPIO_NUM_NC if CS is tied low)
+ *  @param dc           D/C GPIO pin number
+ *  @param rst          RST GPIO pin number (GPIO_NUM_NC if not connected); the display is reset on initialization
+ *  @return
+ *          - Non-zero handle if successful
+ *          - INVALID_HANDLE in case of error
+ */
+disp_proto_handle_t disp_proto_init_spi(spi_host_device_t host, int clock_speed, gpio_num_t mosi, gpio_num_t sclk,
+    gpio_num_t cs, gpio_num_t dc, gpio_num_t rst);
+
+/** @brief Gets protocol specific data of the instance (for use by protocol implementations)
+ *  @param handle       Communication protocol handle
+ *  @param proto_type   Expected communication protocol type
+ *  @return Pointer to the data or NULL if the handle is invalid or of a different type
+ */
+void* disp_proto_get_data(disp_proto_handle_t handle, disp_proto_type_t proto_type);
+
 /** @brief Writes single command
  *  @param handle   Communication protocol handle
  *  @param cmd      Command
@@ -98,6 +171,31 @@ esp_err_t disp_proto_write_data_byte(disp_proto_handle_t handle, uint8_t data);
  */
 esp_err_t disp_proto_write_data(disp_proto_handle_t handle, uint8_t data[], int len);
 
+/** @brief Writes a batch of command and data segments (in a single transaction, if supported by the protocol)
+ *  @param handle   Communication protocol handle
+ *  @param segments Segments
+ *  @param num      Number of segments
+ *  @return ESP_OK in case of success or any other value indicating an error
+ */
+esp_err_t disp_proto_write_segments(disp_proto_handle_t handle, disp_proto_seg_t segments[], int num);
+
+/** @brief Gets snapshot of performance counters
+ *  @param handle   Communication protocol handle
+ *  @param stats    Pointer to the structure receiving the counters
+ *  @return 
+ *          - ESP_OK in case of success
+ *          - ESP_ERR_NOT_SUPPORTED if the component is built without BW_DISP_STATS
+ *          - any other value indicating an error
+ */
+esp_err_t disp_proto_get_stats(disp_proto_handle_t handle, disp_proto_stats_t *stats);
+
+/** @brief Resets performance counters
+ *  @param handle   Communication protocol handle
+ *  @return ESP_OK in case of success, ESP_ERR_NOT_SUPPORTED if the component is built without BW_DISP_STATS 
+ *          or any other value indicating an error
+ */
+esp_err_t disp_proto_reset_stats(disp_proto_handle_t handle);
+
 /** @brief Closes communication link
  *  @param handle   Communication protocol handle 
  *  @return ESP_OK in case of success or any other value indicating an error
@@ -0,0 +1,83 @@
+// simulated display protocol (host builds, testing, benchmarking)
+
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+#include "disp_proto.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @file */
+
+/** Width of the simulated display RAM (SH1106 has 132 columns) */
+#define DP_SIM_GDDRAM_WIDTH 132
+/** Number of pages of the simulated display RAM */
+#define DP_SIM_GDDRAM_PAGES 8
+
+/** @brief Bus traffic counters of the simulated protocol */
+typedef struct
+{
+    uint32_t transactions;      ///< Number of bus transactions
+    uint32_t command_bytes;     ///< Number of command bytes
+    uint32_t data_bytes;        ///< Number of data bytes
+    uint32_t wire_bytes;        ///< Number of bytes on the wire, counted as for I2C (address and control bytes included)
+} disp_proto_sim_stats_t;
+
+/** @brief State of the simulated SH1106 display controller */
+typedef struct
+{
+    uint8_t gddram[DP_SIM_GDDRAM_PAGES][DP_SIM_GDDRAM_WIDTH];  ///< Display RAM
+    uint8_t page;               ///< Current page address
+    uint8_t col;                ///< Current column address
+    uint8_t start_line;         ///< Display start line
+    uint8_t display_offset;     ///< Display offset
+    uint8_t contrast;           ///< Contrast
+    uint8_t multiplex_ratio;    ///< Multiplex ratio
+    bool display_on;            ///< Display is on
+    bool segment_remap;         ///< Segment remap is inverse (column address 131 mapped to SEG0)
+    bool com_scan_reverse;      ///< COM output scan direction is reversed
+    bool inverse;               ///< Display shows inverted RAM content
+    bool charge_pump;           ///< Charge pump (DC-DC) is on
+    uint32_t unknown_commands;  ///< Number of unsupported command bytes received
+    uint32_t overflow_bytes;    ///< Number of data bytes written past the last column
+} disp_proto_sim_state_t;
+
+/** @brief Initializes simulated display communication protocol.
+ *  All bytes sent by the driver are decoded and applied to a virtual SH1106 display RAM.
+ *  @return
+ *          - Non-zero handle if successful
+ *          - INVALID_HANDLE in case of error
+ */
+disp_proto_handle_t disp_proto_init_sim(void);
+
+/** @brief Gets state of the simulated display controller
+ *  @param handle   Communication protocol handle
+ *  @return Pointer to the state or NULL if the handle is not a valid simulated protocol handle
+ */
+const disp_proto_sim_state_t* disp_proto_sim_get_state(disp_proto_handle_t handle);
+
+/** @brief Gets bus traffic counters
+ *  @param handle   Communication protocol handle
+ *  @param stats    Pointer to the structure receiving the counters
+ *  @return ESP_OK in case of success or any other value indicating an error
+ */
+esp_err_t disp_proto_sim_get_stats(disp_proto_handle_t handle, disp_proto_sim_stats_t *stats);
+
+/** @brief Resets bus traffic counters
+ *  @param handle   Communication protocol handle
+ *  @return ESP_OK in case of success or any other value indicating an error
+ */
+esp_err_t disp_proto_sim_reset_stats(disp_proto_handle_t handle);
+
+/** @brief Sets time taken by each batched transfer (write_segments), simulating a slow bus
+ *  @param handle   Communication protocol handle
+ *  @param delay    Transfer time in ticks (0 - none)
+ *  @return ESP_OK in case of success or any other value indicating an error
+ */
+esp_err_t disp_proto_sim_set_transfer_delay(disp_proto_handle_t handle, TickType_t delay);
+
+#ifdef __cplusplus
+}
+#endif
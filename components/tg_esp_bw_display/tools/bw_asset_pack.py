@@ -0,0 +1,240 @@
+#!/usr/bin/env python3
+# bw_asset_pack.py - builds an asset pack (see bw_disp_asset.h) from PBM/PNG images
+#
+# Usage:
+#   bw_asset_pack.py -o assets.bin [-H assets.h] [--rle] [--invert]
+#       [--image NAME=FILE]... [--font NAME=FILE:WxH[:FIRST[:SPACING[:DEFAULT]]]]...
+#
+# Lit (white) pixels are 1 in PBM files and bright (>= 128) pixels in PNG files (PNG needs Pillow);
+# --invert swaps them. A font is a sheet of fixed-size cells, left to right and top to bottom,
+# starting with code point FIRST (default 0x20). --rle stores images compressed (BWIF_RLE).
+# The optional header defines ids of the assets (BWA_ID_<NAME>) for O(1) lookups without names.
+
+import argparse
+import re
+import struct
+import sys
+
+MAGIC = b'BWAP'
+VERSION = 1
+HEADER_SIZE = 16
+ENTRY_SIZE = 32
+NAME_MAX_LEN = 19
+FONT_HEADER_SIZE = 24
+
+TYPE_IMAGE = 1
+TYPE_FONT = 2
+
+FORMAT_RAW = 0
+FORMAT_RLE = 1
+
+RLE_MAX_RUN = 64
+RLE_LITERAL = 0x00
+RLE_ZEROS = 0x40
+RLE_ONES = 0x80
+RLE_REPEAT = 0xC0
+
+
+def pbm_tokens(data, pos, count):
+    """Reads count whitespace separated header tokens (skipping comments), returns them and the position after them."""
+    tokens = []
+    while len(tokens) < count:
+        m = re.compile(rb'\s*(#[^\n]*\n\s*)*(\S+)').match(data, pos)
+        if m is None:
+            raise ValueError('truncated PBM header')
+        tokens.append(m.group(2))
+        pos = m.end()
+    return tokens, pos
+
+
+def load_pbm(path):
+    with open(path, 'rb') as f:
+        data = f.read()
+    (magic, w, h), pos = pbm_tokens(data, 0, 3)
+    w = int(w)
+    h = int(h)
+    if magic == b'P1':
+        bits = [c - 0x30 for c in data[pos:] if c in (0x30, 0x31)]
+        rows = [bits[y * w:(y + 1) * w] for y in range(h)]
+    elif magic == b'P4':
+        pos += 1
+        stride = (w + 7) // 8
+        rows = []
+        for y in range(h):
+            row = data[pos + y * stride:pos + (y + 1) * stride]
+            rows.append([(row[x >> 3] >> (7 - (x & 7))) & 1 for x in range(w)])
+    else:
+        raise ValueError('%s: not a PBM file' % path)
+    if len(rows) != h or any(len(r) != w for r in rows):
+        raise ValueError('%s: truncated PBM data' % path)
+    return w, h, rows
+
+
+def load_png(path):
+    try:
+        from PIL import Image
+    except ImportError:
+        raise ValueError('%s: PNG sources need Pillow (pip install pillow)' % path)
+    img = Image.open(path).convert('L')
+    w, h = img.size
+    px = img.load()
+    return w, h, [[1 if px[x, y] >= 128 else 0 for x in range(w)] for y in range(h)]
+
+
+def load_bitmap(path, invert):
+    if path.lower().endswith('.png'):
+        w, h, rows = load_png(path)
+    else:
+        w, h, rows = load_pbm(path)
+    if invert:
+        rows = [[1 - b for b in r] for r in rows]
+    return w, h, rows
+
+
+def page_major(rows, x0, y0, w, h):
+    """Converts a w x h area of bit rows to page-major bytes (bit 0 of a byte is the top row of the page)."""
+    pages = (h + 7) // 8
+    out = bytearray(w * pages)
+    for y in range(h):
+        row = rows[y0 + y]
+        bit = 1 << (y & 7)
+        base = (y >> 3) * w
+        for x in range(w):
+            if row[x0 + x]:
+                out[base + x] |= bit
+    return out
+
+
+def rle_encode_row(row):
+    """Same encoding as bw_image_compress."""
+    out = bytearray()
+    i = 0
+    w = len(row)
+    while i < w:
+        n = 1
+        while i + n < w and n < RLE_MAX_RUN and row[i + n] == row[i]:
+            n += 1
+        if n >= 2 or row[i] in (0x00, 0xFF):
+            if row[i] == 0x00:
+                out.append(RLE_ZEROS | (n - 1))
+            elif row[i] == 0xFF:
+                out.append(RLE_ONES | (n - 1))
+            else:
+                out += bytes((RLE_REPEAT | (n - 1), row[i]))
+            i += n
+            continue
+        n = 1
+        while (i + n < w and n < RLE_MAX_RUN and row[i + n] not in (0x00, 0xFF) and
+               not (i + n + 1 < w and row[i + n + 1] == row[i + n])):
+            n += 1
+        out.append(RLE_LITERAL | (n - 1))
+        out += row[i:i + n]
+        i += n
+    return out
+
+
+def image_payload(w, h, data, rle):
+    if not rle:
+        return struct.pack('<HHB', w, h, FORMAT_RAW) + bytes(data)
+    pages = (h + 7) // 8
+    table = bytearray()
+    stream = bytearray()
+    for p in range(pages):
+        table += struct.pack('<H', len(stream))
+        stream += rle_encode_row(data[p * w:(p + 1) * w])
+    if len(stream) > 0xFFFF:
+        raise ValueError('compressed image too big')
+    return struct.pack('<HHB', w, h, FORMAT_RLE) + bytes(table) + bytes(stream)
+
+
+def font_payload(path, cell, first, spacing, default, invert):
+    w, h, rows = load_bitmap(path, invert)
+    cw, ch = cell
+    cols = w // cw
+    num = cols * (h // ch)
+    if num == 0:
+        raise ValueError('%s: no %dx%d cells' % (path, cw, ch))
+    bitmap = bytearray()
+    for i in range(num):
+        bitmap += page_major(rows, (i % cols) * cw, (i // cols) * ch, cw, ch)
+    header = struct.pack('<BBBBIHHIII', ch, cw, spacing, 0, first, num, 0, default, 0, FONT_HEADER_SIZE)
+    return header + bytes(bitmap)
+
+
+def fnv1a(name):
+    h = 2166136261
+    for c in name.encode():
+        h = ((h ^ c) * 16777619) & 0xFFFFFFFF
+    return h
+
+
+def build(assets):
+    """assets: list of (name, type, payload). Returns pack bytes."""
+    n = len(assets)
+    hash_size = 1
+    while hash_size < 2 * n:
+        hash_size *= 2
+    table = [0] * hash_size
+    for i, (name, _, _) in enumerate(assets):
+        slot = fnv1a(name) & (hash_size - 1)
+        while table[slot] != 0:
+            slot = (slot + 1) & (hash_size - 1)
+        table[slot] = i + 1
+    offset = HEADER_SIZE + n * ENTRY_SIZE + 2 * hash_size
+    entries = bytearray()
+    payloads = bytearray()
+    for name, typ, payload in assets:
+        pad = (-(offset + len(payloads))) & 3
+        payloads += bytes(pad)
+        entries += struct.pack('<20sB3xII', name.encode(), typ, offset + len(payloads), len(payload))
+        payloads += payload
+    size = offset + len(payloads)
+    header = MAGIC + struct.pack('<HHHHI', VERSION, n, hash_size, 0, size)
+    return header + bytes(entries) + struct.pack('<%dH' % hash_size, *table) + bytes(payloads)
+
+
+def main():
+    ap = argparse.ArgumentParser(description='Builds a bw_disp asset pack from PBM/PNG images.')
+    ap.add_argument('-o', '--output', required=True, help='pack file')
+    ap.add_argument('-H', '--header', help='C header with asset ids')
+    ap.add_argument('--rle', action='store_true', help='compress images')
+    ap.add_argument('--invert', action='store_true', help='swap lit and unlit pixels of the sources')
+    ap.add_argument('--image', action='append', default=[], metavar='NAME=FILE')
+    ap.add_argument('--font', action='append', default=[], metavar='NAME=FILE:WxH[:FIRST[:SPACING[:DEFAULT]]]')
+    args = ap.parse_args()
+
+    assets = []
+    try:
+        for spec in args.image:
+            name, _, path = spec.partition('=')
+            w, h, rows = load_bitmap(path, args.invert)
+            assets.append((name, TYPE_IMAGE, image_payload(w, h, page_major(rows, 0, 0, w, h), args.rle)))
+        for spec in args.font:
+            name, _, rest = spec.partition('=')
+            parts = rest.split(':')
+            cw, ch = (int(v) for v in parts[1].lower().split('x'))
+            first = int(parts[2], 0) if len(parts) > 2 else 0x20
+            spacing = int(parts[3], 0) if len(parts) > 3 else 1
+            default = int(parts[4], 0) if len(parts) > 4 else ord('?')
+            assets.append((name, TYPE_FONT, font_payload(parts[0], (cw, ch), first, spacing, default, args.invert)))
+        names = set()
+        for name, _, _ in assets:
+            if not name or len(name.encode()) > NAME_MAX_LEN or name in names:
+                raise ValueError('invalid or duplicate asset name: "%s"' % name)
+            names.add(name)
+    except (ValueError, IndexError, OSError) as e:
+        sys.exit('bw_asset_pack: %s' % e)
+
+    pack = build(assets)
+    with open(args.output, 'wb') as f:
+        f.write(pack)
+    if args.header:
+        with open(args.header, 'w') as f:
+            f.write('// Generated by bw_asset_pack.py - do not edit\n\n#pragma once\n\n')
+            for i, (name, _, _) in enumerate(assets):
+                f.write('#define BWA_ID_%s %d\n' % (re.sub(r'\W', '_', name).upper(), i))
+    print('%s: %d assets, %d bytes' % (args.output, len(assets), len(pack)))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,94 @@
+#!/usr/bin/env python3
+# bw_trace_convert.py - converts a binary operation trace (see bw_disp_trace.h) to Chrome trace-event JSON
+#
+# Usage:
+#   bw_trace_convert.py trace.bin -o trace.json
+#
+# The output opens in chrome://tracing or Perfetto (ui.perfetto.dev) and matches bw_trace_export_json:
+# a thread per display handle and per protocol handle, timestamps relative to the earliest start.
+
+import argparse
+import json
+import struct
+import sys
+
+MAGIC = b'BWTR'
+VERSION = 1
+HEADER_SIZE = 12
+EVENT_SIZE = 16
+
+OP_NAMES = [
+    'fill', 'pixel', 'line', 'rect', 'circle', 'polygon', 'image', 'text',
+    'refresh', 'refresh_page',
+    'write_command', 'write_commands', 'write_data_byte', 'write_data', 'write_segments',
+]
+OP_REFRESH = OP_NAMES.index('refresh')
+OP_WRITE_COMMAND = OP_NAMES.index('write_command')
+
+FLAG_ERROR = 0x01
+PROTO_TID = 0x10000
+
+
+def load(data):
+    """Parses the dump, returns list of (ts_us, dur_us, len, handle, op, flags) tuples (oldest first)."""
+    if len(data) < HEADER_SIZE:
+        raise ValueError('truncated header')
+    magic, version, event_size, num = struct.unpack_from('<4sHHI', data, 0)
+    if magic != MAGIC or version != VERSION:
+        raise ValueError('not a version %d trace dump' % VERSION)
+    if event_size < EVENT_SIZE or len(data) < HEADER_SIZE + num * event_size:
+        raise ValueError('truncated events')
+    return [struct.unpack_from('<IIIHBB', data, HEADER_SIZE + i * event_size) for i in range(num)]
+
+
+def base_ts(events):
+    """Gets the earliest start of the events (a parent is recorded after its nested events, when it ends)."""
+    base = events[0][0] if events else 0
+    for ev in events:
+        # signed 32-bit difference, the wrap-around does not matter
+        if (ev[0] - base) & 0xFFFFFFFF >= 0x80000000:
+            base = ev[0]
+    return base
+
+
+def convert(events):
+    base = base_ts(events)
+    out = [{'name': 'process_name', 'ph': 'M', 'pid': 1, 'tid': 0, 'args': {'name': 'tg_esp_bw_display'}}]
+    threads = set()
+    for ts, dur, length, handle, op, flags in events:
+        proto = op >= OP_WRITE_COMMAND
+        tid = PROTO_TID + handle if proto else handle
+        if tid not in threads:
+            threads.add(tid)
+            out.append({'name': 'thread_name', 'ph': 'M', 'pid': 1, 'tid': tid,
+                        'args': {'name': '%s #%u' % ('protocol' if proto else 'display', handle)}})
+        args = {'len': length}
+        if flags & FLAG_ERROR:
+            args['error'] = True
+        out.append({'name': OP_NAMES[op] if op < len(OP_NAMES) else 'unknown',
+                    'cat': 'proto' if proto else 'refresh' if op >= OP_REFRESH else 'draw',
+                    'ph': 'X', 'pid': 1, 'tid': tid,
+                    # 32-bit timestamps relative to the earliest start, the differences survive the wrap-around
+                    'ts': (ts - base) & 0xFFFFFFFF, 'dur': dur, 'args': args})
+    return {'traceEvents': out}
+
+
+def main():
+    ap = argparse.ArgumentParser(description='Converts a binary bw_disp operation trace to Chrome trace-event JSON.')
+    ap.add_argument('input', help='binary trace (bw_trace_export_bin)')
+    ap.add_argument('-o', '--output', required=True, help='JSON file')
+    args = ap.parse_args()
+
+    try:
+        with open(args.input, 'rb') as f:
+            events = load(f.read())
+    except (ValueError, OSError) as e:
+        sys.exit('bw_trace_convert: %s' % e)
+
+    with open(args.output, 'w') as f:
+        json.dump(convert(events), f)
+    print('%s: %d events' % (args.output, len(events)))
+
+
+if __name__ == '__main__':
+    main()
@@ -8,11 +8,21 @@
 
 #include "disp_proto.h"
 #include "bw_disp.h"
+#include "bw_disp_sprite.h"
 
 
+// 1 - display connected over SPI (4-wire), 0 - over I2C
+#define DISP_USE_SPI 0
+
 #define SDA_PIN GPIO_NUM_21
 #define SCL_PIN GPIO_NUM_22
 
+#define MOSI_PIN GPIO_NUM_23
+#define SCLK_PIN GPIO_NUM_18
+#define CS_PIN   GPIO_NUM_5
+#define DC_PIN   GPIO_NUM_17
+#define RST_PIN  GPIO_NUM_16
+
 #define TAG "BW_DISPLAY_TEST"
 
 
@@ -36,15 +46,19 @@ bw_image_t img_tennis_ball =
 
 void app_main(void)
 {
-    disp_proto_handle_t disp_i2c = disp_proto_init_i2c(I2C_NUM_0, 1000000, BWD_OLED_I2C_ADDRESS, SDA_PIN, SCL_PIN);
+#if DISP_USE_SPI
+    disp_proto_handle_t disp_conn = disp_proto_init_spi(SPI2_HOST, 8000000, MOSI_PIN, SCLK_PIN, CS_PIN, DC_PIN, RST_PIN);
+#else
+    disp_proto_handle_t disp_conn = disp_proto_init_i2c(I2C_NUM_0, 1000000, BWD_OLED_I2C_ADDRESS, SDA_PIN, SCL_PIN);
+#endif
     bw_disp_handle_t disp = INVALID_HANDLE;
-    if (disp_i2c == INVALID_HANDLE)
+    if (disp_conn == INVALID_HANDLE)
     {
-        ESP_LOGE(TAG, "I2C initialization failed!");
+        ESP_LOGE(TAG, "Connection initialization failed!");
     }
     else
     {
-        disp = bw_disp_init(disp_i2c, BWD_SH1106_128X64);
+        disp = bw_disp_init(disp_conn, BWD_SH1106_128X64);
         if (disp == INVALID_HANDLE)
         {
             ESP_LOGE(TAG, "Display initialization failed!");
@@ -62,7 +76,10 @@ void app_main(void)
     uint16_t y = 16;
     uint16_t width = bw_disp_get_width(disp);
     uint16_t height = bw_disp_get_height(disp);
-    bw_disp_image(disp, x, y, &img_tennis_ball);
+    bw_sprite_handle_t ball = bw_sprite_create(disp, &img_tennis_ball, BWDM_OVERRIDE, 0);
+    bw_sprite_move(ball, x, y);
+    bw_sprite_show(ball, true);
+    bw_sprite_update(disp);
     uint16_t iw = img_tennis_ball.width;
     uint16_t ih = img_tennis_ball.height;
 
@@ -72,7 +89,6 @@ void app_main(void)
     vTaskDelay(1000/portTICK_PERIOD_MS);
     while (1)
     {
-        bw_disp_fill_rect(disp, x, y, iw, ih, BWDC_BLACK);
         x += dx;
         if (x == 0 || (x == (width - iw)))
         {
@@ -83,7 +99,8 @@ void app_main(void)
         {
             dy = -dy;
         }
-        bw_disp_image(disp, x, y, &img_tennis_ball);
+        bw_sprite_move(ball, x, y);
+        bw_sprite_update(disp);
         bw_disp_refresh(disp);
         vTaskDelay(10/portTICK_PERIOD_MS);
     }    